@@ -0,0 +1,428 @@
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define ANIMATION_SSE2
+#endif
+
+#include "Animation.h"
+
+namespace
+{
+	// Levels per channel of the palette and the step between blue, green and red in an index
+	const int		kBlueLevels = 6;
+	const int		kGreenLevels = 7;
+	const int		kRedLevels = 6;
+	const int		kGreenStep = kBlueLevels;
+	const int		kRedStep = kBlueLevels * kGreenLevels;
+
+	// 4x4 Bayer matrix scaled to thresholds in [0, 255)
+	const uint8_t	kDither[4][4] = {
+		{   8, 136,  40, 168 },
+		{ 200,  72, 232, 104 },
+		{  56, 184,  24, 152 },
+		{ 248, 120, 216,  88 },
+	};
+
+	const uint8_t	kPngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	// Level of one 8-bit component: (value * (levels - 1) + threshold) / 255, the division done as (t + 1) * 257 >> 16,
+	// which is exact for t up to 65534 and maps onto _mm_mulhi_epu16
+	inline int QuantizeComponent(int value, int levels, int threshold)
+	{
+		return (int)(((uint32_t)(value * (levels - 1) + threshold + 1) * 257) >> 16);
+	}
+
+	struct PngChunk
+	{
+		const uint8_t*		type;
+		const uint8_t*		data;
+		uint32_t			size;
+	};
+
+	inline uint32_t ReadBigEndian32(const uint8_t* p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+
+	inline void AppendBigEndian32(std::vector<uint8_t>& out, uint32_t value)
+	{
+		out.push_back((uint8_t)(value >> 24));
+		out.push_back((uint8_t)(value >> 16));
+		out.push_back((uint8_t)(value >> 8));
+		out.push_back((uint8_t)value);
+	}
+
+	inline void AppendBigEndian16(std::vector<uint8_t>& out, uint16_t value)
+	{
+		out.push_back((uint8_t)(value >> 8));
+		out.push_back((uint8_t)value);
+	}
+
+	const uint32_t* GetCrcTable()
+	{
+		static uint32_t table[256];
+		static bool initialized = [] {
+			for (uint32_t n = 0; n < 256; n++)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+				table[n] = c;
+			}
+			return true;
+		}();
+		(void)initialized;
+		return table;
+	}
+
+	uint32_t UpdateCrc(uint32_t crc, const uint8_t* data, size_t size)
+	{
+		const uint32_t* table = GetCrcTable();
+		for (size_t i = 0; i < size; i++)
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return crc;
+	}
+
+	// Chunk with its CRC over type and data; prefix is written in front of data, for the sequence number of fdAT
+	void AppendChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* prefix, size_t prefixSize, const uint8_t* data, size_t size)
+	{
+		AppendBigEndian32(out, (uint32_t)(prefixSize + size));
+
+		size_t start = out.size();
+		out.insert(out.end(), (const uint8_t*)type, (const uint8_t*)type + 4);
+		if (prefixSize > 0)
+			out.insert(out.end(), prefix, prefix + prefixSize);
+		if (size > 0)
+			out.insert(out.end(), data, data + size);
+
+		uint32_t crc = UpdateCrc(0xffffffffu, out.data() + start, out.size() - start);
+		AppendBigEndian32(out, crc ^ 0xffffffffu);
+	}
+
+	bool IsChunk(const PngChunk& chunk, const char* type)
+	{
+		return memcmp(chunk.type, type, 4) == 0;
+	}
+
+	bool ParsePng(const uint8_t* png, size_t size, std::vector<PngChunk>& chunks)
+	{
+		size_t offset = sizeof(kPngSignature);
+
+		chunks.clear();
+		if ((size < offset) || (memcmp(png, kPngSignature, sizeof(kPngSignature)) != 0))
+			return false;
+
+		while (offset + 12 <= size)
+		{
+			uint32_t length = ReadBigEndian32(png + offset);
+			if (length > size - offset - 12)
+				return false;
+
+			PngChunk chunk = { png + offset + 4, png + offset + 8, length };
+			chunks.push_back(chunk);
+			offset += 12 + (size_t)length;
+
+			if (IsChunk(chunk, "IEND"))
+				return (chunks.size() > 1) && IsChunk(chunks[0], "IHDR") && (chunks[0].size == 13);
+		}
+		return false;
+	}
+
+	std::vector<uint8_t> MakeFrameControl(uint32_t sequence, const Animation::ApngFrame& frame)
+	{
+		std::vector<uint8_t> control;
+
+		control.reserve(26);
+		AppendBigEndian32(control, sequence);
+		AppendBigEndian32(control, (uint32_t)frame.rect.width);
+		AppendBigEndian32(control, (uint32_t)frame.rect.height);
+		AppendBigEndian32(control, (uint32_t)frame.rect.x);
+		AppendBigEndian32(control, (uint32_t)frame.rect.y);
+		AppendBigEndian16(control, frame.delayNumerator);
+		AppendBigEndian16(control, frame.delayDenominator);
+		control.push_back(0);							// dispose_op NONE, the canvas is kept for the next frame
+		control.push_back(frame.blend ? 1 : 0);			// blend_op OVER or SOURCE
+		return control;
+	}
+
+	// First and last byte offsets at which two rows differ, false if they are equal
+	bool FindRowChange(const uint8_t* a, const uint8_t* b, long bytes, long& first, long& last)
+	{
+		long i = 0;
+
+		first = -1;
+#if defined(ANIMATION_SSE2)
+		for (; i + 16 <= bytes; i += 16)
+		{
+			int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+			if (equal != 0xffff)
+				break;
+		}
+#endif
+		for (; i < bytes; i++)
+		{
+			if (a[i] != b[i])
+			{
+				first = i;
+				break;
+			}
+		}
+		if (first < 0)
+			return false;
+
+		long j = bytes;
+#if defined(ANIMATION_SSE2)
+		for (; j - 16 > first; j -= 16)
+		{
+			int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + j - 16)), _mm_loadu_si128((const __m128i*)(b + j - 16))));
+			if (equal != 0xffff)
+				break;
+		}
+#endif
+		for (; j > first; j--)
+		{
+			if (a[j - 1] != b[j - 1])
+				break;
+		}
+		last = j - 1;
+		return true;
+	}
+}
+
+void Animation::GetPalette(uint32_t palette[256])
+{
+	for (int i = 0; i < 256; i++)
+	{
+		if (i >= kPaletteColors)
+		{
+			palette[i] = 0;
+			continue;
+		}
+
+		uint32_t red = (uint32_t)(i / kRedStep) * 255 / (kRedLevels - 1);
+		uint32_t green = (uint32_t)(i / kGreenStep % kGreenLevels) * 255 / (kGreenLevels - 1);
+		uint32_t blue = (uint32_t)(i % kBlueLevels) * 255 / (kBlueLevels - 1);
+		palette[i] = 0xff000000u | (red << 16) | (green << 8) | blue;
+	}
+}
+
+void Animation::Quantize(const uint8_t* bgra, long rowBytes, long width, long height, uint8_t* indexes)
+{
+	for (long y = 0; y < height; y++)
+	{
+		const uint8_t*	src = bgra + (size_t)y * rowBytes;
+		uint8_t*		dst = indexes + (size_t)y * width;
+		const uint8_t*	thresholds = kDither[y & 3];
+		long			x = 0;
+
+#if defined(ANIMATION_SSE2)
+		// 4 pixels per step, widened to 16-bit B, G, R, A lanes: level = mulhi(value * (levels - 1) + threshold + 1, 257),
+		// then the index as B + 6 G + 42 R with one multiply-add
+		const __m128i	zero = _mm_setzero_si128();
+		const __m128i	levels = _mm_setr_epi16(kBlueLevels - 1, kGreenLevels - 1, kRedLevels - 1, 0, kBlueLevels - 1, kGreenLevels - 1, kRedLevels - 1, 0);
+		const __m128i	steps = _mm_setr_epi16(1, kGreenStep, kRedStep, 0, 1, kGreenStep, kRedStep, 0);
+		const __m128i	divisor = _mm_set1_epi16(257);
+		const __m128i	thresholdLow = _mm_setr_epi16(thresholds[0] + 1, thresholds[0] + 1, thresholds[0] + 1, 0, thresholds[1] + 1, thresholds[1] + 1, thresholds[1] + 1, 0);
+		const __m128i	thresholdHigh = _mm_setr_epi16(thresholds[2] + 1, thresholds[2] + 1, thresholds[2] + 1, 0, thresholds[3] + 1, thresholds[3] + 1, thresholds[3] + 1, 0);
+
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)(src + x * 4));
+			__m128i low = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), levels), thresholdLow), divisor);
+			__m128i high = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), levels), thresholdHigh), divisor);
+
+			// 32-bit B + 6 G and 42 R per pixel, summed into lanes 0 and 2
+			low = _mm_madd_epi16(low, steps);
+			high = _mm_madd_epi16(high, steps);
+			low = _mm_add_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+			high = _mm_add_epi32(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+
+			__m128i sums = _mm_unpacklo_epi64(_mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0)));
+			sums = _mm_packs_epi32(sums, sums);
+			int packed = _mm_cvtsi128_si32(_mm_packus_epi16(sums, sums));
+			memcpy(dst + x, &packed, 4);
+		}
+#endif
+
+		for (; x < width; x++)
+		{
+			int threshold = thresholds[x & 3];
+			dst[x] = (uint8_t)(QuantizeComponent(src[x * 4], kBlueLevels, threshold) +
+				QuantizeComponent(src[x * 4 + 1], kGreenLevels, threshold) * kGreenStep +
+				QuantizeComponent(src[x * 4 + 2], kRedLevels, threshold) * kRedStep);
+		}
+	}
+}
+
+PixelConverter::Rect Animation::GetChangedRect(const uint8_t* previous, const uint8_t* current, long rowBytes, long width, long height, int pixelBytes)
+{
+	long left = width;
+	long right = -1;
+	long top = -1;
+	long bottom = -1;
+
+	for (long y = 0; y < height; y++)
+	{
+		long first;
+		long last;
+
+		if (!FindRowChange(previous + (size_t)y * rowBytes, current + (size_t)y * rowBytes, width * pixelBytes, first, last))
+			continue;
+
+		if (top < 0)
+			top = y;
+		bottom = y;
+		left = (std::min)(left, first / pixelBytes);
+		right = (std::max)(right, last / pixelBytes);
+	}
+
+	if (top < 0)
+		return { 0, 0, 0, 0 };
+	return { left, top, right - left + 1, bottom - top + 1 };
+}
+
+void Animation::CopyChanged(const uint8_t* previous, const uint8_t* current, long rowBytes, const PixelConverter::Rect& rect, int pixelBytes,
+	uint8_t* dst, long dstRowBytes)
+{
+	for (long y = 0; y < rect.height; y++)
+	{
+		size_t			offset = (size_t)(rect.y + y) * rowBytes + (size_t)rect.x * pixelBytes;
+		const uint8_t*	a = previous + offset;
+		const uint8_t*	b = current + offset;
+		uint8_t*		out = dst + (size_t)y * dstRowBytes;
+		long			bytes = rect.width * pixelBytes;
+		long			i = 0;
+
+#if defined(ANIMATION_SSE2)
+		// Equal 4-byte pixels become 0 (transparent BGRA), equal indexes become kTransparentIndex
+		const __m128i transparent = _mm_set1_epi8((char)kTransparentIndex);
+
+		for (; i + 16 <= bytes; i += 16)
+		{
+			__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+			__m128i result;
+
+			if (pixelBytes == 4)
+				result = _mm_andnot_si128(_mm_cmpeq_epi32(va, vb), vb);
+			else
+			{
+				__m128i equal = _mm_cmpeq_epi8(va, vb);
+				result = _mm_or_si128(_mm_and_si128(equal, transparent), _mm_andnot_si128(equal, vb));
+			}
+			_mm_storeu_si128((__m128i*)(out + i), result);
+		}
+#endif
+
+		for (; i < bytes; i += pixelBytes)
+		{
+			if (memcmp(a + i, b + i, pixelBytes) != 0)
+				memcpy(out + i, b + i, pixelBytes);
+			else if (pixelBytes == 1)
+				out[i] = kTransparentIndex;
+			else
+				memset(out + i, 0, pixelBytes);
+		}
+	}
+}
+
+bool Animation::AssembleApng(const std::vector<ApngFrame>& frames, std::vector<uint8_t>& apng)
+{
+	std::vector<PngChunk>	chunks;
+	uint8_t					header[13];
+	uint32_t				sequence = 0;
+
+	apng.clear();
+	if (frames.empty() || !ParsePng(frames[0].png, frames[0].size, chunks))
+		return false;
+	memcpy(header, chunks[0].data, sizeof(header));
+
+	apng.reserve(frames[0].size * 2);
+	apng.insert(apng.end(), kPngSignature, kPngSignature + sizeof(kPngSignature));
+	AppendChunk(apng, "IHDR", NULL, 0, header, sizeof(header));
+
+	uint8_t animationControl[8];
+	animationControl[0] = (uint8_t)(frames.size() >> 24);
+	animationControl[1] = (uint8_t)(frames.size() >> 16);
+	animationControl[2] = (uint8_t)(frames.size() >> 8);
+	animationControl[3] = (uint8_t)frames.size();
+	memset(animationControl + 4, 0, 4);		// num_plays 0, loop forever
+	AppendChunk(apng, "acTL", NULL, 0, animationControl, sizeof(animationControl));
+
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		const ApngFrame& frame = frames[i];
+
+		if ((i > 0) && !ParsePng(frame.png, frame.size, chunks))
+			return false;
+
+		// Every frame has to fit the canvas and share the bit depth, color type and interlacing of the first
+		const uint8_t* frameHeader = chunks[0].data;
+		if ((ReadBigEndian32(frameHeader) != (uint32_t)frame.rect.width) || (ReadBigEndian32(frameHeader + 4) != (uint32_t)frame.rect.height) ||
+			(memcmp(frameHeader + 8, header + 8, 5) != 0) ||
+			(frame.rect.x < 0) || (frame.rect.y < 0) || (frame.rect.x + frame.rect.width > (long)ReadBigEndian32(header)) ||
+			(frame.rect.y + frame.rect.height > (long)ReadBigEndian32(header + 4)) ||
+			((i == 0) && ((frame.rect.x != 0) || (frame.rect.y != 0))))
+			return false;
+
+		// Ancillary chunks of the first frame (color space, physical size) describe the whole image and precede the data
+		if (i == 0)
+		{
+			for (const PngChunk& chunk : chunks)
+			{
+				if (IsChunk(chunk, "IDAT"))
+					break;
+				if (!IsChunk(chunk, "IHDR"))
+					AppendChunk(apng, (const char*)chunk.type, NULL, 0, chunk.data, chunk.size);
+			}
+		}
+
+		std::vector<uint8_t> frameControl = MakeFrameControl(sequence++, frame);
+		AppendChunk(apng, "fcTL", NULL, 0, frameControl.data(), frameControl.size());
+
+		// The first frame is also the default image, so its data stays IDAT; later frames go into fdAT
+		for (const PngChunk& chunk : chunks)
+		{
+			if (!IsChunk(chunk, "IDAT"))
+				continue;
+
+			if (i == 0)
+			{
+				AppendChunk(apng, "IDAT", NULL, 0, chunk.data, chunk.size);
+			}
+			else
+			{
+				uint8_t sequenceBytes[4] = { (uint8_t)(sequence >> 24), (uint8_t)(sequence >> 16), (uint8_t)(sequence >> 8), (uint8_t)sequence };
+				AppendChunk(apng, "fdAT", sequenceBytes, sizeof(sequenceBytes), chunk.data, chunk.size);
+				sequence++;
+			}
+		}
+	}
+
+	AppendChunk(apng, "IEND", NULL, 0, NULL, 0);
+	return true;
+}
+
+void Animation::ParallelFrames(size_t count, const std::function<void(size_t frame)>& work)
+{
+	size_t						threadCount = (std::min)((size_t)PixelConverter::GetThreadCount(), count);
+	std::atomic<size_t>			next{ 0 };
+	std::vector<std::thread>	threads;
+
+	// Frames are taken one at a time, their cost differs with how much of them changed
+	auto worker = [&] {
+		for (size_t frame = next++; frame < count; frame = next++)
+			work(frame);
+	};
+
+	for (size_t t = 1; t < threadCount; t++)
+		threads.emplace_back(worker);
+	worker();
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
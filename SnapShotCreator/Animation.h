@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "PixelConverter.h"
+
+// Building blocks of the animated image formats: frame differencing, the fixed GIF palette and APNG assembly.
+// Frames are 8-bit BGRA or 8-bit palette indexes; all of it works on plain buffers and leaves encoding to WIC.
+namespace Animation
+{
+	// 6 levels of red, 7 of green and 6 of blue in the first 252 entries; entry 255 is transparent
+	const int			kPaletteColors = 252;
+	const uint8_t		kTransparentIndex = 255;
+
+	// Palette entries as 0xAARRGGBB
+	void GetPalette(uint32_t palette[256]);
+
+	// BGRA to palette indexes with a 4x4 ordered dither, indexes has width bytes per row
+	void Quantize(const uint8_t* bgra, long rowBytes, long width, long height, uint8_t* indexes);
+
+	// Bounding box of the pixels that differ between two images of the same layout, width 0 if they are identical
+	PixelConverter::Rect GetChangedRect(const uint8_t* previous, const uint8_t* current, long rowBytes, long width, long height, int pixelBytes);
+
+	// Copy rect of current to dst, pixels equal in previous become transparent so that the frame before shows through:
+	// BGRA 0 for 4-byte pixels, kTransparentIndex for palette indexes
+	void CopyChanged(const uint8_t* previous, const uint8_t* current, long rowBytes, const PixelConverter::Rect& rect, int pixelBytes,
+		uint8_t* dst, long dstRowBytes);
+
+	// One frame of an APNG, a complete PNG of the part of the canvas it covers
+	struct ApngFrame
+	{
+		const uint8_t*			png;
+		size_t					size;
+		PixelConverter::Rect	rect;				// position on the canvas
+		uint16_t				delayNumerator;		// display time in seconds, as a fraction
+		uint16_t				delayDenominator;
+		bool					blend;				// transparent pixels keep the canvas, otherwise they replace it
+	};
+
+	// Combine the frames into an endlessly looping APNG, sized and typed by the first frame which covers the canvas.
+	// Returns false if a frame is not a PNG or does not match the first one.
+	bool AssembleApng(const std::vector<ApngFrame>& frames, std::vector<uint8_t>& apng);
+
+	// Run work for each of count frames on up to as many threads as the pixel converter uses
+	void ParallelFrames(size_t count, const std::function<void(size_t frame)>& work);
+};
@@ -74,14 +74,14 @@ HRESULT	STDMETHODCALLTYPE Bgr24VideoFrame::QueryInterface(REFIID iid, LPVOID *pp
 
 ULONG STDMETHODCALLTYPE Bgr24VideoFrame::AddRef(void)
 {
-	return m_refCount.fetch_add(1);
+	return m_refCount.fetch_add(1) + 1;
 }
 
 ULONG STDMETHODCALLTYPE Bgr24VideoFrame::Release(void)
 {
 	ULONG		newRefValue;
 
-	newRefValue = m_refCount.fetch_sub(1);
+	newRefValue = m_refCount.fetch_sub(1) - 1;
 	if (newRefValue == 0)
 	{
 		delete this;
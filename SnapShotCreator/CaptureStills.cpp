@@ -27,25 +27,284 @@
 // CaptureStills.cpp
 //
 
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
 #include "include/spdlog/spdlog.h"
 #include "platform.h"
 #include "Bgr24VideoFrame.h"
 #include "Bgra32VideoFrame.h"
+#include "Rgb48VideoFrame.h"
+#include "PixelConverter.h"
 #include "DeckLinkInputDevice.h"
 #include "DeckLinkAPI.h"
 #include "ImageWriter.h"
+#include "FrameHash.h"
+#include "FrameAccumulator.h"
 
 #include "CaptureStills.h"
 
-void CaptureStills::CreateSnapshot(DeckLinkInputDevice* deckLinkInput, const std::string& captureDirectory, const std::string& filenamePrefix, const std::string& imageFormat,
-	std::string& filepath, std::string& err)
+namespace
 {
-	HRESULT						result = S_OK;
-	bool						captureRunning = true;
+	// Largest width or height of a contact sheet
+	const long					kMaxContactSheetSize = 16384;
 
-	IDeckLinkVideoFrame*		receivedVideoFrame = NULL;
-	IDeckLinkVideoConversion*	deckLinkFrameConverter = NULL;
-	IDeckLinkVideoFrame*		videoFrame = NULL;
+	// Length of an animated image if the request gives none, and the memory its converted frames may take
+	const double				kDefaultAnimationDuration = 2.0;
+	const size_t				kMaxAnimationBytes = 512 * 1024 * 1024;
+
+	// One image written from a captured frame
+	struct OutputImage
+	{
+		std::string				captureDirectory;
+		std::string				filenamePrefix;
+		std::string				imageFormat;
+		int						bitDepth;
+		PixelConverter::Rect	region;		// part of the captured frame to write
+		PixelConverter::Deinterlace	deinterlace;	// none unless the frame is interlaced
+		BMDFieldDominance		fieldDominance;
+		long					width;
+		long					height;
+		bool					thumbnail;	// named after the preceding output with a "_thumb" suffix
+		std::string				filepath;
+	};
+
+	// Last snapshot written, guarded by g_snapshotMutex
+	std::mutex					g_snapshotMutex;
+	FrameHash::Fingerprint		g_lastFingerprint;
+	std::vector<OutputImage>	g_lastOutputs;
+
+	// The requested region of interest, or the whole frame if none was given
+	PixelConverter::Rect GetRegion(IDeckLinkVideoFrame* videoFrame, const Protocol::Region& roi)
+	{
+		if ((roi.width == 0) && (roi.height == 0))
+			return { 0, 0, videoFrame->GetWidth(), videoFrame->GetHeight() };
+
+		// Compared as differences, the sums of huge requested values would overflow a long
+		if ((roi.x < 0) || (roi.y < 0) || (roi.width <= 0) || (roi.height <= 0) ||
+			(roi.width > videoFrame->GetWidth() - roi.x) || (roi.height > videoFrame->GetHeight() - roi.y))
+			throw std::runtime_error("Region of interest is outside the " + std::to_string(videoFrame->GetWidth()) + "x" +
+				std::to_string(videoFrame->GetHeight()) + " frame");
+
+		return { roi.x, roi.y, roi.width, roi.height };
+	}
+
+	// The deinterlacing the request asks for, none for frames of progressive display modes
+	PixelConverter::Deinterlace GetDeinterlace(const Protocol::CommandRequest& request, BMDFieldDominance fieldDominance)
+	{
+		if (!PixelConverter::IsInterlaced(fieldDominance))
+			return PixelConverter::kDeinterlaceNone;
+		else if (request.deinterlace == "field")
+			return PixelConverter::kDeinterlaceField;
+		else if (request.deinterlace == "blend")
+			return PixelConverter::kDeinterlaceBlend;
+		else if (request.deinterlace == "adaptive")
+			return PixelConverter::kDeinterlaceAdaptive;
+		return PixelConverter::kDeinterlaceNone;
+	}
+
+	// Output size for a scale factor and an optional width limit, never larger than the frame
+	void GetScaledSize(long width, long height, double scale, int maxWidth, long& scaledWidth, long& scaledHeight)
+	{
+		scaledWidth = (std::max)(1L, (long)lround(width * scale));
+		scaledHeight = (std::max)(1L, (long)lround(height * scale));
+
+		if ((maxWidth > 0) && (scaledWidth > maxWidth))
+		{
+			scaledHeight = (std::max)(1L, (long)lround((double)scaledHeight * maxWidth / scaledWidth));
+			scaledWidth = maxWidth;
+		}
+	}
+
+	// Returns a new reference to a frame in the pixel format and size the encoder of the output expects
+	IDeckLinkVideoFrame* ConvertForOutput(IDeckLinkVideoFrame* receivedVideoFrame, IDeckLinkVideoConversion* deckLinkFrameConverter, const OutputImage& output)
+	{
+		HRESULT					result = S_OK;
+		IDeckLinkVideoFrame*	videoFrame = NULL;
+		bool					fullSize = (output.width == receivedVideoFrame->GetWidth()) && (output.height == receivedVideoFrame->GetHeight());
+		bool					wholeFrame = (output.region.width == receivedVideoFrame->GetWidth()) && (output.region.height == receivedVideoFrame->GetHeight());
+
+		if (output.imageFormat == "raw")
+		{
+			// Raw frames are written in the captured pixel format - no conversion required
+			videoFrame = receivedVideoFrame;
+			videoFrame->AddRef();
+		}
+		else if ((output.bitDepth == 16) || !fullSize || !wholeFrame || (output.deinterlace != PixelConverter::kDeinterlaceNone))
+		{
+			// Unpacked straight from the captured pixel format, deinterlaced, cropped and scaled in the same pass,
+			// DeckLink conversion only goes to 8 bits of the whole frame at full size
+			if (output.bitDepth == 16)
+			{
+				spdlog::debug("Converting to {}x{} 16-bit RGB video frame", output.width, output.height);
+				videoFrame = new Rgb48VideoFrame(output.width, output.height, receivedVideoFrame->GetFlags());
+			}
+			else
+			{
+				spdlog::debug("Converting to {}x{} 32-bit BGRA video frame", output.width, output.height);
+				videoFrame = new Bgra32VideoFrame(output.width, output.height, receivedVideoFrame->GetFlags());
+			}
+
+			result = PixelConverter::ConvertFrame(receivedVideoFrame, output.region, videoFrame, output.deinterlace, output.fieldDominance);
+		}
+		else if (receivedVideoFrame->GetPixelFormat() == bmdFormat8BitBGRA)
+		{
+			// Frame is already 8-bit BGRA - no conversion required
+			spdlog::debug("Frame is already 8-bit BGRA - no conversion required");
+			videoFrame = receivedVideoFrame;
+			videoFrame->AddRef();
+		}
+		else
+		{
+			if (output.imageFormat == "jpeg")
+			{
+				// FIXME: Bgr24VideoFrame outputs incorrect images.
+				spdlog::debug("Converting to 24-bit BGR video frame");
+				videoFrame = new Bgr24VideoFrame(receivedVideoFrame->GetWidth(), receivedVideoFrame->GetHeight(), receivedVideoFrame->GetFlags());
+			}
+			else
+			{
+				spdlog::debug("Converting to 32-bit BGRA video frame");
+				videoFrame = new Bgra32VideoFrame(receivedVideoFrame->GetWidth(), receivedVideoFrame->GetHeight(), receivedVideoFrame->GetFlags());
+			}
+
+			result = deckLinkFrameConverter->ConvertFrame(receivedVideoFrame, videoFrame);
+		}
+
+		if (FAILED(result))
+		{
+			videoFrame->Release();
+			throw std::runtime_error("Frame conversion was unsuccessful");
+		}
+
+		return videoFrame;
+	}
+
+	// Outputs that read the same converted frame: same encoder input format, region and size
+	bool SharesConversion(const OutputImage& a, const OutputImage& b)
+	{
+		return ((a.imageFormat == "raw") == (b.imageFormat == "raw")) &&
+			((a.imageFormat == "jpeg") == (b.imageFormat == "jpeg")) &&
+			(a.bitDepth == b.bitDepth) && (a.deinterlace == b.deinterlace) && (a.fieldDominance == b.fieldDominance) &&
+			(a.region.x == b.region.x) && (a.region.y == b.region.y) &&
+			(a.region.width == b.region.width) && (a.region.height == b.region.height) &&
+			(a.width == b.width) && (a.height == b.height);
+	}
+
+	// Outputs that would be written to the same kind of file
+	bool SameOutputs(const std::vector<OutputImage>& a, const std::vector<OutputImage>& b)
+	{
+		if (a.size() != b.size())
+			return false;
+
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (!SharesConversion(a[i], b[i]) || (a[i].imageFormat != b[i].imageFormat) || (a[i].thumbnail != b[i].thumbnail) ||
+				(a[i].captureDirectory != b[i].captureDirectory) || (a[i].filenamePrefix != b[i].filenamePrefix))
+				return false;
+		}
+		return true;
+	}
+
+	// The image for one output entry of the request, the filepath is assigned once the frame is known to be written.
+	// Raw images are written as captured, never deinterlaced.
+	OutputImage GetOutputImage(IDeckLinkVideoFrame* videoFrame, const Protocol::OutputRequest& request,
+		PixelConverter::Deinterlace deinterlace, BMDFieldDominance fieldDominance)
+	{
+		PixelConverter::Rect	region = GetRegion(videoFrame, request.roi);
+		OutputImage				output = { request.captureDirectory, request.filenamePrefix, request.imageFormat, request.bitDepth, region,
+			(request.imageFormat == "raw") ? PixelConverter::kDeinterlaceNone : deinterlace, fieldDominance, 0, 0, false, "" };
+
+		GetScaledSize(region.width, region.height, request.scale, request.maxWidth, output.width, output.height);
+		return output;
+	}
+
+	// Convert the captured frame for the outputs and write them. videoFrames receives the converted frames,
+	// released by the caller also when an exception is thrown.
+	void WriteOutputImages(IDeckLinkVideoFrame* receivedVideoFrame, IDeckLinkVideoConversion* deckLinkFrameConverter,
+		const std::vector<OutputImage>& outputs, time_t captureTime, std::vector<IDeckLinkVideoFrame*>& videoFrames)
+	{
+		// Convert once per distinct conversion, outputs sharing one reference the same frame
+		videoFrames.assign(outputs.size(), NULL);
+		for (size_t i = 0; i < outputs.size(); i++)
+		{
+			spdlog::info("Capturing frame to {}", outputs[i].filepath.c_str());
+
+			for (size_t j = 0; (j < i) && (videoFrames[i] == NULL); j++)
+			{
+				if (SharesConversion(outputs[i], outputs[j]))
+				{
+					videoFrames[i] = videoFrames[j];
+					videoFrames[i]->AddRef();
+				}
+			}
+
+			if (videoFrames[i] == NULL)
+				videoFrames[i] = ConvertForOutput(receivedVideoFrame, deckLinkFrameConverter, outputs[i]);
+		}
+
+		// Encode in parallel, the encoders only read the converted frames
+		std::vector<HRESULT> results(outputs.size(), E_FAIL);
+		if (outputs.size() == 1)
+		{
+			results[0] = ImageWriter::WriteVideoFrameToImage(videoFrames[0], outputs[0].filepath, outputs[0].imageFormat, captureTime);
+		}
+		else
+		{
+			std::vector<std::thread> encoders;
+			for (size_t i = 0; i < outputs.size(); i++)
+			{
+				encoders.emplace_back([&, i] {
+					results[i] = ImageWriter::WriteVideoFrameToImage(videoFrames[i], outputs[i].filepath, outputs[i].imageFormat, captureTime);
+				});
+			}
+			for (std::thread& encoder : encoders)
+				encoder.join();
+		}
+
+		for (size_t i = 0; i < outputs.size(); i++)
+		{
+			if (FAILED(results[i]))
+			{
+				throw std::runtime_error("Image encoding to file was unsuccessful (" + outputs[i].filepath + ")");
+			}
+		}
+	}
+
+	void ReleaseFrames(std::vector<IDeckLinkVideoFrame*>& videoFrames)
+	{
+		for (IDeckLinkVideoFrame* videoFrame : videoFrames)
+		{
+			if (videoFrame != NULL)
+				videoFrame->Release();
+		}
+		videoFrames.clear();
+	}
+
+	// "<dir>\<name>.<ext>" -> "<dir>\<name>_thumb.<ext>"
+	std::string GetThumbnailFilepath(const std::string& filepath)
+	{
+		size_t extension = filepath.find_last_of('.');
+		return filepath.substr(0, extension) + "_thumb" + filepath.substr(extension);
+	}
+}
+
+void CaptureStills::WriteSnapshot(IDeckLinkVideoFrame* receivedVideoFrame, const Protocol::CommandRequest& request, BMDFieldDominance fieldDominance,
+	time_t captureTime, std::vector<std::string>& filepaths)
+{
+	HRESULT								result = S_OK;
+	IDeckLinkVideoConversion*			deckLinkFrameConverter = NULL;
+	std::vector<IDeckLinkVideoFrame*>	videoFrames;
+	std::vector<OutputImage>			outputs;
+	PixelConverter::Deinterlace			deinterlace = GetDeinterlace(request, fieldDominance);
+
+	// One snapshot at a time, requests and automatic captures share the last snapshot state
+	std::lock_guard<std::mutex> lock(g_snapshotMutex);
+
+	filepaths.clear();
 
 	try
 	{
@@ -56,8 +315,91 @@ void CaptureStills::CreateSnapshot(DeckLinkInputDevice* deckLinkInput, const std
 			throw std::runtime_error("Failed to get DeckLink frame converter");
 		}
 
+		if (!request.outputs.empty())
+		{
+			for (const Protocol::OutputRequest& outputRequest : request.outputs)
+				outputs.push_back(GetOutputImage(receivedVideoFrame, outputRequest, deinterlace, fieldDominance));
+		}
+		else
+		{
+			// The main image, then the thumbnail if one is requested
+			OutputImage output = GetOutputImage(receivedVideoFrame, request, deinterlace, fieldDominance);
+			if (request.thumbnail)
+			{
+				OutputImage thumbnail = output;
+				output.width = output.region.width;
+				output.height = output.region.height;
+				thumbnail.thumbnail = true;
+				outputs.push_back(output);
+				outputs.push_back(thumbnail);
+			}
+			else
+			{
+				outputs.push_back(output);
+			}
+		}
+
+		// Fingerprint the captured frame before any conversion
+		FrameHash::Fingerprint fingerprint;
+		result = FrameHash::Compute(receivedVideoFrame, fingerprint);
+		if (FAILED(result))
+		{
+			throw std::runtime_error("Failed to fingerprint frame");
+		}
+		spdlog::debug("Frame fingerprint {:016x} perceptual {:016x}", fingerprint.exact, fingerprint.perceptual);
+
+		bool unchanged = request.skipIfUnchanged && SameOutputs(outputs, g_lastOutputs) &&
+			FrameHash::Matches(fingerprint, g_lastFingerprint, request.changeThreshold);
+
+		if (unchanged)
+		{
+			spdlog::info("Frame unchanged since the last snapshot (perceptual distance {}), skipping",
+				FrameHash::HammingDistance(fingerprint.perceptual, g_lastFingerprint.perceptual));
+
+			for (const OutputImage& output : g_lastOutputs)
+				filepaths.push_back(output.filepath);
+		}
+		else
+		{
+			for (size_t i = 0; i < outputs.size(); i++)
+			{
+				outputs[i].filepath = outputs[i].thumbnail ? GetThumbnailFilepath(outputs[i - 1].filepath) :
+					ImageWriter::GetFilepath(outputs[i].captureDirectory, outputs[i].filenamePrefix, outputs[i].imageFormat);
+			}
+
+			WriteOutputImages(receivedVideoFrame, deckLinkFrameConverter, outputs, captureTime, videoFrames);
+
+			for (const OutputImage& output : outputs)
+				filepaths.push_back(output.filepath);
+
+			g_lastFingerprint = fingerprint;
+			g_lastOutputs = outputs;
+		}
+	}
+	catch (...)
+	{
+		ReleaseFrames(videoFrames);
+		if (deckLinkFrameConverter != NULL)
+			deckLinkFrameConverter->Release();
+		throw;
+	}
+
+	ReleaseFrames(videoFrames);
+	deckLinkFrameConverter->Release();
+}
+
+void CaptureStills::CreateSnapshot(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, std::vector<std::string>& filepaths, std::string& err)
+{
+	IDeckLinkVideoFrame*		receivedVideoFrame = NULL;
+	time_t						captureTime = 0;
+
+	filepaths.clear();
+
+	try
+	{
+		// Accumulated frames are dated by the first of them
 		bool captureCancelled;
-		if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, captureCancelled))
+		if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, captureCancelled, &captureTime))
 		{
 			throw std::runtime_error("Timeout waiting for valid frame");
 		}
@@ -69,48 +411,254 @@ void CaptureStills::CreateSnapshot(DeckLinkInputDevice* deckLinkInput, const std
 
 		else
 		{
-			filepath = ImageWriter::GetFilepath(captureDirectory, filenamePrefix, imageFormat);
-			spdlog::info("Capturing frame to {}", filepath.c_str());
+			// Combine the next frames with this one, each is released once added so the queue never holds them
+			if (request.accumulateFrames > 1)
+			{
+				FrameAccumulator accumulator((request.accumulateMode == "median") ? FrameAccumulator::kModeMedian : FrameAccumulator::kModeMean);
+
+				while (true)
+				{
+					if (accumulator.Add(receivedVideoFrame) != S_OK)
+						throw std::runtime_error("Failed to accumulate frame, the frame size or pixel format changed");
+
+					receivedVideoFrame->Release();
+					receivedVideoFrame = NULL;
+
+					if (accumulator.GetFrameCount() >= (uint32_t)request.accumulateFrames)
+						break;
+					else if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, captureCancelled))
+						throw std::runtime_error("Timeout waiting for valid frame");
+					else if (captureCancelled)
+						throw std::runtime_error("Capture is cancelled");
+				}
+
+				if (accumulator.GetResult(&receivedVideoFrame) != S_OK)
+					throw std::runtime_error("Failed to combine accumulated frames");
+			}
+
+			WriteSnapshot(receivedVideoFrame, request, deckLinkInput->GetFieldDominance(), captureTime, filepaths);
+
+			err = "";
+			spdlog::info("Capture completed");
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		spdlog::dump_backtrace();
+		err = ex.what();
+		spdlog::error(err.c_str());
+	}
+
+	if (receivedVideoFrame != NULL)
+	{
+		receivedVideoFrame->Release();
+		receivedVideoFrame = NULL;
+	}
+}
+
+void CaptureStills::CreateAnimation(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, std::string& filepath, std::string& err)
+{
+	HRESULT								result = S_OK;
+	IDeckLinkVideoFrame*				receivedVideoFrame = NULL;
+	std::vector<IDeckLinkVideoFrame*>	animationFrames;
+	double								duration = (request.clipDuration > 0.0) ? request.clipDuration : kDefaultAnimationDuration;
+	int									frameCount = (std::max)(1, (int)lround(duration * request.animationFrameRate));
+	long								frameWidth = 0;
+	long								frameHeight = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	filepath.clear();
+
+	try
+	{
+		for (int i = 0; i < frameCount; i++)
+		{
+			// As for a contact sheet, nothing is queued until the next frame is due; at rates close to the input
+			// frame rate the deadline has often passed already and the next arriving frame is taken
+			std::chrono::steady_clock::time_point deadline = start +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(i / request.animationFrameRate));
 
-			if (receivedVideoFrame->GetPixelFormat() == bmdFormat8BitBGRA)
+			if ((i > 0) && (std::chrono::steady_clock::now() < deadline))
 			{
-				// Frame is already 8-bit BGRA - no conversion required
-				spdlog::debug("Frame is already 8-bit BGRA - no conversion required");
-				videoFrame = receivedVideoFrame;
-				videoFrame->AddRef();
+				deckLinkInput->SetVideoFrameQueueing(false);
+				if (deckLinkInput->WaitForCaptureCancelled(deadline))
+				{
+					throw std::runtime_error("Capture is cancelled");
+				}
+				deckLinkInput->SetVideoFrameQueueing(true);
 			}
-			else
+
+			bool captureCancelled;
+			if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, captureCancelled))
 			{
-				if (imageFormat == "jpeg")
+				throw std::runtime_error("Timeout waiting for valid frame");
+			}
+			else if (captureCancelled)
+			{
+				throw std::runtime_error("Capture is cancelled");
+			}
+
+			PixelConverter::Rect region = GetRegion(receivedVideoFrame, request.roi);
+
+			// Sized by the first frame; all frames are kept converted and scaled until they are encoded together
+			if (animationFrames.empty())
+			{
+				GetScaledSize(region.width, region.height, request.scale, request.maxWidth, frameWidth, frameHeight);
+				if ((size_t)frameWidth * frameHeight * 4 * frameCount > kMaxAnimationBytes)
 				{
-					// FIXME: Bgr24VideoFrame outputs incorrect images.
-					spdlog::debug("Converting to 24-bit BGR video frame");
-					videoFrame = new Bgr24VideoFrame(receivedVideoFrame->GetWidth(), receivedVideoFrame->GetHeight(), receivedVideoFrame->GetFlags());
+					throw std::runtime_error(std::to_string(frameCount) + " frames of " + std::to_string(frameWidth) + "x" + std::to_string(frameHeight) +
+						" are too large for an animation, reduce the scale, duration or frame rate");
 				}
-				else
+				spdlog::debug("Creating {}x{} animation of {} frames", frameWidth, frameHeight, frameCount);
+			}
+
+			void* frameBytes = NULL;
+			animationFrames.push_back(new Bgra32VideoFrame(frameWidth, frameHeight, receivedVideoFrame->GetFlags()));
+			animationFrames.back()->GetBytes(&frameBytes);
+
+			BMDFieldDominance fieldDominance = deckLinkInput->GetFieldDominance();
+			result = PixelConverter::ConvertScaled(receivedVideoFrame, region, bmdFormat8BitBGRA, frameWidth, frameHeight, frameBytes, animationFrames.back()->GetRowBytes(),
+				GetDeinterlace(request, fieldDominance), fieldDominance);
+			receivedVideoFrame->Release();
+			receivedVideoFrame = NULL;
+
+			if (FAILED(result))
+			{
+				throw std::runtime_error("Frame conversion was unsuccessful");
+			}
+		}
+
+		filepath = ImageWriter::GetFilepath(request.captureDirectory, request.filenamePrefix, request.imageFormat);
+		spdlog::info("Writing animation to {}", filepath.c_str());
+
+		result = ImageWriter::WriteAnimation(animationFrames, request.animationFrameRate, filepath, request.imageFormat);
+		if (FAILED(result))
+		{
+			throw std::runtime_error("Image encoding to file was unsuccessful (" + filepath + ")");
+		}
+
+		err = "";
+		spdlog::info("Animation completed");
+	}
+	catch(const std::exception& ex)
+	{
+		spdlog::dump_backtrace();
+		err = ex.what();
+		spdlog::error(err.c_str());
+	}
+
+	if (receivedVideoFrame != NULL)
+	{
+		receivedVideoFrame->Release();
+		receivedVideoFrame = NULL;
+	}
+	ReleaseFrames(animationFrames);
+}
+
+void CaptureStills::CreateContactSheet(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, std::string& filepath, std::string& err)
+{
+	HRESULT						result = S_OK;
+	IDeckLinkVideoFrame*		receivedVideoFrame = NULL;
+	IDeckLinkVideoFrame*		sheetFrame = NULL;
+	int							columns = (request.sheetColumns > 0) ? request.sheetColumns : (int)ceil(sqrt((double)request.sheetFrames));
+	int							rows = (request.sheetFrames + columns - 1) / columns;
+	BMDPixelFormat				sheetPixelFormat = (request.bitDepth == 16) ? kPixelFormat16BitRGB : bmdFormat8BitBGRA;
+	long						tileWidth = 0;
+	long						tileHeight = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	filepath.clear();
+
+	try
+	{
+		for (int i = 0; i < request.sheetFrames; i++)
+		{
+			if ((i > 0) && (request.sheetInterval > 0.0))
+			{
+				// Nothing is queued until the next frame is due, so the first frame after the deadline is taken
+				std::chrono::steady_clock::time_point deadline = start +
+					std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(i * request.sheetInterval));
+
+				deckLinkInput->SetVideoFrameQueueing(false);
+				if (deckLinkInput->WaitForCaptureCancelled(deadline))
 				{
-					spdlog::debug("Converting to 32-bit BGRA video frame");
-					videoFrame = new Bgra32VideoFrame(receivedVideoFrame->GetWidth(), receivedVideoFrame->GetHeight(), receivedVideoFrame->GetFlags());
+					throw std::runtime_error("Capture is cancelled");
 				}
+				deckLinkInput->SetVideoFrameQueueing(true);
+			}
+
+			bool captureCancelled;
+			if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, captureCancelled))
+			{
+				throw std::runtime_error("Timeout waiting for valid frame");
+			}
+			else if (captureCancelled)
+			{
+				throw std::runtime_error("Capture is cancelled");
+			}
+
+			PixelConverter::Rect region = GetRegion(receivedVideoFrame, request.roi);
 
-				result = deckLinkFrameConverter->ConvertFrame(receivedVideoFrame, videoFrame);
-				if (FAILED(result))
+			// The sheet is sized by the first frame, later frames are scaled into the same tiles
+			if (sheetFrame == NULL)
+			{
+				GetScaledSize(region.width, region.height, request.scale, request.maxWidth, tileWidth, tileHeight);
+				if ((tileWidth * columns > kMaxContactSheetSize) || (tileHeight * rows > kMaxContactSheetSize))
 				{
-					throw std::runtime_error("Frame conversion was unsuccessful");
+					throw std::runtime_error("Contact sheet of " + std::to_string(tileWidth * columns) + "x" + std::to_string(tileHeight * rows) +
+						" is too large, at most " + std::to_string(kMaxContactSheetSize) + " pixels wide and high are supported");
+				}
+
+				spdlog::debug("Creating {}x{} contact sheet of {}x{} tiles", tileWidth * columns, tileHeight * rows, columns, rows);
+				if (request.bitDepth == 16)
+				{
+					sheetFrame = new Rgb48VideoFrame(tileWidth * columns, tileHeight * rows, receivedVideoFrame->GetFlags());
+				}
+				else
+				{
+					// Opaque black behind tiles left empty in the last row
+					void* sheetBytes = NULL;
+					sheetFrame = new Bgra32VideoFrame(tileWidth * columns, tileHeight * rows, receivedVideoFrame->GetFlags());
+					sheetFrame->GetBytes(&sheetBytes);
+					for (size_t offset = 3; offset < (size_t)sheetFrame->GetRowBytes() * sheetFrame->GetHeight(); offset += 4)
+						((uint8_t*)sheetBytes)[offset] = 0xff;
 				}
 			}
 
-			result = ImageWriter::WriteVideoFrameToImage(videoFrame, filepath, imageFormat);
+			// Converted and scaled straight into the tile, the captured frame is released before the next one is taken
+			void*		sheetBytes = NULL;
+			long		rowBytes = sheetFrame->GetRowBytes();
+			long		pixelBytes = rowBytes / sheetFrame->GetWidth();
+
+			sheetFrame->GetBytes(&sheetBytes);
+			uint8_t* tile = (uint8_t*)sheetBytes + (size_t)(i / columns) * tileHeight * rowBytes + (size_t)(i % columns) * tileWidth * pixelBytes;
+
+			BMDFieldDominance fieldDominance = deckLinkInput->GetFieldDominance();
+			result = PixelConverter::ConvertScaled(receivedVideoFrame, region, sheetPixelFormat, tileWidth, tileHeight, tile, rowBytes,
+				GetDeinterlace(request, fieldDominance), fieldDominance);
+			receivedVideoFrame->Release();
+			receivedVideoFrame = NULL;
+
 			if (FAILED(result))
 			{
-				throw std::runtime_error("Image encoding to file was unsuccessful");
+				throw std::runtime_error("Frame conversion was unsuccessful");
 			}
+			spdlog::debug("Contact sheet frame {} of {} captured", i + 1, request.sheetFrames);
+		}
 
-			videoFrame->Release();
+		filepath = ImageWriter::GetFilepath(request.captureDirectory, request.filenamePrefix, request.imageFormat);
+		spdlog::info("Writing contact sheet to {}", filepath.c_str());
 
-			err = "";
-			spdlog::info("Capture completed");
+		result = ImageWriter::WriteVideoFrameToImage(sheetFrame, filepath, request.imageFormat);
+		if (FAILED(result))
+		{
+			throw std::runtime_error("Image encoding to file was unsuccessful (" + filepath + ")");
 		}
+
+		err = "";
+		spdlog::info("Contact sheet completed");
 	}
 	catch(const std::exception& ex)
 	{
@@ -124,11 +672,51 @@ void CaptureStills::CreateSnapshot(DeckLinkInputDevice* deckLinkInput, const std
 		receivedVideoFrame->Release();
 		receivedVideoFrame = NULL;
 	}
+	if (sheetFrame != NULL)
+	{
+		sheetFrame->Release();
+		sheetFrame = NULL;
+	}
+}
+
+void CaptureStills::AnalyzeFrame(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, FrameStatistics::Statistics& statistics, std::string& err)
+{
+	IDeckLinkVideoFrame*		receivedVideoFrame = NULL;
+
+	try
+	{
+		bool captureCancelled;
+		if (!deckLinkInput->WaitForVideoFrameArrived(&receivedVideoFrame, captureCancelled))
+		{
+			throw std::runtime_error("Timeout waiting for valid frame");
+		}
+
+		else if (captureCancelled)
+		{
+			throw std::runtime_error("Capture is cancelled");
+		}
 
-	if (deckLinkFrameConverter != NULL)
+		else
+		{
+			HRESULT result = FrameStatistics::Compute(receivedVideoFrame, GetRegion(receivedVideoFrame, request.roi), statistics);
+			if (result != S_OK)
+				throw std::runtime_error("Frame analysis was unsuccessful");
+
+			err = "";
+			spdlog::info("Analysis completed");
+		}
+	}
+	catch(const std::exception& ex)
 	{
-		deckLinkFrameConverter->Release();
-		deckLinkFrameConverter = NULL;
+		spdlog::dump_backtrace();
+		err = ex.what();
+		spdlog::error(err.c_str());
+	}
+
+	if (receivedVideoFrame != NULL)
+	{
+		receivedVideoFrame->Release();
+		receivedVideoFrame = NULL;
 	}
 }
 
@@ -5,6 +5,8 @@
 #include <vector>
 
 #include "DeckLinkInputDevice.h"
+#include "Protocol.h"
+#include "FrameStatistics.h"
 
 // Pixel format tuple encoding {BMDPixelFormat enum, Pixel format display name}
 const std::vector<std::tuple<BMDPixelFormat, std::string>> kSupportedPixelFormats
@@ -29,13 +31,34 @@ const std::list<std::string> supportedImageFormats = {
 	"bmp",
 	"png",
 	"tiff",
+	"raw",
+	"apng",
+	"gif",
 	// "jpeg",
 };
 
+// Image formats written from a short burst of frames instead of a single one
+const std::list<std::string> animatedImageFormats = {
+	"apng",
+	"gif",
+};
+
 namespace CaptureStills
 {
 	void DisplayUsage(DeckLinkInputDevice* selectedDeckLinkInput, const std::vector<std::string>& deviceNames,
 		const int selectedDeviceIndex, const int selectedDisplayModeIndex, const bool supportsFormatDetection);
-	void CreateSnapshot(DeckLinkInputDevice* deckLinkInput, const std::string& captureDirectory, const std::string& filenamePrefix,
-		const std::string& imageFormat, std::string& filepath, std::string& err);
+	// Write the images the request asks for from a captured frame, filepaths lists them in that order.
+	// The field dominance of the display mode decides whether the requested deinterlacing applies,
+	// captureTime is the wall-clock time the frame arrived. Throws std::runtime_error on failure.
+	void WriteSnapshot(IDeckLinkVideoFrame* receivedVideoFrame, const Protocol::CommandRequest& request, BMDFieldDominance fieldDominance,
+		time_t captureTime, std::vector<std::string>& filepaths);
+	// Capture one frame, or the mean or median of the number of consecutive frames the request accumulates,
+	// and write the images the request asks for, filepaths lists them in that order
+	void CreateSnapshot(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, std::vector<std::string>& filepaths, std::string& err);
+	// Capture frames at the requested frame rate for the requested duration and write them as one looping animated image
+	void CreateAnimation(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, std::string& filepath, std::string& err);
+	// Capture frames at the requested interval and write them as the tiles of one image
+	void CreateContactSheet(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, std::string& filepath, std::string& err);
+	// Capture one frame and compute the level statistics of its region of interest, nothing is converted or written
+	void AnalyzeFrame(DeckLinkInputDevice* deckLinkInput, const Protocol::CommandRequest& request, FrameStatistics::Statistics& statistics, std::string& err);
 }
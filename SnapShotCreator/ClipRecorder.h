@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "DeckLinkAPI.h"
+
+// Recording of consecutive captured frames into one uncompressed file. Frames are taken from the capture callback
+// into a short bounded queue, and packed by the recording thread into one of two large buffers while an I/O thread
+// writes out the other, so the disk sees few large sequential writes. Frames arriving while the queue is full
+// are dropped and counted.
+namespace ClipRecorder
+{
+	enum Container
+	{
+		kContainerY4m = 0,		// YUV4MPEG2, planar 4:2:2, 8-bit or 16-bit little-endian samples for 10-bit input
+		kContainerRaw,			// captured frames back to back in the native pixel format, described by a .json sidecar
+	};
+
+	struct Options
+	{
+		std::string			filepath;
+		Container			container = kContainerY4m;
+		uint64_t			frameCount = 0;				// frames to record, 0 to record for duration instead
+		double				duration = 0.0;				// seconds to record, converted to frames at the input frame rate
+		BMDFieldDominance	fieldDominance = bmdUnknownFieldDominance;
+	};
+
+	struct Result
+	{
+		uint64_t			writtenFrames;
+		uint64_t			droppedFrames;		// arrived while the queue was full, they count towards the clip length
+		uint64_t			bytes;
+		int64_t				frameDuration;		// in units of timeScale, 0 if the input did not report it
+		int64_t				timeScale;
+	};
+
+	// Record a clip and return once it is complete. Throws std::runtime_error if the clip could not be completed;
+	// frames written before are kept in the file.
+	void Record(const Options& options, Result& result);
+	// Ends a recording in progress early, as on shutdown
+	void Cancel(void);
+	bool IsRecording(void);
+
+	// Called by the input callback for every valid frame
+	void FrameArrived(IDeckLinkVideoFrame* videoFrame);
+};
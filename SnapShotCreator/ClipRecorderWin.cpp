@@ -0,0 +1,542 @@
+#include <Windows.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CLIPRECORDER_SSE2
+#endif
+
+#include "include/spdlog/spdlog.h"
+#include "platform.h"
+#include "RawVideoFrame.h"
+#include "FileWriter.h"
+#include "ImageWriter.h"
+#include "ClipRecorder.h"
+
+namespace
+{
+	// Frames waiting to be packed; DeckLink only has a limited pool of capture buffers, so few are held
+	const size_t		kMaxQueuedFrames = 8;
+
+	// Each of the two write buffers holds as many whole frames as fit
+	const size_t		kBufferBytes = 64 * 1024 * 1024;
+
+	// Exact for all common frame rates, 23.976 to 60 Hz
+	const int64_t		kTimeScale = 120000;
+
+	const std::chrono::seconds	kFrameTimeout{5};
+
+	const char			kY4mFrameHeader[] = "FRAME\n";
+
+	// Capture side, guarded by g_mutex
+	std::atomic<bool>					g_accepting{ false };
+	std::mutex							g_mutex;
+	std::condition_variable				g_frameCondition;		// signalled when a frame is queued or the recording is cancelled
+	std::deque<IDeckLinkVideoFrame*>	g_frameQueue;
+	uint64_t							g_droppedFrames = 0;
+	bool								g_recording = false;
+	bool								g_cancelled = false;
+
+	// I/O thread, guarded by g_ioMutex
+	std::thread							g_ioThread;
+	std::mutex							g_ioMutex;
+	std::condition_variable				g_ioCondition;			// signalled when a buffer is submitted, written or stop is requested
+	HANDLE								g_ioFile = INVALID_HANDLE_VALUE;
+	const uint8_t*						g_ioBuffer = NULL;		// buffer being written, NULL when idle
+	size_t								g_ioSize = 0;
+	HRESULT								g_ioResult = S_OK;
+	bool								g_stopIo = false;
+
+	void IoThread()
+	{
+		std::unique_lock<std::mutex> lock(g_ioMutex);
+
+		while (true)
+		{
+			g_ioCondition.wait(lock, [] { return (g_ioBuffer != NULL) || g_stopIo; });
+			if (g_ioBuffer == NULL)
+				break;
+
+			const uint8_t*	bytes = g_ioBuffer;
+			size_t			size = g_ioSize;
+
+			lock.unlock();
+			HRESULT result = FileWriter::WriteChunks(g_ioFile, bytes, size);
+			lock.lock();
+
+			if (FAILED(result))
+				g_ioResult = result;
+			g_ioBuffer = NULL;
+			g_ioCondition.notify_all();
+		}
+	}
+
+	// Hand a filled buffer to the I/O thread. Blocks while the previous one is still being written,
+	// so the buffer submitted before this one can be filled again once it returns.
+	HRESULT SubmitBuffer(const uint8_t* bytes, size_t size)
+	{
+		std::unique_lock<std::mutex> lock(g_ioMutex);
+
+		g_ioCondition.wait(lock, [] { return g_ioBuffer == NULL; });
+		if (FAILED(g_ioResult) || (size == 0))
+			return g_ioResult;
+
+		g_ioBuffer = bytes;
+		g_ioSize = size;
+		g_ioCondition.notify_all();
+		return S_OK;
+	}
+
+	// Waits for the last buffer to be written and ends the I/O thread
+	HRESULT StopIo()
+	{
+		{
+			std::unique_lock<std::mutex> lock(g_ioMutex);
+			g_ioCondition.wait(lock, [] { return g_ioBuffer == NULL; });
+			g_stopIo = true;
+			g_ioCondition.notify_all();
+		}
+
+		if (g_ioThread.joinable())
+			g_ioThread.join();
+		return g_ioResult;
+	}
+
+	// Stop taking frames and release the ones still queued
+	void StopAccepting()
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+
+		g_accepting.store(false);
+		while (!g_frameQueue.empty())
+		{
+			g_frameQueue.front()->Release();
+			g_frameQueue.pop_front();
+		}
+		g_recording = false;
+	}
+
+	// Y4M has no RGB colour space, only the 4:2:2 capture formats are stored there
+	const char* GetY4mColorspace(BMDPixelFormat pixelFormat)
+	{
+		switch (pixelFormat)
+		{
+			case bmdFormat8BitYUV:		return "422";
+			case bmdFormat10BitYUV:		return "422p10";
+			default:					return NULL;
+		}
+	}
+
+	char GetY4mInterlacing(BMDFieldDominance fieldDominance)
+	{
+		switch (fieldDominance)
+		{
+			case bmdProgressiveFrame:
+			case bmdProgressiveSegmentedFrame:	return 'p';
+			case bmdUpperFieldFirst:			return 't';
+			case bmdLowerFieldFirst:			return 'b';
+			default:							return '?';
+		}
+	}
+
+	const char* GetFieldDominanceName(BMDFieldDominance fieldDominance)
+	{
+		switch (fieldDominance)
+		{
+			case bmdProgressiveFrame:			return "progressive";
+			case bmdProgressiveSegmentedFrame:	return "progressive_segmented";
+			case bmdUpperFieldFirst:			return "upper_field_first";
+			case bmdLowerFieldFirst:			return "lower_field_first";
+			default:							return "unknown";
+		}
+	}
+
+	// 8-bit 4:2:2 Cb Y0 Cr Y1 into Y, Cb and Cr planes
+	void PackPlanar2vuy(const uint8_t* row, long width, uint8_t* luma, uint8_t* cb, uint8_t* cr)
+	{
+		long x = 0;
+
+#if defined(CLIPRECORDER_SSE2)
+		// 16 pixels per step: luma from the odd bytes, chroma from the even ones split by 32-bit lane half
+		const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+		const __m128i lowWords = _mm_set1_epi32(0x0000ffff);
+
+		for (; x + 16 <= width; x += 16, row += 32)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)row);
+			__m128i b = _mm_loadu_si128((const __m128i*)(row + 16));
+
+			_mm_storeu_si128((__m128i*)(luma + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+
+			__m128i chromaA = _mm_and_si128(a, lowBytes);
+			__m128i chromaB = _mm_and_si128(b, lowBytes);
+			__m128i cbWords = _mm_packs_epi32(_mm_and_si128(chromaA, lowWords), _mm_and_si128(chromaB, lowWords));
+			__m128i crWords = _mm_packs_epi32(_mm_srli_epi32(chromaA, 16), _mm_srli_epi32(chromaB, 16));
+
+			_mm_storel_epi64((__m128i*)(cb + x / 2), _mm_packus_epi16(cbWords, cbWords));
+			_mm_storel_epi64((__m128i*)(cr + x / 2), _mm_packus_epi16(crWords, crWords));
+		}
+#endif
+
+		for (; x < width; x += 2, row += 4)
+		{
+			cb[x / 2] = row[0];
+			luma[x] = row[1];
+			cr[x / 2] = row[2];
+			luma[x + 1] = row[3];
+		}
+	}
+
+	inline void Store16(uint8_t* dst, uint32_t value)
+	{
+		dst[0] = (uint8_t)value;
+		dst[1] = (uint8_t)(value >> 8);
+	}
+
+	// 10-bit 4:2:2, 6 pixels in four little-endian words, into 16-bit little-endian Y, Cb and Cr planes
+	void PackPlanarV210(const uint8_t* row, long width, uint8_t* luma, uint8_t* cb, uint8_t* cr)
+	{
+		for (long x = 0; x < width; x += 6, row += 16)
+		{
+			uint32_t words[4];
+			memcpy(words, row, sizeof(words));
+
+			const uint32_t	y[6] = { (words[0] >> 10) & 0x3ff, words[1] & 0x3ff, (words[1] >> 20) & 0x3ff,
+									 (words[2] >> 10) & 0x3ff, words[3] & 0x3ff, (words[3] >> 20) & 0x3ff };
+			const uint32_t	u[3] = { words[0] & 0x3ff, (words[1] >> 10) & 0x3ff, (words[2] >> 20) & 0x3ff };
+			const uint32_t	v[3] = { (words[0] >> 20) & 0x3ff, words[2] & 0x3ff, (words[3] >> 10) & 0x3ff };
+
+			// Widths are even, the last group may hold only 2 or 4 pixels
+			for (long k = 0; (k < 6) && (x + k < width); k += 2)
+			{
+				Store16(luma + (x + k) * 2, y[k]);
+				Store16(luma + (x + k + 1) * 2, y[k + 1]);
+				Store16(cb + (x + k), u[k / 2]);
+				Store16(cr + (x + k), v[k / 2]);
+			}
+		}
+	}
+
+	// Bytes one frame takes in the file, including the Y4M frame header
+	size_t GetFrameRecordBytes(ClipRecorder::Container container, IDeckLinkVideoFrame* videoFrame)
+	{
+		if (container == ClipRecorder::kContainerRaw)
+			return (size_t)videoFrame->GetRowBytes() * videoFrame->GetHeight();
+
+		size_t sampleBytes = (videoFrame->GetPixelFormat() == bmdFormat10BitYUV) ? 2 : 1;
+		return sizeof(kY4mFrameHeader) - 1 + (size_t)videoFrame->GetWidth() * videoFrame->GetHeight() * 2 * sampleBytes;
+	}
+
+	void PackFrame(ClipRecorder::Container container, IDeckLinkVideoFrame* videoFrame, uint8_t* dst)
+	{
+		void*			bytes = NULL;
+		long			width = videoFrame->GetWidth();
+		long			height = videoFrame->GetHeight();
+		long			rowBytes = videoFrame->GetRowBytes();
+
+		videoFrame->GetBytes(&bytes);
+
+		if (container == ClipRecorder::kContainerRaw)
+		{
+			memcpy(dst, bytes, (size_t)rowBytes * height);
+			return;
+		}
+
+		memcpy(dst, kY4mFrameHeader, sizeof(kY4mFrameHeader) - 1);
+		dst += sizeof(kY4mFrameHeader) - 1;
+
+		size_t		sampleBytes = (videoFrame->GetPixelFormat() == bmdFormat10BitYUV) ? 2 : 1;
+		uint8_t*	luma = dst;
+		uint8_t*	cb = luma + (size_t)width * height * sampleBytes;
+		uint8_t*	cr = cb + (size_t)(width / 2) * height * sampleBytes;
+
+		for (long y = 0; y < height; y++)
+		{
+			const uint8_t*	row = (const uint8_t*)bytes + (size_t)y * rowBytes;
+			size_t			lumaOffset = (size_t)y * width * sampleBytes;
+			size_t			chromaOffset = (size_t)y * (width / 2) * sampleBytes;
+
+			if (sampleBytes == 2)
+				PackPlanarV210(row, width, luma + lumaOffset, cb + chromaOffset, cr + chromaOffset);
+			else
+				PackPlanar2vuy(row, width, luma + lumaOffset, cb + chromaOffset, cr + chromaOffset);
+		}
+	}
+
+	// Frame duration reported by the input, 0 if unknown
+	int64_t GetFrameDuration(IDeckLinkVideoFrame* videoFrame)
+	{
+		IDeckLinkVideoInputFrame*	inputFrame = NULL;
+		BMDTimeValue				streamTime = 0;
+		BMDTimeValue				streamDuration = 0;
+
+		if (videoFrame->QueryInterface(IID_IDeckLinkVideoInputFrame, (void**)&inputFrame) != S_OK)
+			return 0;
+
+		if (inputFrame->GetStreamTime(&streamTime, &streamDuration, kTimeScale) != S_OK)
+			streamDuration = 0;
+		inputFrame->Release();
+		return (int64_t)streamDuration;
+	}
+
+	int64_t GreatestCommonDivisor(int64_t a, int64_t b)
+	{
+		while (b != 0)
+		{
+			int64_t remainder = a % b;
+			a = b;
+			b = remainder;
+		}
+		return a;
+	}
+
+	std::string MakeY4mHeader(IDeckLinkVideoFrame* videoFrame, int64_t frameDuration, BMDFieldDominance fieldDominance)
+	{
+		char		header[128];
+		int64_t		rateNumerator = kTimeScale;
+		int64_t		rateDenominator = frameDuration;
+
+		if (frameDuration <= 0)
+		{
+			spdlog::warn("Input frame rate unknown, writing the clip at 25 fps");
+			rateNumerator = 25;
+			rateDenominator = 1;
+		}
+		int64_t divisor = GreatestCommonDivisor(rateNumerator, rateDenominator);
+
+		snprintf(header, sizeof(header), "YUV4MPEG2 W%ld H%ld F%lld:%lld I%c A1:1 C%s\n",
+			videoFrame->GetWidth(), videoFrame->GetHeight(), (long long)(rateNumerator / divisor), (long long)(rateDenominator / divisor),
+			GetY4mInterlacing(fieldDominance), GetY4mColorspace(videoFrame->GetPixelFormat()));
+		return header;
+	}
+
+	// Members describing the recording, appended to the raw frame sidecar
+	std::string MakeClipFields(const ClipRecorder::Result& result, BMDFieldDominance fieldDominance)
+	{
+		std::string	fields;
+
+		fields += ",\"field_dominance\":\"";
+		fields += GetFieldDominanceName(fieldDominance);
+		fields += "\",\"frames\":";
+		fields += std::to_string(result.writtenFrames);
+		fields += ",\"dropped_frames\":";
+		fields += std::to_string(result.droppedFrames);
+		fields += ",\"frame_duration\":";
+		fields += std::to_string(result.frameDuration);
+		return fields;
+	}
+}
+
+void ClipRecorder::Record(const Options& options, Result& result)
+{
+	std::string					tempFilepath = options.filepath + ".tmp";
+	std::string					sidecarFilepath = options.filepath.substr(0, options.filepath.find_last_of('.')) + ".json";
+	time_t						captureTime = time(NULL);
+	std::vector<uint8_t>		buffers[2];
+	size_t						fillIndex = 0;
+	size_t						fillSize = 0;
+	IDeckLinkVideoFrame*		firstFrame = NULL;
+	size_t						frameRecordBytes = 0;
+	uint64_t					frameCount = options.frameCount;
+	std::string					err;
+
+	result = Result();
+	result.timeScale = kTimeScale;
+
+	HANDLE file = CreateFileA(tempFilepath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Could not create file " + tempFilepath);
+
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		g_droppedFrames = 0;
+		g_cancelled = false;
+		g_recording = true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(g_ioMutex);
+		g_ioFile = file;
+		g_ioBuffer = NULL;
+		g_ioResult = S_OK;
+		g_stopIo = false;
+	}
+	g_ioThread = std::thread(IoThread);
+	g_accepting.store(true);
+
+	try
+	{
+		while ((frameCount == 0) || (result.writtenFrames + result.droppedFrames < frameCount))
+		{
+			IDeckLinkVideoFrame* videoFrame = NULL;
+
+			{
+				std::unique_lock<std::mutex> lock(g_mutex);
+				if (!g_frameCondition.wait_for(lock, kFrameTimeout, [] { return !g_frameQueue.empty() || g_cancelled; }))
+					throw std::runtime_error("Timeout waiting for valid frame");
+				if (g_cancelled)
+					throw std::runtime_error("Recording is cancelled");
+
+				videoFrame = g_frameQueue.front();
+				g_frameQueue.pop_front();
+				result.droppedFrames = g_droppedFrames;
+			}
+
+			// The first frame fixes the format, and the length of a clip given by duration
+			if (firstFrame == NULL)
+			{
+				firstFrame = videoFrame;
+				firstFrame->AddRef();
+
+				if ((options.container == kContainerY4m) && (GetY4mColorspace(videoFrame->GetPixelFormat()) == NULL))
+				{
+					videoFrame->Release();
+					throw std::runtime_error(std::string("y4m needs 8 or 10-bit YUV input, the input is ") +
+						RawVideoFrame::GetPixelFormatTag(videoFrame->GetPixelFormat()) + ", record raw instead");
+				}
+
+				result.frameDuration = GetFrameDuration(videoFrame);
+				if (frameCount == 0)
+				{
+					int64_t frameDuration = (result.frameDuration > 0) ? result.frameDuration : kTimeScale / 25;
+					frameCount = (std::max)((uint64_t)1, (uint64_t)ceil(options.duration * kTimeScale / frameDuration - 1e-6));
+				}
+
+				frameRecordBytes = GetFrameRecordBytes(options.container, videoFrame);
+				buffers[0].resize((std::max)(kBufferBytes, frameRecordBytes + 256));
+				buffers[1].resize(buffers[0].size());
+
+				if (options.container == kContainerY4m)
+				{
+					std::string header = MakeY4mHeader(videoFrame, result.frameDuration, options.fieldDominance);
+					memcpy(buffers[0].data(), header.data(), header.size());
+					fillSize = header.size();
+				}
+
+				spdlog::info("Recording {} frames of {}x{} {} to {}", frameCount, videoFrame->GetWidth(), videoFrame->GetHeight(),
+					RawVideoFrame::GetPixelFormatTag(videoFrame->GetPixelFormat()), options.filepath.c_str());
+			}
+			else if ((videoFrame->GetWidth() != firstFrame->GetWidth()) || (videoFrame->GetHeight() != firstFrame->GetHeight()) ||
+				(videoFrame->GetPixelFormat() != firstFrame->GetPixelFormat()) || (videoFrame->GetRowBytes() != firstFrame->GetRowBytes()))
+			{
+				videoFrame->Release();
+				throw std::runtime_error("Video format changed during recording");
+			}
+
+			// Full buffers go to the I/O thread, packing continues into the other one
+			if (fillSize + frameRecordBytes > buffers[fillIndex].size())
+			{
+				HRESULT ioResult = SubmitBuffer(buffers[fillIndex].data(), fillSize);
+				if (FAILED(ioResult))
+				{
+					videoFrame->Release();
+					throw std::runtime_error("Writing to " + tempFilepath + " was unsuccessful");
+				}
+				result.bytes += fillSize;
+				fillIndex ^= 1;
+				fillSize = 0;
+			}
+
+			PackFrame(options.container, videoFrame, buffers[fillIndex].data() + fillSize);
+			videoFrame->Release();
+			fillSize += frameRecordBytes;
+			result.writtenFrames++;
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		err = ex.what();
+	}
+
+	// Frames arriving from here on are not needed
+	StopAccepting();
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		result.droppedFrames = g_droppedFrames;
+	}
+
+	HRESULT ioResult = SubmitBuffer(buffers[fillIndex].data(), fillSize);
+	if (SUCCEEDED(ioResult))
+		result.bytes += fillSize;
+	ioResult = StopIo();
+	CloseHandle(file);
+
+	if (FAILED(ioResult) && err.empty())
+		err = "Writing to " + tempFilepath + " was unsuccessful";
+
+	// Whatever was written before an error is kept, a raw clip is described by its sidecar before it appears
+	if ((result.writtenFrames > 0) && SUCCEEDED(ioResult))
+	{
+		if (options.container == kContainerRaw)
+		{
+			std::string sidecar = ImageWriter::MakeRawSidecar(firstFrame, captureTime, result.timeScale, MakeClipFields(result, options.fieldDominance));
+			if (FAILED(FileWriter::WriteFileAtomic(sidecarFilepath, sidecar.data(), sidecar.size())) && err.empty())
+				err = "Could not write file " + sidecarFilepath;
+		}
+		if (!MoveFileExA(tempFilepath.c_str(), options.filepath.c_str(), MOVEFILE_REPLACE_EXISTING) && err.empty())
+			err = "Could not write file " + options.filepath;
+	}
+	else
+	{
+		DeleteFileA(tempFilepath.c_str());
+	}
+
+	if (firstFrame != NULL)
+		firstFrame->Release();
+
+	spdlog::info("Recorded {} frames ({} dropped, {} bytes) to {}", result.writtenFrames, result.droppedFrames, result.bytes, options.filepath.c_str());
+	if (result.droppedFrames > 0)
+		spdlog::warn("{} frames dropped while recording, the disk could not keep up", result.droppedFrames);
+
+	if (!err.empty())
+		throw std::runtime_error(err);
+}
+
+void ClipRecorder::Cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		if (!g_recording)
+			return;
+		g_cancelled = true;
+	}
+	g_frameCondition.notify_one();
+}
+
+bool ClipRecorder::IsRecording()
+{
+	std::lock_guard<std::mutex> lock(g_mutex);
+	return g_recording;
+}
+
+void ClipRecorder::FrameArrived(IDeckLinkVideoFrame* videoFrame)
+{
+	if (!g_accepting.load(std::memory_order_acquire))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		if (!g_accepting.load())
+			return;
+
+		// Dropped frames still count towards the clip length, so a slow disk does not stretch the recording
+		if (g_frameQueue.size() >= kMaxQueuedFrames)
+		{
+			g_droppedFrames++;
+			return;
+		}
+
+		videoFrame->AddRef();
+		g_frameQueue.push_back(videoFrame);
+	}
+	g_frameCondition.notify_one();
+}
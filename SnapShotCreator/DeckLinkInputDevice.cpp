@@ -29,11 +29,14 @@
 #include "include/spdlog/spdlog.h"
 #include "platform.h"
 #include "DeckLinkInputDevice.h"
+#include "SignalAnalyzer.h"
+#include "MotionTrigger.h"
+#include "ClipRecorder.h"
 
 static const std::chrono::seconds kValidFrameTimeout{5};
 
 DeckLinkInputDevice::DeckLinkInputDevice(IDeckLink* device)
-	: m_deckLink(device), m_deckLinkInput(NULL), m_cancelCapture(false), m_refCount(1)
+	: m_deckLink(device), m_deckLinkInput(NULL), m_cancelCapture(false), m_queueVideoFrames(true), m_fieldDominance(bmdUnknownFieldDominance), m_frameWidth(0), m_frameHeight(0), m_refCount(1)
 {
 	m_deckLink->AddRef();
 }
@@ -114,6 +117,20 @@ HRESULT DeckLinkInputDevice::StartCapture(BMDDisplayMode displayMode, BMDPixelFo
 	BMDVideoInputFlags inputFlags = bmdVideoInputFlagDefault;
 
 	m_prevInputFrameValid = false;
+	SetVideoFrameQueueing(true);
+
+	{
+		std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
+		m_fieldDominance = bmdUnknownFieldDominance;
+		for (IDeckLinkDisplayMode* mode : m_modeList)
+		{
+			if (mode->GetDisplayMode() == displayMode)
+			{
+				m_fieldDominance = mode->GetFieldDominance();
+				break;
+			}
+		}
+	}
 
 	if (enableFormatDetection)
 		inputFlags |= bmdVideoInputEnableFormatDetection;
@@ -154,6 +171,22 @@ void DeckLinkInputDevice::CancelCapture()
 	m_deckLinkInputCondition.notify_one();
 }
 
+void DeckLinkInputDevice::SetVideoFrameQueueing(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
+
+	m_queueVideoFrames = enabled;
+	if (!enabled)
+	{
+		// Frames queued meanwhile are stale by the time queueing is enabled again
+		while (!m_videoFrameQueue.empty())
+		{
+			m_videoFrameQueue.front().frame->Release();
+			m_videoFrameQueue.pop();
+		}
+	}
+}
+
 void DeckLinkInputDevice::StopCapture()
 {
 	if (m_deckLinkInput != NULL)
@@ -166,7 +199,7 @@ void DeckLinkInputDevice::StopCapture()
 			std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
 			while (!m_videoFrameQueue.empty())
 			{
-				m_videoFrameQueue.front()->Release();
+				m_videoFrameQueue.front().frame->Release();
 				m_videoFrameQueue.pop();
 			}
 		}
@@ -185,7 +218,7 @@ void DeckLinkInputDevice::StopCapture()
 	}
 }
 
-bool DeckLinkInputDevice::WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled)
+bool DeckLinkInputDevice::WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled, time_t* arrivalTime)
 {
 	std::unique_lock<std::mutex> lock(m_deckLinkInputMutex);
 	if (!m_deckLinkInputCondition.wait_for(lock, kValidFrameTimeout, [&]{ return !m_videoFrameQueue.empty() || m_cancelCapture; }))
@@ -194,7 +227,9 @@ bool DeckLinkInputDevice::WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame,
 
 	if (!m_videoFrameQueue.empty())
 	{
-		*frame = m_videoFrameQueue.front();
+		*frame = m_videoFrameQueue.front().frame;
+		if (arrivalTime != NULL)
+			*arrivalTime = m_videoFrameQueue.front().arrivalTime;
 		m_videoFrameQueue.pop();
 	}
 
@@ -202,6 +237,26 @@ bool DeckLinkInputDevice::WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame,
 	return true;
 }
 
+bool DeckLinkInputDevice::WaitForCaptureCancelled(const std::chrono::steady_clock::time_point& deadline)
+{
+	std::unique_lock<std::mutex> lock(m_deckLinkInputMutex);
+	return m_deckLinkInputCondition.wait_until(lock, deadline, [&]{ return m_cancelCapture; });
+}
+
+BMDFieldDominance DeckLinkInputDevice::GetFieldDominance()
+{
+	std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
+	return m_fieldDominance;
+}
+
+bool DeckLinkInputDevice::GetFrameSize(long& width, long& height)
+{
+	std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
+	width = m_frameWidth;
+	height = m_frameHeight;
+	return (m_frameWidth > 0) && (m_frameHeight > 0);
+}
+
 HRESULT DeckLinkInputDevice::VideoInputFormatChanged(/* in */ BMDVideoInputFormatChangedEvents notificationEvents, /* in */ IDeckLinkDisplayMode *newMode, /* in */ BMDDetectedVideoInputFormatFlags detectedSignalFlags)
 {
 	HRESULT			result;
@@ -211,6 +266,11 @@ HRESULT DeckLinkInputDevice::VideoInputFormatChanged(/* in */ BMDVideoInputForma
 	if (detectedSignalFlags & bmdDetectedVideoInputRGB444)
 		pixelFormat = bmdFormat10BitRGB;
 
+	{
+		std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
+		m_fieldDominance = newMode->GetFieldDominance();
+	}
+
 	// Stop the capture
 	m_deckLinkInput->StopStreams();
 
@@ -250,6 +310,8 @@ HRESULT DeckLinkInputDevice::VideoInputFrameArrived(/* in */ IDeckLinkVideoInput
 	{
 		bool inputFrameValid = ((videoFrame->GetFlags() & bmdFrameHasNoInputSource) == 0);
 
+		SignalAnalyzer::FrameArrived(videoFrame, inputFrameValid);
+
 		// Detect change in input signal, restart stream when valid stream detected
 		if (inputFrameValid && !m_prevInputFrameValid)
 		{
@@ -260,13 +322,24 @@ HRESULT DeckLinkInputDevice::VideoInputFrameArrived(/* in */ IDeckLinkVideoInput
 
 		if (inputFrameValid && m_prevInputFrameValid)
 		{
+			MotionTrigger::FrameArrived(videoFrame);
+			ClipRecorder::FrameArrived(videoFrame);
+
 			// If valid frame, add to queue for processing and notify
-			videoFrame->AddRef();
+			bool queued = false;
 			{
 				std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
-				m_videoFrameQueue.push(videoFrame);
+				m_frameWidth = videoFrame->GetWidth();
+				m_frameHeight = videoFrame->GetHeight();
+				if (m_queueVideoFrames)
+				{
+					videoFrame->AddRef();
+					m_videoFrameQueue.push({ videoFrame, time(NULL) });
+					queued = true;
+				}
 			}
-			m_deckLinkInputCondition.notify_one();
+			if (queued)
+				m_deckLinkInputCondition.notify_one();
 		}
 
 		m_prevInputFrameValid = inputFrameValid;
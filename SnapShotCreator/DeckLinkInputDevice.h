@@ -27,7 +27,9 @@
 
 #pragma once
 
+#include <time.h>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <queue>
@@ -43,11 +45,21 @@ private:
 	IDeckLinkInput*						m_deckLinkInput;
 	std::vector<IDeckLinkDisplayMode*>	m_modeList;
 
-	std::queue<IDeckLinkVideoFrame*>	m_videoFrameQueue;
+	struct QueuedFrame
+	{
+		IDeckLinkVideoFrame*			frame;
+		time_t							arrivalTime;
+	};
+
+	std::queue<QueuedFrame>				m_videoFrameQueue;
 	std::condition_variable				m_deckLinkInputCondition;
 	std::mutex							m_deckLinkInputMutex;
 	bool								m_cancelCapture;
+	bool								m_queueVideoFrames;
 	bool								m_prevInputFrameValid;
+	BMDFieldDominance					m_fieldDominance;
+	long								m_frameWidth;
+	long								m_frameHeight;
 
 	std::atomic<uint32_t>				m_refCount;
 
@@ -60,9 +72,18 @@ public:
 	HRESULT								StartCapture(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, bool enableFormatDetection);
 	void								StopCapture(void);
 	void								CancelCapture(void);
+	// Capture keeps running while disabled, frames are only passed to the signal analyzer
+	void								SetVideoFrameQueueing(bool enabled);
 	IDeckLinkInput*						GetDeckLinkInput(void) const { return m_deckLinkInput; };
 	std::vector<IDeckLinkDisplayMode*>& GetDisplayModeList(void) { return m_modeList; };
-	bool								WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled);
+	// arrivalTime, if given, receives the wall-clock time the frame arrived at
+	bool								WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled, time_t* arrivalTime = NULL);
+	// Sleep until deadline, returns true early if the capture is cancelled
+	bool								WaitForCaptureCancelled(const std::chrono::steady_clock::time_point& deadline);
+	// Of the display mode being captured, follows format detection
+	BMDFieldDominance					GetFieldDominance(void);
+	// Of the last valid input frame, returns false if none has arrived yet
+	bool								GetFrameSize(long& width, long& height);
 
 	// IDeckLinkInputCallback interface
 	virtual HRESULT STDMETHODCALLTYPE	VideoInputFormatChanged (BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode *newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags);
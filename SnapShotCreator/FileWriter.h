@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include "platform.h"
+
+class MemoryStream;
+
+// Writing finished output files to disk
+namespace FileWriter
+{
+	// How much to wait for the data to reach stable storage before a file is published
+	enum Durability
+	{
+		kDurabilityNone = 0,	// leave it to the OS cache
+		kDurabilityData,		// flush the file contents before the rename
+		kDurabilityFull,		// flush the contents and write the rename through to disk
+	};
+
+	struct Options
+	{
+		Durability		durability;
+		bool			preallocate;	// reserve the whole file size before writing, for contiguous extents
+		bool			unbuffered;		// bypass the system file cache for large files
+		size_t			unbufferedMinBytes;
+	};
+
+	void Configure(const Options& options);
+
+	// Write data to a temporary file next to filepath and rename it into place,
+	// so that readers of the directory only ever see complete files
+	HRESULT WriteFileAtomic(const std::string& filepath, const void* data, size_t size);
+
+	// Sequential write of size bytes to an open file, in chunks WriteFile can take
+	HRESULT WriteChunks(HANDLE file, const uint8_t* bytes, size_t size);
+
+	// Background writer: files queued with WriteFileAsync are written in batches by a single I/O thread,
+	// with the writes of all files in a batch in flight together. Queuing only blocks while more than
+	// maxPendingBytes are waiting to be written.
+	void StartAsyncWriter(size_t maxPendingBytes);
+	void StopAsyncWriter(void);		// writes out everything already queued
+	bool IsAsyncWriterRunning(void);
+
+	// Takes a reference on stream until the file is published; failures are only logged
+	void WriteFileAsync(const std::string& filepath, MemoryStream* stream);
+};
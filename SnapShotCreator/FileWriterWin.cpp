@@ -0,0 +1,463 @@
+#include <Windows.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "include/spdlog/spdlog.h"
+#include "MemoryStream.h"
+#include "FileWriter.h"
+
+namespace FileWriter
+{
+	Options				g_options = { kDurabilityNone, false, false, 0 };
+
+	// WriteFile takes a 32-bit length; unbuffered writes go out in chunks of this size
+	const DWORD			kMaxWriteBytes = 8 * 1024 * 1024;
+
+	// Largest sector size we are prepared to pad the tail of a file to
+	const DWORD			kMaxSectorBytes = 64 * 1024;
+
+	// Most files written by one submission on the async writer thread
+	const size_t		kMaxBatchFiles = 16;
+
+	struct PendingWrite
+	{
+		std::string			filepath;
+		MemoryStream*		stream;
+	};
+
+	// A file of the current batch, from open to publish
+	struct BatchEntry
+	{
+		PendingWrite			write;
+		std::string				tempFilepath;
+		HANDLE					file;
+		DWORD					sectorSize;
+		uint8_t*				tail;			// zero padded last sector for unbuffered writes
+		std::vector<OVERLAPPED>	requests;
+		std::vector<DWORD>		requestBytes;
+		HRESULT					result;
+	};
+
+	// Async writer state, guarded by g_asyncMutex
+	std::thread					g_asyncThread;
+	std::mutex					g_asyncMutex;
+	std::condition_variable		g_asyncCondition;		// signalled when writes are queued or stop is requested
+	std::condition_variable		g_asyncSpaceCondition;	// signalled when queued bytes are written
+	std::deque<PendingWrite>	g_asyncQueue;
+	size_t						g_asyncPendingBytes = 0;
+	size_t						g_asyncMaxPendingBytes = 0;
+	bool						g_stopAsyncWriter = false;
+
+	HANDLE OpenUnbuffered(const std::string& filepath, const void* data, DWORD extraFlags, DWORD& sectorSize);
+	HANDLE OpenTempFile(const std::string& tempFilepath, const void* data, size_t size, DWORD extraFlags, DWORD& sectorSize);
+	HRESULT PublishFile(HANDLE file, const std::string& tempFilepath, const std::string& filepath, HRESULT result);
+	HRESULT WriteUnbuffered(HANDLE file, const uint8_t* bytes, size_t size, DWORD sectorSize);
+	void WriteBatch(HANDLE completionPort, std::vector<PendingWrite>& writes);
+}
+
+void FileWriter::Configure(const Options& options)
+{
+	g_options = options;
+}
+
+// Returns INVALID_HANDLE_VALUE when the volume or the buffer does not meet the alignment unbuffered I/O requires
+HANDLE FileWriter::OpenUnbuffered(const std::string& filepath, const void* data, DWORD extraFlags, DWORD& sectorSize)
+{
+	FILE_STORAGE_INFO		storageInfo;
+	FILE_ALIGNMENT_INFO		alignmentInfo;
+
+	HANDLE file = CreateFileA(filepath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | extraFlags, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return INVALID_HANDLE_VALUE;
+
+	if (!GetFileInformationByHandleEx(file, FileStorageInfo, &storageInfo, sizeof(storageInfo)) ||
+		!GetFileInformationByHandleEx(file, FileAlignmentInfo, &alignmentInfo, sizeof(alignmentInfo)))
+	{
+		CloseHandle(file);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	// Sizes and offsets must be whole sectors, the buffer must satisfy both the sector size and the device alignment
+	sectorSize = (std::max)(storageInfo.LogicalBytesPerSector, storageInfo.PhysicalBytesPerSectorForPerformance);
+	DWORD bufferAlignment = (std::max)(sectorSize, (DWORD)alignmentInfo.AlignmentRequirement + 1);
+
+	if ((sectorSize == 0) || (sectorSize > kMaxSectorBytes) || ((sectorSize & (sectorSize - 1)) != 0) ||
+		(((uintptr_t)data % bufferAlignment) != 0))
+	{
+		spdlog::debug("Unbuffered write not possible for {} (sector size {}, alignment {})", filepath, sectorSize, bufferAlignment);
+		CloseHandle(file);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return file;
+}
+
+HRESULT FileWriter::WriteChunks(HANDLE file, const uint8_t* bytes, size_t size)
+{
+	size_t		offset = 0;
+
+	while (offset < size)
+	{
+		DWORD bytesToWrite = (DWORD)(std::min)(size - offset, (size_t)kMaxWriteBytes);
+		DWORD bytesWritten = 0;
+
+		if (!WriteFile(file, bytes + offset, bytesToWrite, &bytesWritten, NULL) || bytesWritten != bytesToWrite)
+			return HRESULT_FROM_WIN32(GetLastError());
+
+		offset += bytesWritten;
+	}
+
+	return S_OK;
+}
+
+HRESULT FileWriter::WriteUnbuffered(HANDLE file, const uint8_t* bytes, size_t size, DWORD sectorSize)
+{
+	HRESULT					result = S_OK;
+	size_t					alignedSize = size & ~((size_t)sectorSize - 1);
+	size_t					tailSize = size - alignedSize;
+	FILE_END_OF_FILE_INFO	endOfFileInfo;
+
+	// Whole sectors straight from the caller's buffer
+	result = WriteChunks(file, bytes, alignedSize);
+	if (FAILED(result))
+		return result;
+
+	// The partial last sector goes through a zero padded bounce buffer, then the file is cut back to its real length
+	if (tailSize > 0)
+	{
+		uint8_t* tail = (uint8_t*)VirtualAlloc(NULL, sectorSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (tail == NULL)
+			return E_OUTOFMEMORY;
+
+		memcpy(tail, bytes + alignedSize, tailSize);
+		result = WriteChunks(file, tail, sectorSize);
+		VirtualFree(tail, 0, MEM_RELEASE);
+
+		if (FAILED(result))
+			return result;
+
+		endOfFileInfo.EndOfFile.QuadPart = (LONGLONG)size;
+		if (!SetFileInformationByHandle(file, FileEndOfFileInfo, &endOfFileInfo, sizeof(endOfFileInfo)))
+			return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	return S_OK;
+}
+
+// Creates the temporary file, unbuffered when enabled and possible (sectorSize is then non-zero), and preallocates it
+HANDLE FileWriter::OpenTempFile(const std::string& tempFilepath, const void* data, size_t size, DWORD extraFlags, DWORD& sectorSize)
+{
+	HANDLE				file = INVALID_HANDLE_VALUE;
+
+	sectorSize = 0;
+	if (g_options.unbuffered && (size >= g_options.unbufferedMinBytes))
+		file = OpenUnbuffered(tempFilepath, data, extraFlags, sectorSize);
+
+	// Falls back to a cached write when unbuffered I/O is disabled or not possible
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		sectorSize = 0;
+		file = CreateFileA(tempFilepath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN | extraFlags, NULL);
+	}
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		DWORD lastError = GetLastError();
+		spdlog::error("Could not create file {}", tempFilepath);
+		SetLastError(lastError);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	if (g_options.preallocate)
+	{
+		FILE_ALLOCATION_INFO allocationInfo;
+		allocationInfo.AllocationSize.QuadPart = (LONGLONG)size;
+
+		// Best effort: the write still succeeds without it
+		if (!SetFileInformationByHandle(file, FileAllocationInfo, &allocationInfo, sizeof(allocationInfo)))
+			spdlog::debug("Could not preallocate {} bytes for {}", size, tempFilepath);
+	}
+
+	return file;
+}
+
+// Flushes, closes and renames a written temporary file into place, or removes it if writing failed
+HRESULT FileWriter::PublishFile(HANDLE file, const std::string& tempFilepath, const std::string& filepath, HRESULT result)
+{
+	if (FAILED(result))
+		goto bail;
+
+	// Unbuffered data is already on the device, but the file metadata may still be cached
+	if (g_options.durability != kDurabilityNone)
+	{
+		if (!FlushFileBuffers(file))
+		{
+			result = HRESULT_FROM_WIN32(GetLastError());
+			goto bail;
+		}
+	}
+
+	CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+
+	if (!MoveFileExA(tempFilepath.c_str(), filepath.c_str(),
+		MOVEFILE_REPLACE_EXISTING | ((g_options.durability == kDurabilityFull) ? MOVEFILE_WRITE_THROUGH : 0)))
+	{
+		result = HRESULT_FROM_WIN32(GetLastError());
+		goto bail;
+	}
+
+bail:
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+
+	if (FAILED(result))
+	{
+		spdlog::error("Could not write file {}", filepath);
+		DeleteFileA(tempFilepath.c_str());
+	}
+
+	return result;
+}
+
+HRESULT FileWriter::WriteFileAtomic(const std::string& filepath, const void* data, size_t size)
+{
+	HRESULT				result = S_OK;
+	std::string			tempFilepath = filepath + ".tmp";
+	DWORD				sectorSize = 0;
+
+	HANDLE file = OpenTempFile(tempFilepath, data, size, 0, sectorSize);
+	if (file == INVALID_HANDLE_VALUE)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	if (sectorSize != 0)
+		result = WriteUnbuffered(file, (const uint8_t*)data, size, sectorSize);
+	else
+		result = WriteChunks(file, (const uint8_t*)data, size);
+
+	return PublishFile(file, tempFilepath, filepath, result);
+}
+
+// Opens every file of the batch, queues all of their writes on the completion port, waits for them all,
+// then publishes each file. Keys on the port are indices into the batch.
+void FileWriter::WriteBatch(HANDLE completionPort, std::vector<PendingWrite>& writes)
+{
+	std::vector<BatchEntry>		batch(writes.size());
+	size_t						outstanding = 0;
+
+	for (size_t i = 0; i < writes.size(); i++)
+	{
+		BatchEntry&		entry = batch[i];
+		const uint8_t*	bytes = writes[i].stream->GetData();
+		size_t			size = writes[i].stream->GetSize();
+		size_t			alignedSize = size;
+
+		entry.write = writes[i];
+		entry.tempFilepath = entry.write.filepath + ".tmp";
+		entry.tail = NULL;
+		entry.result = S_OK;
+
+		entry.file = OpenTempFile(entry.tempFilepath, bytes, size, FILE_FLAG_OVERLAPPED, entry.sectorSize);
+		if ((entry.file == INVALID_HANDLE_VALUE) || (CreateIoCompletionPort(entry.file, completionPort, (ULONG_PTR)i, 0) == NULL))
+		{
+			entry.result = HRESULT_FROM_WIN32(GetLastError());
+			continue;
+		}
+
+		// Split into chunks at explicit offsets; with unbuffered I/O the partial last sector goes through a padded copy
+		std::vector<std::pair<const uint8_t*, DWORD>> chunks;
+		if (entry.sectorSize != 0)
+			alignedSize = size & ~((size_t)entry.sectorSize - 1);
+
+		for (size_t offset = 0; offset < alignedSize; offset += kMaxWriteBytes)
+			chunks.push_back(std::make_pair(bytes + offset, (DWORD)(std::min)(alignedSize - offset, (size_t)kMaxWriteBytes)));
+
+		if (alignedSize < size)
+		{
+			entry.tail = (uint8_t*)VirtualAlloc(NULL, entry.sectorSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+			if (entry.tail == NULL)
+			{
+				entry.result = E_OUTOFMEMORY;
+				continue;
+			}
+			memcpy(entry.tail, bytes + alignedSize, size - alignedSize);
+			chunks.push_back(std::make_pair((const uint8_t*)entry.tail, entry.sectorSize));
+		}
+
+		entry.requests.resize(chunks.size());
+		entry.requestBytes.resize(chunks.size());
+
+		uint64_t offset = 0;
+		for (size_t c = 0; c < chunks.size(); c++)
+		{
+			OVERLAPPED& request = entry.requests[c];
+
+			memset(&request, 0, sizeof(request));
+			request.Offset = (DWORD)offset;
+			request.OffsetHigh = (DWORD)(offset >> 32);
+			entry.requestBytes[c] = chunks[c].second;
+
+			// A write completing immediately still posts to the port
+			if (!WriteFile(entry.file, chunks[c].first, chunks[c].second, NULL, &request) && (GetLastError() != ERROR_IO_PENDING))
+			{
+				entry.result = HRESULT_FROM_WIN32(GetLastError());
+				break;
+			}
+			outstanding++;
+			offset += chunks[c].second;
+		}
+	}
+
+	while (outstanding > 0)
+	{
+		DWORD			bytesWritten = 0;
+		ULONG_PTR		key = 0;
+		OVERLAPPED*		request = NULL;
+
+		BOOL completed = GetQueuedCompletionStatus(completionPort, &bytesWritten, &key, &request, INFINITE);
+		if (request == NULL)
+		{
+			// The port itself failed: cancel what is still in flight and wait for each request to finish,
+			// so that the buffers, handles and temporary files can be released
+			spdlog::error("Waiting for file writes failed, cancelling the batch");
+			for (BatchEntry& entry : batch)
+			{
+				if (entry.file == INVALID_HANDLE_VALUE)
+					continue;
+
+				CancelIoEx(entry.file, NULL);
+				for (OVERLAPPED& pending : entry.requests)
+				{
+					while (!HasOverlappedIoCompleted(&pending))
+						Sleep(1);
+				}
+				entry.result = E_ABORT;
+			}
+			outstanding = 0;
+			break;
+		}
+		outstanding--;
+
+		BatchEntry& entry = batch[key];
+		if (!completed || (bytesWritten != entry.requestBytes[request - entry.requests.data()]))
+			entry.result = completed ? E_FAIL : HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	for (BatchEntry& entry : batch)
+	{
+		if (entry.file == INVALID_HANDLE_VALUE)
+		{
+			spdlog::error("Could not write file {}", entry.write.filepath);
+		}
+		else
+		{
+			if (SUCCEEDED(entry.result) && (entry.tail != NULL))
+			{
+				FILE_END_OF_FILE_INFO endOfFileInfo;
+				endOfFileInfo.EndOfFile.QuadPart = (LONGLONG)entry.write.stream->GetSize();
+				if (!SetFileInformationByHandle(entry.file, FileEndOfFileInfo, &endOfFileInfo, sizeof(endOfFileInfo)))
+					entry.result = HRESULT_FROM_WIN32(GetLastError());
+			}
+
+			PublishFile(entry.file, entry.tempFilepath, entry.write.filepath, entry.result);
+		}
+
+		if (entry.tail != NULL)
+			VirtualFree(entry.tail, 0, MEM_RELEASE);
+		entry.write.stream->Release();
+	}
+}
+
+void FileWriter::StartAsyncWriter(size_t maxPendingBytes)
+{
+	StopAsyncWriter();
+
+	g_stopAsyncWriter = false;
+	g_asyncMaxPendingBytes = maxPendingBytes;
+	g_asyncThread = std::thread([] {
+		std::vector<PendingWrite>	writes;
+
+		// Without a completion port, files are written one at a time on this thread, still off the encode threads
+		HANDLE completionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+		if (completionPort == NULL)
+			spdlog::warn("Could not create I/O completion port, writing files sequentially");
+
+		std::unique_lock<std::mutex> lock(g_asyncMutex);
+		while (true)
+		{
+			g_asyncCondition.wait(lock, [] { return g_stopAsyncWriter || !g_asyncQueue.empty(); });
+			if (g_asyncQueue.empty())
+				break;
+
+			writes.clear();
+			while (!g_asyncQueue.empty() && (writes.size() < kMaxBatchFiles))
+			{
+				writes.push_back(g_asyncQueue.front());
+				g_asyncQueue.pop_front();
+			}
+
+			size_t batchBytes = 0;
+			for (const PendingWrite& write : writes)
+				batchBytes += write.stream->GetSize();
+
+			lock.unlock();
+			if (completionPort != NULL)
+			{
+				WriteBatch(completionPort, writes);
+			}
+			else
+			{
+				for (PendingWrite& write : writes)
+				{
+					WriteFileAtomic(write.filepath, write.stream->GetData(), write.stream->GetSize());
+					write.stream->Release();
+				}
+			}
+			lock.lock();
+
+			g_asyncPendingBytes -= batchBytes;
+			g_asyncSpaceCondition.notify_all();
+		}
+
+		if (completionPort != NULL)
+			CloseHandle(completionPort);
+	});
+}
+
+void FileWriter::StopAsyncWriter()
+{
+	if (!g_asyncThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(g_asyncMutex);
+		g_stopAsyncWriter = true;
+	}
+	g_asyncCondition.notify_one();
+	g_asyncThread.join();
+}
+
+bool FileWriter::IsAsyncWriterRunning()
+{
+	return g_asyncThread.joinable();
+}
+
+void FileWriter::WriteFileAsync(const std::string& filepath, MemoryStream* stream)
+{
+	size_t size = stream->GetSize();
+
+	stream->AddRef();
+	{
+		std::unique_lock<std::mutex> lock(g_asyncMutex);
+
+		// Bound the memory held by queued images; a single file larger than the limit is still accepted
+		g_asyncSpaceCondition.wait(lock, [=] { return (g_asyncPendingBytes == 0) || (g_asyncPendingBytes + size <= g_asyncMaxPendingBytes); });
+
+		g_asyncQueue.push_back({ filepath, stream });
+		g_asyncPendingBytes += size;
+	}
+	g_asyncCondition.notify_one();
+}
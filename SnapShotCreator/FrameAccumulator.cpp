@@ -0,0 +1,424 @@
+#include <string.h>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FRAMEACCUMULATOR_SSE2
+#endif
+
+#include "platform.h"
+#include "PixelConverter.h"
+#include "RawVideoFrame.h"
+#include "FrameAccumulator.h"
+
+namespace
+{
+	// Samples handled per step and thread; a multiple of the sample groups of every layout
+	// (12 for a block of four 10-bit words, 24 for nine 12-bit words) and of the 16-byte vectors
+	const size_t	kChunkSamples = 4800;
+
+	inline uint32_t LoadWord(const uint8_t* p, bool bigEndian)
+	{
+		if (bigEndian)
+			return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+		return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+	}
+
+	inline void StoreWord(uint8_t* p, uint32_t value, bool bigEndian)
+	{
+		for (int i = 0; i < 4; i++)
+			p[bigEndian ? 3 - i : i] = (uint8_t)(value >> (i * 8));
+	}
+
+#if defined(FRAMEACCUMULATOR_SSE2)
+	inline __m128i ByteSwap32(__m128i value)
+	{
+		value = _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+		return _mm_shufflehi_epi16(_mm_shufflelo_epi16(value, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+	}
+#endif
+
+	size_t GetSampleCount(const FrameAccumulator::SampleLayout& layout, size_t bufferSize)
+	{
+		switch (layout.bits)
+		{
+			case 8:		return bufferSize;
+			case 10:	return bufferSize / 4 * 3;
+			default:	return bufferSize / 36 * 24;
+		}
+	}
+
+	// Samples [first, first + count) as 16-bit values, first being a multiple of kChunkSamples.
+	// 10-bit words go in blocks of four, the first sample of each of the words before the second ones and the
+	// third ones, so that the three fields of four words are extracted at once; any order serves as long as
+	// StoreSamples puts them back the same way.
+	void ExtractSamples(const FrameAccumulator::SampleLayout& layout, const uint8_t* buffer, size_t first, size_t count, uint16_t* dst)
+	{
+		if (layout.bits == 8)
+		{
+			size_t i = 0;
+#if defined(FRAMEACCUMULATOR_SSE2)
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 16 <= count; i += 16)
+			{
+				__m128i bytes = _mm_loadu_si128((const __m128i*)(buffer + first + i));
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(bytes, zero));
+				_mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(bytes, zero));
+			}
+#endif
+			for (; i < count; i++)
+				dst[i] = buffer[first + i];
+		}
+		else if (layout.bits == 10)
+		{
+			size_t firstWord = first / 3;
+			size_t endWord = firstWord + count / 3;
+
+			for (size_t word = firstWord; word < endWord; word += 4, dst += 12)
+			{
+				size_t words = (std::min)((size_t)4, endWord - word);
+#if defined(FRAMEACCUMULATOR_SSE2)
+				if (words == 4)
+				{
+					const __m128i	mask = _mm_set1_epi32(0x3ff);
+					__m128i			values = _mm_loadu_si128((const __m128i*)(buffer + word * 4));
+
+					if (layout.bigEndian)
+						values = ByteSwap32(values);
+					__m128i field0 = _mm_and_si128(_mm_srl_epi32(values, _mm_cvtsi32_si128(layout.shift)), mask);
+					__m128i field1 = _mm_and_si128(_mm_srl_epi32(values, _mm_cvtsi32_si128(layout.shift + 10)), mask);
+					__m128i field2 = _mm_and_si128(_mm_srl_epi32(values, _mm_cvtsi32_si128(layout.shift + 20)), mask);
+					_mm_storeu_si128((__m128i*)dst, _mm_packs_epi32(field0, field1));
+					_mm_storel_epi64((__m128i*)(dst + 8), _mm_packs_epi32(field2, field2));
+					continue;
+				}
+#endif
+				for (size_t l = 0; l < words; l++)
+				{
+					uint32_t value = LoadWord(buffer + (word + l) * 4, layout.bigEndian);
+					for (size_t k = 0; k < 3; k++)
+						dst[k * words + l] = (uint16_t)((value >> (layout.shift + k * 10)) & 0x3ff);
+				}
+			}
+		}
+		else
+		{
+			uint32_t words[10];
+
+			// Spare last word, so that samples straddling two words need no bounds check
+			words[9] = 0;
+			for (size_t group = first / 24; group < (first + count) / 24; group++, dst += 24)
+			{
+				for (int w = 0; w < 9; w++)
+					words[w] = LoadWord(buffer + group * 36 + w * 4, layout.bigEndian);
+
+				for (int k = 0; k < 24; k++)
+				{
+					int bit = k * 12;
+					dst[k] = (uint16_t)(((((uint64_t)words[bit / 32 + 1] << 32) | words[bit / 32]) >> (bit % 32)) & 0xfff);
+				}
+			}
+		}
+	}
+
+	// Inverse of ExtractSamples; bits outside the samples, such as the padding of 10-bit words, are cleared
+	void StoreSamples(const FrameAccumulator::SampleLayout& layout, uint8_t* buffer, size_t first, size_t count, const uint16_t* src)
+	{
+		if (layout.bits == 8)
+		{
+			size_t i = 0;
+#if defined(FRAMEACCUMULATOR_SSE2)
+			for (; i + 16 <= count; i += 16)
+			{
+				__m128i low = _mm_loadu_si128((const __m128i*)(src + i));
+				__m128i high = _mm_loadu_si128((const __m128i*)(src + i + 8));
+				_mm_storeu_si128((__m128i*)(buffer + first + i), _mm_packus_epi16(low, high));
+			}
+#endif
+			for (; i < count; i++)
+				buffer[first + i] = (uint8_t)src[i];
+		}
+		else if (layout.bits == 10)
+		{
+			size_t firstWord = first / 3;
+			size_t endWord = firstWord + count / 3;
+
+			for (size_t word = firstWord; word < endWord; word += 4, src += 12)
+			{
+				size_t words = (std::min)((size_t)4, endWord - word);
+#if defined(FRAMEACCUMULATOR_SSE2)
+				if (words == 4)
+				{
+					const __m128i	zero = _mm_setzero_si128();
+					__m128i			fields01 = _mm_loadu_si128((const __m128i*)src);
+					__m128i			field2 = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(src + 8)), zero);
+					__m128i			values = _mm_or_si128(
+						_mm_or_si128(_mm_sll_epi32(_mm_unpacklo_epi16(fields01, zero), _mm_cvtsi32_si128(layout.shift)),
+							_mm_sll_epi32(_mm_unpackhi_epi16(fields01, zero), _mm_cvtsi32_si128(layout.shift + 10))),
+						_mm_sll_epi32(field2, _mm_cvtsi32_si128(layout.shift + 20)));
+
+					if (layout.bigEndian)
+						values = ByteSwap32(values);
+					_mm_storeu_si128((__m128i*)(buffer + word * 4), values);
+					continue;
+				}
+#endif
+				for (size_t l = 0; l < words; l++)
+				{
+					uint32_t value = 0;
+					for (size_t k = 0; k < 3; k++)
+						value |= (uint32_t)src[k * words + l] << (layout.shift + k * 10);
+					StoreWord(buffer + (word + l) * 4, value, layout.bigEndian);
+				}
+			}
+		}
+		else
+		{
+			for (size_t group = first / 24; group < (first + count) / 24; group++, src += 24)
+			{
+				uint32_t words[10] = { 0 };
+
+				for (int k = 0; k < 24; k++)
+				{
+					int			bit = k * 12;
+					uint64_t	bits = (uint64_t)(src[k] & 0xfff) << (bit % 32);
+					words[bit / 32] |= (uint32_t)bits;
+					words[bit / 32 + 1] |= (uint32_t)(bits >> 32);
+				}
+
+				for (int w = 0; w < 9; w++)
+					StoreWord(buffer + group * 36 + w * 4, words[w], layout.bigEndian);
+			}
+		}
+	}
+
+	// Rounded sum / frames, with a reciprocal that is exact for sums of up to 2^32 / frames
+	inline uint16_t Divide(uint32_t sum, uint32_t half, uint64_t reciprocal)
+	{
+		return (uint16_t)(((sum + half) * reciprocal) >> 32);
+	}
+
+	// Median of count rows of 8 samples each, values up to 12 bits; the rows are partly sorted in place.
+	// Bubble passes move the largest remaining value to the end, so after count / 2 + 1 of them
+	// the middle one or two rows are in place.
+	void Median(uint16_t* rows, size_t rowStride, int count, uint16_t* dst)
+	{
+#if defined(FRAMEACCUMULATOR_SSE2)
+		__m128i values[FrameAccumulator::kMaxMedianFrames];
+
+		for (int i = 0; i < count; i++)
+			values[i] = _mm_loadu_si128((const __m128i*)(rows + i * rowStride));
+
+		for (int pass = 0; pass < count / 2 + 1; pass++)
+		{
+			for (int i = 0; i + 1 < count - pass; i++)
+			{
+				__m128i low = _mm_min_epi16(values[i], values[i + 1]);
+				values[i + 1] = _mm_max_epi16(values[i], values[i + 1]);
+				values[i] = low;
+			}
+		}
+
+		__m128i median = (count % 2 != 0) ? values[count / 2] : _mm_avg_epu16(values[count / 2 - 1], values[count / 2]);
+		_mm_storeu_si128((__m128i*)dst, median);
+#else
+		for (int lane = 0; lane < 8; lane++)
+		{
+			uint16_t values[FrameAccumulator::kMaxMedianFrames];
+
+			for (int i = 0; i < count; i++)
+				values[i] = rows[i * rowStride + lane];
+			std::sort(values, values + count);
+			dst[lane] = (count % 2 != 0) ? values[count / 2] : (uint16_t)((values[count / 2 - 1] + values[count / 2] + 1) / 2);
+		}
+#endif
+	}
+}
+
+FrameAccumulator::FrameAccumulator(Mode mode)
+	: m_mode(mode), m_width(0), m_height(0), m_rowBytes(0), m_pixelFormat(bmdFormat8BitYUV), m_flags(bmdFrameFlagDefault),
+	m_layout({ 8, false, 0 }), m_sampleCount(0), m_frameCount(0)
+{
+}
+
+bool FrameAccumulator::GetSampleLayout(BMDPixelFormat pixelFormat, SampleLayout& layout)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:		layout = { 8, false, 0 }; return true;
+		case bmdFormat10BitYUV:		layout = { 10, false, 0 }; return true;
+		case bmdFormat10BitRGB:		layout = { 10, true, 0 }; return true;
+		case bmdFormat10BitRGBX:	layout = { 10, true, 2 }; return true;
+		case bmdFormat10BitRGBXLE:	layout = { 10, false, 2 }; return true;
+		case bmdFormat12BitRGB:		layout = { 12, true, 0 }; return true;
+		case bmdFormat12BitRGBLE:	layout = { 12, false, 0 }; return true;
+		default:					return false;
+	}
+}
+
+HRESULT FrameAccumulator::Add(IDeckLinkVideoFrame* videoFrame)
+{
+	void*		frameBytes = NULL;
+
+	videoFrame->GetBytes(&frameBytes);
+	if (frameBytes == NULL)
+		return E_POINTER;
+
+	if (m_frameCount == 0)
+	{
+		if (!GetSampleLayout(videoFrame->GetPixelFormat(), m_layout))
+			return E_INVALIDARG;
+
+		m_width = videoFrame->GetWidth();
+		m_height = videoFrame->GetHeight();
+		m_rowBytes = videoFrame->GetRowBytes();
+		m_pixelFormat = videoFrame->GetPixelFormat();
+		m_flags = videoFrame->GetFlags();
+		m_sampleCount = GetSampleCount(m_layout, (size_t)m_rowBytes * m_height);
+
+		if (m_mode == kModeMean)
+		{
+			if (m_layout.bits == 8)
+				m_sums16.assign(m_sampleCount, 0);
+			else
+				m_sums32.assign(m_sampleCount, 0);
+		}
+	}
+	else if ((videoFrame->GetWidth() != m_width) || (videoFrame->GetHeight() != m_height) ||
+		(videoFrame->GetRowBytes() != m_rowBytes) || (videoFrame->GetPixelFormat() != m_pixelFormat))
+	{
+		return E_INVALIDARG;
+	}
+
+	if ((m_mode == kModeMedian) && (m_frames.size() >= (size_t)kMaxMedianFrames))
+		return E_INVALIDARG;
+	else if ((m_mode == kModeMean) && (m_layout.bits == 8) && (m_frameCount >= 257))
+		return E_INVALIDARG;
+
+	const uint8_t*	bytes = (const uint8_t*)frameBytes;
+	long			chunks = (long)((m_sampleCount + kChunkSamples - 1) / kChunkSamples);
+
+	if (m_mode == kModeMedian)
+	{
+		m_frames.emplace_back(bytes, bytes + (size_t)m_rowBytes * m_height);
+	}
+	else if (m_layout.bits == 8)
+	{
+		// Bytes widened straight into the 16-bit sums
+		PixelConverter::ParallelRows(chunks, [&](long firstChunk, long endChunk) {
+			size_t		first = (size_t)firstChunk * kChunkSamples;
+			size_t		end = (std::min)((size_t)endChunk * kChunkSamples, m_sampleCount);
+			uint16_t*	sums = m_sums16.data();
+			size_t		i = first;
+
+#if defined(FRAMEACCUMULATOR_SSE2)
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 16 <= end; i += 16)
+			{
+				__m128i values = _mm_loadu_si128((const __m128i*)(bytes + i));
+				__m128i low = _mm_loadu_si128((const __m128i*)(sums + i));
+				__m128i high = _mm_loadu_si128((const __m128i*)(sums + i + 8));
+				_mm_storeu_si128((__m128i*)(sums + i), _mm_add_epi16(low, _mm_unpacklo_epi8(values, zero)));
+				_mm_storeu_si128((__m128i*)(sums + i + 8), _mm_add_epi16(high, _mm_unpackhi_epi8(values, zero)));
+			}
+#endif
+			for (; i < end; i++)
+				sums[i] += bytes[i];
+		});
+	}
+	else
+	{
+		// Packed samples extracted a chunk at a time, then widened into the 32-bit sums
+		PixelConverter::ParallelRows(chunks, [&](long firstChunk, long endChunk) {
+			std::vector<uint16_t>	samples(kChunkSamples);
+
+			for (long chunk = firstChunk; chunk < endChunk; chunk++)
+			{
+				size_t		first = (size_t)chunk * kChunkSamples;
+				size_t		count = (std::min)(kChunkSamples, m_sampleCount - first);
+				uint32_t*	sums = m_sums32.data() + first;
+				size_t		i = 0;
+
+				ExtractSamples(m_layout, bytes, first, count, samples.data());
+
+#if defined(FRAMEACCUMULATOR_SSE2)
+				const __m128i zero = _mm_setzero_si128();
+				for (; i + 8 <= count; i += 8)
+				{
+					__m128i values = _mm_loadu_si128((const __m128i*)(samples.data() + i));
+					__m128i low = _mm_loadu_si128((const __m128i*)(sums + i));
+					__m128i high = _mm_loadu_si128((const __m128i*)(sums + i + 4));
+					_mm_storeu_si128((__m128i*)(sums + i), _mm_add_epi32(low, _mm_unpacklo_epi16(values, zero)));
+					_mm_storeu_si128((__m128i*)(sums + i + 4), _mm_add_epi32(high, _mm_unpackhi_epi16(values, zero)));
+				}
+#endif
+				for (; i < count; i++)
+					sums[i] += samples[i];
+			}
+		});
+	}
+
+	m_frameCount++;
+	return S_OK;
+}
+
+HRESULT FrameAccumulator::GetResult(IDeckLinkVideoFrame** resultFrame)
+{
+	std::vector<uint8_t>	buffer;
+	long					chunks = (long)((m_sampleCount + kChunkSamples - 1) / kChunkSamples);
+	uint32_t				half = m_frameCount / 2;
+	uint64_t				reciprocal = 0xffffffffULL / (std::max)(m_frameCount, 1u) + 1;
+
+	*resultFrame = NULL;
+	if (m_frameCount == 0)
+		return E_FAIL;
+
+	// Built with the stride of the captured frames, then copied row by row into the new frame
+	buffer.assign((size_t)m_rowBytes * m_height, 0);
+
+	PixelConverter::ParallelRows(chunks, [&](long firstChunk, long endChunk) {
+		std::vector<uint16_t>	samples(kChunkSamples * (m_mode == kModeMedian ? m_frames.size() + 1 : 1));
+		uint16_t*				result = samples.data() + (samples.size() - kChunkSamples);
+
+		for (long chunk = firstChunk; chunk < endChunk; chunk++)
+		{
+			size_t first = (size_t)chunk * kChunkSamples;
+			size_t count = (std::min)(kChunkSamples, m_sampleCount - first);
+
+			if (m_mode == kModeMedian)
+			{
+				for (size_t f = 0; f < m_frames.size(); f++)
+					ExtractSamples(m_layout, m_frames[f].data(), first, count, samples.data() + f * kChunkSamples);
+
+				// Whole vectors; samples past count in the last chunk are computed but not stored
+				for (size_t i = 0; i < count; i += 8)
+					Median(samples.data() + i, kChunkSamples, (int)m_frames.size(), result + i);
+			}
+			else if (m_layout.bits == 8)
+			{
+				for (size_t i = 0; i < count; i++)
+					result[i] = Divide(m_sums16[first + i], half, reciprocal);
+			}
+			else
+			{
+				for (size_t i = 0; i < count; i++)
+					result[i] = Divide(m_sums32[first + i], half, reciprocal);
+			}
+
+			StoreSamples(m_layout, buffer.data(), first, count, result);
+		}
+	});
+
+	RawVideoFrame*	frame = new RawVideoFrame(m_width, m_height, m_pixelFormat, m_flags);
+	void*			frameBytes = NULL;
+	long			rowBytes = (std::min)(m_rowBytes, frame->GetRowBytes());
+
+	frame->GetBytes(&frameBytes);
+	for (long y = 0; y < m_height; y++)
+		memcpy((uint8_t*)frameBytes + (size_t)y * frame->GetRowBytes(), buffer.data() + (size_t)y * m_rowBytes, rowBytes);
+
+	*resultFrame = frame;
+	return S_OK;
+}
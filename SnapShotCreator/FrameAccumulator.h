@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Noise reduction by combining consecutive frames sample by sample in their native pixel format: a running sum
+// for the mean, updated as each frame arrives, or copies of the frames for the median. Only the result is divided
+// and repacked, into a frame of the same pixel format that is converted and encoded like a captured one.
+class FrameAccumulator
+{
+public:
+	enum Mode
+	{
+		kModeMean = 0,
+		kModeMedian,
+	};
+
+	// Samples of a pixel format as stored in its frame buffer
+	struct SampleLayout
+	{
+		int						bits;			// 8 for byte samples, 10 for three per 32-bit word, 12 for 24 per nine words
+		bool					bigEndian;		// of the 32-bit words
+		int						shift;			// of the lowest 10-bit sample in a word
+	};
+
+	// Frames the median is taken from at most, each one is kept as a copy
+	static const int			kMaxMedianFrames = 15;
+
+private:
+	Mode						m_mode;
+	long						m_width;
+	long						m_height;
+	long						m_rowBytes;
+	BMDPixelFormat				m_pixelFormat;
+	BMDFrameFlags				m_flags;
+	SampleLayout				m_layout;
+	size_t						m_sampleCount;
+	uint32_t					m_frameCount;
+
+	std::vector<uint16_t>		m_sums16;		// mean of 8-bit samples, enough for 257 frames
+	std::vector<uint32_t>		m_sums32;		// mean of 10 and 12-bit samples
+	std::vector<std::vector<uint8_t>>	m_frames;	// median
+
+public:
+	FrameAccumulator(Mode mode);
+
+	static bool					GetSampleLayout(BMDPixelFormat pixelFormat, SampleLayout& layout);
+
+	// The first frame sets the size and pixel format, later ones must match it
+	HRESULT						Add(IDeckLinkVideoFrame* videoFrame);
+	uint32_t					GetFrameCount(void) const	{ return m_frameCount; };
+
+	// New frame with the mean or median of the frames added, rounded to the precision of the pixel format
+	HRESULT						GetResult(IDeckLinkVideoFrame** resultFrame);
+};
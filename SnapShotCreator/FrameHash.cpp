@@ -0,0 +1,198 @@
+#include <string.h>
+#include <bitset>
+#include <vector>
+
+#include "platform.h"
+#include "PixelConverter.h"
+#include "FrameHash.h"
+
+namespace
+{
+	const uint64_t	kPrime1 = 11400714785074694791ULL;
+	const uint64_t	kPrime2 = 14029467366897019727ULL;
+	const uint64_t	kPrime3 = 1609587929392839161ULL;
+	const uint64_t	kPrime4 = 9650029242287828579ULL;
+	const uint64_t	kPrime5 = 2870177450012600261ULL;
+
+	// Perceptual hash grid, one column wider than the 8 gradients of each row
+	const long		kGridWidth = 9;
+	const long		kGridHeight = 8;
+
+	// Source rows unpacked per grid row; only these are read, so the cost does not grow with the frame height
+	const long		kSampleRowsPerCell = 4;
+
+	inline uint64_t RotateLeft(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	inline uint64_t Read64(const uint8_t* p)
+	{
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint32_t Read32(const uint8_t* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint64_t Round(uint64_t accumulator, uint64_t input)
+	{
+		accumulator += input * kPrime2;
+		accumulator = RotateLeft(accumulator, 31);
+		return accumulator * kPrime1;
+	}
+
+	inline uint64_t MergeRound(uint64_t accumulator, uint64_t value)
+	{
+		accumulator ^= Round(0, value);
+		return accumulator * kPrime1 + kPrime4;
+	}
+}
+
+uint64_t FrameHash::XXHash64(const void* data, size_t length, uint64_t seed)
+{
+	const uint8_t*	p = (const uint8_t*)data;
+	const uint8_t*	end = p + length;
+	uint64_t		hash;
+
+	if (length >= 32)
+	{
+		// Four independent lanes keep the multipliers busy
+		uint64_t v1 = seed + kPrime1 + kPrime2;
+		uint64_t v2 = seed + kPrime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - kPrime1;
+
+		for (const uint8_t* limit = end - 32; p <= limit; p += 32)
+		{
+			v1 = Round(v1, Read64(p));
+			v2 = Round(v2, Read64(p + 8));
+			v3 = Round(v3, Read64(p + 16));
+			v4 = Round(v4, Read64(p + 24));
+		}
+
+		hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+		hash = MergeRound(hash, v1);
+		hash = MergeRound(hash, v2);
+		hash = MergeRound(hash, v3);
+		hash = MergeRound(hash, v4);
+	}
+	else
+	{
+		hash = seed + kPrime5;
+	}
+
+	hash += (uint64_t)length;
+
+	for (; p + 8 <= end; p += 8)
+	{
+		hash ^= Round(0, Read64(p));
+		hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+	}
+
+	if (p + 4 <= end)
+	{
+		hash ^= (uint64_t)Read32(p) * kPrime1;
+		hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+		p += 4;
+	}
+
+	for (; p < end; p++)
+	{
+		hash ^= (*p) * kPrime5;
+		hash = RotateLeft(hash, 11) * kPrime1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= kPrime2;
+	hash ^= hash >> 29;
+	hash *= kPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+HRESULT FrameHash::Compute(IDeckLinkVideoFrame* videoFrame, Fingerprint& fingerprint)
+{
+	void*				bytes = NULL;
+	long				width = videoFrame->GetWidth();
+	long				height = videoFrame->GetHeight();
+	long				rowBytes = videoFrame->GetRowBytes();
+	BMDPixelFormat		pixelFormat = videoFrame->GetPixelFormat();
+
+	videoFrame->GetBytes(&bytes);
+	if (bytes == NULL)
+		return E_POINTER;
+
+	fingerprint.width = width;
+	fingerprint.height = height;
+	fingerprint.pixelFormat = pixelFormat;
+	fingerprint.exact = XXHash64(bytes, (size_t)rowBytes * height);
+	fingerprint.perceptual = 0;
+
+	if (!PixelConverter::IsSupported(pixelFormat) || (width < kGridWidth) || (height < kGridHeight * kSampleRowsPerCell))
+		return S_OK;
+
+	PixelConverter::Colorimetry	colorimetry = PixelConverter::GetColorimetry(height);
+	std::vector<uint16_t>		row(width * 3);
+	long						columnStart[kGridWidth + 1];
+
+	for (long x = 0; x <= kGridWidth; x++)
+		columnStart[x] = x * width / kGridWidth;
+
+	for (long gridY = 0; gridY < kGridHeight; gridY++)
+	{
+		uint64_t lumaSums[kGridWidth] = {};
+
+		// Rows at the centres of kSampleRowsPerCell equal bands of the grid row
+		for (long sample = 0; sample < kSampleRowsPerCell; sample++)
+		{
+			long band = gridY * kSampleRowsPerCell + sample;
+			long y = (2 * band + 1) * height / (2 * kGridHeight * kSampleRowsPerCell);
+
+			PixelConverter::UnpackRow(pixelFormat, colorimetry, (const uint8_t*)bytes + (size_t)y * rowBytes, 0, width, row.data());
+
+			for (long gridX = 0; gridX < kGridWidth; gridX++)
+			{
+				uint64_t		sum = 0;
+				const uint16_t*	rgb = row.data() + columnStart[gridX] * 3;
+
+				for (long x = columnStart[gridX]; x < columnStart[gridX + 1]; x++, rgb += 3)
+					sum += 77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2];
+				lumaSums[gridX] += sum;
+			}
+		}
+
+		// Bit set where the mean luma rises to the right, cells may differ in width by a column
+		for (long gridX = 0; gridX + 1 < kGridWidth; gridX++)
+		{
+			uint64_t left = lumaSums[gridX] * (uint64_t)(columnStart[gridX + 2] - columnStart[gridX + 1]);
+			uint64_t right = lumaSums[gridX + 1] * (uint64_t)(columnStart[gridX + 1] - columnStart[gridX]);
+
+			if (left < right)
+				fingerprint.perceptual |= 1ULL << (gridY * (kGridWidth - 1) + gridX);
+		}
+	}
+
+	return S_OK;
+}
+
+int FrameHash::HammingDistance(uint64_t a, uint64_t b)
+{
+	return (int)std::bitset<64>(a ^ b).count();
+}
+
+bool FrameHash::Matches(const Fingerprint& a, const Fingerprint& b, int threshold)
+{
+	if ((a.width != b.width) || (a.height != b.height) || (a.pixelFormat != b.pixelFormat))
+		return false;
+
+	if (a.exact == b.exact)
+		return true;
+
+	return HammingDistance(a.perceptual, b.perceptual) < threshold;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include "DeckLinkAPI.h"
+
+// Fingerprints of captured frames, computed on the native pixel format before any conversion,
+// used to tell whether the input changed since the last snapshot
+namespace FrameHash
+{
+	struct Fingerprint
+	{
+		long			width = 0;
+		long			height = 0;
+		BMDPixelFormat	pixelFormat = (BMDPixelFormat)0;
+		uint64_t		exact = 0;			// xxHash64 of the frame buffer
+		uint64_t		perceptual = 0;		// dHash of the luma: one bit per horizontal gradient of a 9x8 grid
+	};
+
+	// XXH64 of a buffer, bit exact with the reference implementation
+	uint64_t XXHash64(const void* data, size_t length, uint64_t seed = 0);
+
+	HRESULT Compute(IDeckLinkVideoFrame* videoFrame, Fingerprint& fingerprint);
+
+	int HammingDistance(uint64_t a, uint64_t b);
+
+	// Same frame geometry, and identical buffers or perceptual hashes differing in fewer than threshold bits.
+	// A threshold of 0 only accepts identical buffers.
+	bool Matches(const Fingerprint& a, const Fingerprint& b, int threshold);
+};
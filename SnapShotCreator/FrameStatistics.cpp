@@ -0,0 +1,382 @@
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FRAMESTATISTICS_SSE2
+#endif
+
+#include "platform.h"
+#include "FrameStatistics.h"
+
+namespace
+{
+	// Fixed point R'G'B' from 10-bit studio range Y'CbCr, full range is 1 << kGamutShift
+	const int		kGamutShift = 20;
+	const int32_t	kGamutLow = -(int32_t)((1 << kGamutShift) / 20);
+	const int32_t	kGamutHigh = (1 << kGamutShift) + (1 << kGamutShift) / 20;
+
+	struct GamutCoefficients
+	{
+		int16_t		y;
+		int16_t		rv;
+		int16_t		gu;
+		int16_t		gv;
+		int16_t		bu;
+	};
+
+	GamutCoefficients MakeGamutCoefficients(double kr, double kb)
+	{
+		double				kg = 1.0 - kr - kb;
+		double				scale = (double)(1 << kGamutShift);
+		GamutCoefficients	coefficients;
+
+		coefficients.y = (int16_t)lround(scale / 876.0);
+		coefficients.rv = (int16_t)lround(scale / 896.0 * 2.0 * (1.0 - kr));
+		coefficients.gu = (int16_t)lround(scale / 896.0 * 2.0 * (1.0 - kb) * kb / kg);
+		coefficients.gv = (int16_t)lround(scale / 896.0 * 2.0 * (1.0 - kr) * kr / kg);
+		coefficients.bu = (int16_t)lround(scale / 896.0 * 2.0 * (1.0 - kb));
+		return coefficients;
+	}
+
+	// Indexed by PixelConverter::Colorimetry
+	const GamutCoefficients	kGamutCoefficients[] =
+	{
+		MakeGamutCoefficients(0.299, 0.114),
+		MakeGamutCoefficients(0.2126, 0.0722),
+	};
+
+	// Per channel histograms of a band of rows. Consecutive pixels of flat areas hit the same bin,
+	// so even and odd pixels count into separate copies to keep the increments independent.
+	struct Accumulator
+	{
+		std::vector<uint32_t>	histograms[3][2];
+		uint64_t				outOfGamut = 0;
+
+		explicit Accumulator(int bitDepth)
+		{
+			for (auto& copies : histograms)
+			{
+				copies[0].assign((size_t)1 << bitDepth, 0);
+				copies[1].assign((size_t)1 << bitDepth, 0);
+			}
+		}
+	};
+
+	inline int32_t GamutTest(const GamutCoefficients& c, int32_t y, int32_t cb, int32_t cr)
+	{
+		int32_t luma = c.y * y;
+		int32_t r = luma + c.rv * cr;
+		int32_t g = luma - c.gu * cb - c.gv * cr;
+		int32_t b = luma + c.bu * cb;
+
+		return ((r < kGamutLow) || (r > kGamutHigh) || (g < kGamutLow) || (g > kGamutHigh) || (b < kGamutLow) || (b > kGamutHigh)) ? 1 : 0;
+	}
+
+	// Pixels of a row with an R'G'B' component outside the gamut limits. Components are native code values
+	// at bitDepth, shifted up to 10 bits; chroma is given per pixel.
+	uint64_t CountOutOfGamut(const GamutCoefficients& c, const uint16_t* luma, const uint16_t* cb, const uint16_t* cr, long width, int bitDepth)
+	{
+		int			shift = 10 - bitDepth;
+		uint64_t	count = 0;
+		long		i = 0;
+
+#if defined(FRAMESTATISTICS_SSE2)
+		// Eight pixels per step, each component pair multiplied and summed into 32 bits by one madd
+		const __m128i	shiftCount = _mm_cvtsi32_si128(shift);
+		const __m128i	lumaOffset = _mm_set1_epi16(64);
+		const __m128i	chromaOffset = _mm_set1_epi16(512);
+		const __m128i	zero = _mm_setzero_si128();
+		const __m128i	red = _mm_set_epi16(c.rv, c.y, c.rv, c.y, c.rv, c.y, c.rv, c.y);
+		const __m128i	greenCb = _mm_set_epi16(-c.gu, c.y, -c.gu, c.y, -c.gu, c.y, -c.gu, c.y);
+		const __m128i	greenCr = _mm_set_epi16(0, -c.gv, 0, -c.gv, 0, -c.gv, 0, -c.gv);
+		const __m128i	blue = _mm_set_epi16(c.bu, c.y, c.bu, c.y, c.bu, c.y, c.bu, c.y);
+		const __m128i	low = _mm_set1_epi32(kGamutLow);
+		const __m128i	high = _mm_set1_epi32(kGamutHigh);
+		__m128i			counts = _mm_setzero_si128();
+
+		for (; i + 8 <= width; i += 8)
+		{
+			__m128i y = _mm_sub_epi16(_mm_sll_epi16(_mm_loadu_si128((const __m128i*)(luma + i)), shiftCount), lumaOffset);
+			__m128i u = _mm_sub_epi16(_mm_sll_epi16(_mm_loadu_si128((const __m128i*)(cb + i)), shiftCount), chromaOffset);
+			__m128i v = _mm_sub_epi16(_mm_sll_epi16(_mm_loadu_si128((const __m128i*)(cr + i)), shiftCount), chromaOffset);
+
+			__m128i yv[2] = { _mm_unpacklo_epi16(y, v), _mm_unpackhi_epi16(y, v) };
+			__m128i yu[2] = { _mm_unpacklo_epi16(y, u), _mm_unpackhi_epi16(y, u) };
+			__m128i vz[2] = { _mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero) };
+
+			for (int half = 0; half < 2; half++)
+			{
+				__m128i r = _mm_madd_epi16(yv[half], red);
+				__m128i g = _mm_add_epi32(_mm_madd_epi16(yu[half], greenCb), _mm_madd_epi16(vz[half], greenCr));
+				__m128i b = _mm_madd_epi16(yu[half], blue);
+
+				__m128i outside = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi32(r, low), _mm_cmpgt_epi32(r, high)),
+					_mm_or_si128(_mm_or_si128(_mm_cmplt_epi32(g, low), _mm_cmpgt_epi32(g, high)),
+						_mm_or_si128(_mm_cmplt_epi32(b, low), _mm_cmpgt_epi32(b, high))));
+
+				// Lanes outside are all ones, subtracting counts them
+				counts = _mm_sub_epi32(counts, outside);
+			}
+		}
+
+		alignas(16) uint32_t laneCounts[4];
+		_mm_store_si128((__m128i*)laneCounts, counts);
+		count = (uint64_t)laneCounts[0] + laneCounts[1] + laneCounts[2] + laneCounts[3];
+#endif
+
+		for (; i < width; i++)
+			count += GamutTest(c, (luma[i] << shift) - 64, (cb[i] << shift) - 512, (cr[i] << shift) - 512);
+
+		return count;
+	}
+
+	// Native Y'CbCr of pixels [x, x + width) of a 4:2:2 row, chroma repeated for both pixels of a pair
+	void UnpackYuvRow(BMDPixelFormat pixelFormat, const uint8_t* row, long x, long width, uint16_t* luma, uint16_t* cb, uint16_t* cr)
+	{
+		if (pixelFormat == bmdFormat8BitYUV)
+		{
+			for (long i = 0; i < width; i++)
+			{
+				const uint8_t* pair = row + ((x + i) >> 1) * 4;
+				luma[i] = pair[1 + 2 * ((x + i) & 1)];
+				cb[i] = pair[0];
+				cr[i] = pair[2];
+			}
+			return;
+		}
+
+		PixelConverter::UnpackV210Components(row, x, width, luma, cb, cr);
+	}
+
+	void AccumulateYuvRows(IDeckLinkVideoFrame* videoFrame, const uint8_t* bytes, const PixelConverter::Rect& region,
+		int bitDepth, long firstRow, long endRow, Accumulator& accumulator)
+	{
+		const GamutCoefficients&	coefficients = kGamutCoefficients[PixelConverter::GetColorimetry(videoFrame->GetHeight())];
+		std::vector<uint16_t>		luma(region.width);
+		std::vector<uint16_t>		cb(region.width);
+		std::vector<uint16_t>		cr(region.width);
+		uint32_t*					lumaCounts[2] = { accumulator.histograms[0][0].data(), accumulator.histograms[0][1].data() };
+		uint32_t*					cbCounts[2] = { accumulator.histograms[1][0].data(), accumulator.histograms[1][1].data() };
+		uint32_t*					crCounts[2] = { accumulator.histograms[2][0].data(), accumulator.histograms[2][1].data() };
+
+		// Chroma is counted once per pair, at its first pixel inside the region
+		long						firstPair = region.x & 1;
+
+		for (long y = region.y + firstRow; y < region.y + endRow; y++)
+		{
+			UnpackYuvRow(videoFrame->GetPixelFormat(), bytes + (size_t)y * videoFrame->GetRowBytes(), region.x, region.width,
+				luma.data(), cb.data(), cr.data());
+
+			long i = 0;
+			for (; i + 2 <= region.width; i += 2)
+			{
+				lumaCounts[0][luma[i]]++;
+				lumaCounts[1][luma[i + 1]]++;
+			}
+			if (i < region.width)
+				lumaCounts[0][luma[i]]++;
+
+			if (firstPair)
+			{
+				cbCounts[1][cb[0]]++;
+				crCounts[1][cr[0]]++;
+			}
+			for (long pair = firstPair, copy = 0; pair < region.width; pair += 2, copy ^= 1)
+			{
+				cbCounts[copy][cb[pair]]++;
+				crCounts[copy][cr[pair]]++;
+			}
+
+			accumulator.outOfGamut += CountOutOfGamut(coefficients, luma.data(), cb.data(), cr.data(), region.width, bitDepth);
+		}
+	}
+
+	// Native R'G'B' code values of pixels [x, x + width) of an r210, R10b or R10l row, one 32-bit word per pixel
+	// with red at bit 20 (r210) or 22, then green and blue 10 bits below
+	void Unpack10BitRgbRow(BMDPixelFormat pixelFormat, const uint8_t* row, long x, long width, uint16_t* rgb)
+	{
+		int				redShift = (pixelFormat == bmdFormat10BitRGB) ? 20 : 22;
+		bool			bigEndian = (pixelFormat != bmdFormat10BitRGBXLE);
+		const uint8_t*	src = row + x * 4;
+
+		for (long i = 0; i < width; i++, src += 4, rgb += 3)
+		{
+			uint32_t word = bigEndian ?
+				((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3] :
+				((uint32_t)src[3] << 24) | ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+
+			rgb[0] = (uint16_t)((word >> redShift) & 0x3ff);
+			rgb[1] = (uint16_t)((word >> (redShift - 10)) & 0x3ff);
+			rgb[2] = (uint16_t)((word >> (redShift - 20)) & 0x3ff);
+		}
+	}
+
+	void AccumulateRgbRows(IDeckLinkVideoFrame* videoFrame, const uint8_t* bytes, const PixelConverter::Rect& region,
+		int bitDepth, long firstRow, long endRow, Accumulator& accumulator)
+	{
+		// 10-bit R'G'B' is video levels, which UnpackRow expands, so it is read natively. The other formats are
+		// full range, unpacking only widens them by bit replication, which the shift undoes.
+		BMDPixelFormat				pixelFormat = videoFrame->GetPixelFormat();
+		bool						native = (bitDepth == 10);
+		std::vector<uint16_t>		rgb(region.width * 3);
+		int							shift = native ? 0 : 16 - bitDepth;
+
+		for (long y = region.y + firstRow; y < region.y + endRow; y++)
+		{
+			const uint8_t* row = bytes + (size_t)y * videoFrame->GetRowBytes();
+
+			if (native)
+				Unpack10BitRgbRow(pixelFormat, row, region.x, region.width, rgb.data());
+			else
+				PixelConverter::UnpackRow(pixelFormat, PixelConverter::kColorimetryRec709, row, region.x, region.width, rgb.data());
+
+			const uint16_t* pixel = rgb.data();
+			for (long i = 0; i < region.width; i++, pixel += 3)
+			{
+				accumulator.histograms[0][i & 1][pixel[0] >> shift]++;
+				accumulator.histograms[1][i & 1][pixel[1] >> shift]++;
+				accumulator.histograms[2][i & 1][pixel[2] >> shift]++;
+			}
+		}
+	}
+
+	void SummarizeChannel(FrameStatistics::Channel& channel)
+	{
+		uint64_t	sum = 0;
+		bool		found = false;
+
+		channel.samples = 0;
+		channel.minimum = 0;
+		channel.maximum = 0;
+		channel.below = 0;
+		channel.above = 0;
+
+		for (uint32_t value = 0; value < (uint32_t)channel.histogram.size(); value++)
+		{
+			uint32_t count = channel.histogram[value];
+			if (count == 0)
+				continue;
+
+			if (!found)
+				channel.minimum = value;
+			found = true;
+			channel.maximum = value;
+			channel.samples += count;
+			sum += (uint64_t)count * value;
+
+			if (value < channel.legalMinimum)
+				channel.below += count;
+			else if (value > channel.legalMaximum)
+				channel.above += count;
+		}
+
+		channel.mean = (channel.samples > 0) ? (double)sum / (double)channel.samples : 0.0;
+	}
+}
+
+int FrameStatistics::GetBitDepth(BMDPixelFormat pixelFormat)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:
+			return 8;
+		case bmdFormat10BitYUV:
+		case bmdFormat10BitRGB:
+		case bmdFormat10BitRGBX:
+		case bmdFormat10BitRGBXLE:
+			return 10;
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:
+			return 12;
+		default:
+			return 0;
+	}
+}
+
+HRESULT FrameStatistics::Compute(IDeckLinkVideoFrame* videoFrame, const PixelConverter::Rect& region, Statistics& statistics)
+{
+	void*				bytes = NULL;
+	BMDPixelFormat		pixelFormat = videoFrame->GetPixelFormat();
+	int					bitDepth = GetBitDepth(pixelFormat);
+	bool				yuv = (pixelFormat == bmdFormat8BitYUV) || (pixelFormat == bmdFormat10BitYUV);
+	Accumulator			total(bitDepth);
+	std::mutex			totalMutex;
+
+	videoFrame->GetBytes(&bytes);
+	if (bytes == NULL)
+		return E_POINTER;
+	if ((bitDepth == 0) || !PixelConverter::IsSupported(pixelFormat))
+		return E_INVALIDARG;
+	if ((region.x < 0) || (region.y < 0) || (region.width <= 0) || (region.height <= 0) ||
+		(region.width > videoFrame->GetWidth() - region.x) || (region.height > videoFrame->GetHeight() - region.y))
+		return E_INVALIDARG;
+
+	PixelConverter::ParallelRows(region.height, [&](long firstRow, long endRow) {
+		Accumulator accumulator(bitDepth);
+
+		if (yuv)
+			AccumulateYuvRows(videoFrame, (const uint8_t*)bytes, region, bitDepth, firstRow, endRow, accumulator);
+		else
+			AccumulateRgbRows(videoFrame, (const uint8_t*)bytes, region, bitDepth, firstRow, endRow, accumulator);
+
+		std::lock_guard<std::mutex> lock(totalMutex);
+		for (int channel = 0; channel < 3; channel++)
+		{
+			for (size_t value = 0; value < total.histograms[channel][0].size(); value++)
+				total.histograms[channel][0][value] += accumulator.histograms[channel][0][value] + accumulator.histograms[channel][1][value];
+		}
+		total.outOfGamut += accumulator.outOfGamut;
+	});
+
+	const char*		names[2][3] = { { "r", "g", "b" }, { "y", "cb", "cr" } };
+	uint32_t		scale = 1u << (bitDepth - 8);
+
+	statistics.width = region.width;
+	statistics.height = region.height;
+	statistics.pixelFormat = pixelFormat;
+	statistics.bitDepth = bitDepth;
+	statistics.yuv = yuv;
+	statistics.outOfGamut = total.outOfGamut;
+
+	for (int i = 0; i < 3; i++)
+	{
+		Channel& channel = statistics.channels[i];
+
+		channel.name = names[yuv ? 1 : 0][i];
+		channel.histogram.swap(total.histograms[i][0]);
+		if (yuv)
+		{
+			channel.legalMinimum = 16 * scale;
+			channel.legalMaximum = ((i == 0) ? 235 : 240) * scale;
+		}
+		else if (bitDepth == 10)
+		{
+			// r210 is specified with white at 960, R10b and R10l at 940
+			channel.legalMinimum = 64;
+			channel.legalMaximum = (pixelFormat == bmdFormat10BitRGB) ? 960 : 940;
+		}
+		else
+		{
+			channel.legalMinimum = 0;
+			channel.legalMaximum = (1u << bitDepth) - 1;
+		}
+		SummarizeChannel(channel);
+	}
+
+	return S_OK;
+}
+
+std::vector<uint64_t> FrameStatistics::GetHistogram(const Channel& channel, int bins)
+{
+	std::vector<uint64_t>	histogram(bins, 0);
+	size_t					valuesPerBin = channel.histogram.size() / bins;
+
+	for (size_t value = 0; value < channel.histogram.size(); value++)
+		histogram[value / valuesPerBin] += channel.histogram[value];
+
+	return histogram;
+}
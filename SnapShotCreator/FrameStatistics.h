@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "PixelConverter.h"
+
+// Level statistics of a captured frame for quality checks, computed on the native Y'CbCr or R'G'B' code values
+// without converting the frame. Histograms keep one bin per code value, everything else is derived from them.
+namespace FrameStatistics
+{
+	struct Channel
+	{
+		const char*				name;			// "y", "cb", "cr" or "r", "g", "b"
+		std::vector<uint32_t>	histogram;		// one bin per code value
+		uint64_t				samples;
+		uint32_t				minimum;
+		uint32_t				maximum;
+		double					mean;
+		uint32_t				legalMinimum;	// studio range for Y'CbCr and 10-bit R'G'B', the full range for other R'G'B'
+		uint32_t				legalMaximum;
+		uint64_t				below;			// samples under legalMinimum
+		uint64_t				above;			// samples over legalMaximum
+	};
+
+	struct Statistics
+	{
+		long					width;			// of the analyzed region
+		long					height;
+		BMDPixelFormat			pixelFormat;
+		int						bitDepth;
+		bool					yuv;
+		Channel					channels[3];
+		uint64_t				outOfGamut;		// Y'CbCr pixels with an R'G'B' component outside -5% to 105%, as in EBU R 103
+	};
+
+	// Bits per component of a supported pixel format
+	int GetBitDepth(BMDPixelFormat pixelFormat);
+
+	HRESULT Compute(IDeckLinkVideoFrame* videoFrame, const PixelConverter::Rect& region, Statistics& statistics);
+
+	// Histogram of a channel summed into bins, a power of two no larger than the number of code values
+	std::vector<uint64_t> GetHistogram(const Channel& channel, int bins);
+};
@@ -30,7 +30,9 @@
 #include <wincodec.h>
 #include <string>
 #include <queue>
+#include <vector>
 #include <stdint.h>
+#include <time.h>
 #include "DeckLinkAPI.h"
 
 namespace ImageWriter
@@ -38,6 +40,18 @@ namespace ImageWriter
 	HRESULT Initialize(void);
 	HRESULT UnInitialize(void);
 
+	// <path>\<prefix><YYYYmmddHHMMSS>_<milliseconds>_<sequence>.<extension>, unique per directory and prefix
 	std::string GetFilepath(const std::string& path, const std::string& filenamePrefix, const std::string& imageFormat);
-	HRESULT WriteVideoFrameToImage(IDeckLinkVideoFrame* videoFrame, const std::string& imgFilename, const std::string& imageFormat);
+	// captureTime is the wall-clock time the frame arrived, recorded in raw sidecars; 0 for the time of writing
+	HRESULT WriteVideoFrameToImage(IDeckLinkVideoFrame* videoFrame, const std::string& imgFilename, const std::string& imageFormat, time_t captureTime = 0);
+
+	// Native frame buffer written as is, described by a <name>.json sidecar written just before it
+	HRESULT WriteRawVideoFrame(IDeckLinkVideoFrame* videoFrame, const std::string& filepath, time_t captureTime = 0);
+	// The JSON sidecar of raw frames and raw clips: buffer layout and pixel format of videoFrame, captureTime (0 for now)
+	// and the time scale of any timestamps, followed by fields, which are members starting with a comma
+	std::string MakeRawSidecar(IDeckLinkVideoFrame* videoFrame, time_t captureTime, int64_t timeScale, const std::string& fields = "");
+
+	// Looping "apng" or "gif" of 8-bit BGRA frames of one size, shown frameRate times per second.
+	// Each frame only stores what changed from the one before, and frames are encoded in parallel before assembly.
+	HRESULT WriteAnimation(const std::vector<IDeckLinkVideoFrame*>& videoFrames, double frameRate, const std::string& filepath, const std::string& imageFormat);
 };
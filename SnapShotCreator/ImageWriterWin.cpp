@@ -27,15 +27,275 @@
 
 #include <wincodec.h>		// For handing bitmap files
 #include <atlstr.h>
+#include <math.h>
 #include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <vector>
 
 #include "include/spdlog/spdlog.h"
 #include "utils.h"
+#include "FileWriter.h"
+#include "MemoryStream.h"
+#include "RawVideoFrame.h"
+#include "Rgb48VideoFrame.h"
+#include "Animation.h"
 #include "ImageWriter.h"
 
 namespace ImageWriter
 {
 	IWICImagingFactory*	g_wicFactory;
+
+	// Filename generation state, guarded by g_filepathMutex
+	std::mutex							g_filepathMutex;
+	std::map<std::string, uint32_t>		g_filepathSequences;	// next sequence number per directory and prefix within g_sequenceMillisecond
+	int64_t								g_sequenceMillisecond = -1;
+	time_t								g_cachedSecond = -1;
+	char								g_cachedTimestamp[32];
+
+	// Resolution of the timestamps in raw frame sidecars
+	const BMDTimeScale					kRawTimeScale = 1000000;
+}
+
+namespace
+{
+	// Write an encoded image; with the async writer the file appears shortly after this returns
+	HRESULT PublishImage(const std::string& filepath, MemoryStream* memoryStream)
+	{
+		if (FileWriter::IsAsyncWriterRunning())
+		{
+			FileWriter::WriteFileAsync(filepath, memoryStream);
+			return S_OK;
+		}
+		return FileWriter::WriteFileAtomic(filepath, memoryStream->GetData(), memoryStream->GetSize());
+	}
+
+	// One frame of an animation: the part of a captured frame that changed from the one before
+	struct AnimationFrame
+	{
+		size_t					first;			// index of the captured frame
+		size_t					count;			// captured frames shown, identical ones are merged into the frame before
+		PixelConverter::Rect	rect;
+		std::vector<uint8_t>	pixels;			// rect.width pixels per row, unchanged ones transparent; empty for the first frame
+		MemoryStream*			png;			// encoded frame of an APNG
+		HRESULT					result;
+	};
+
+	// Display time of count frames from first, rounded per frame edge so that the delays add up without drift
+	uint16_t GetDelay(size_t first, size_t count, double frameRate, int unitsPerSecond)
+	{
+		return (uint16_t)(lround((first + count) * unitsPerSecond / frameRate) - lround(first * unitsPerSecond / frameRate));
+	}
+
+	HRESULT EncodePng(const uint8_t* bgra, long width, long height, long rowBytes, MemoryStream** stream)
+	{
+		HRESULT					result = S_OK;
+		IWICBitmapEncoder*		bitmapEncoder = NULL;
+		IWICBitmapFrameEncode*	bitmapFrame = NULL;
+		WICPixelFormatGUID		pixelFormat = GUID_WICPixelFormat32bppBGRA;
+
+		*stream = new MemoryStream((size_t)rowBytes * height / 2 + 4096);
+
+		result = ImageWriter::g_wicFactory->CreateEncoder(GUID_ContainerFormatPng, NULL, &bitmapEncoder);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapEncoder->Initialize(*stream, WICBitmapEncoderNoCache);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapEncoder->CreateNewFrame(&bitmapFrame, NULL);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapFrame->Initialize(NULL);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapFrame->SetSize(width, height);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapFrame->SetPixelFormat(&pixelFormat);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapFrame->WritePixels(height, rowBytes, rowBytes * height, (BYTE*)bgra);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapFrame->Commit();
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapEncoder->Commit();
+
+	bail:
+		if (bitmapFrame != NULL)
+			bitmapFrame->Release();
+
+		if (bitmapEncoder != NULL)
+			bitmapEncoder->Release();
+
+		return result;
+	}
+
+	HRESULT SetMetadata(IWICMetadataQueryWriter* metadataWriter, const wchar_t* name, VARTYPE type, unsigned value)
+	{
+		PROPVARIANT variant;
+
+		PropVariantInit(&variant);
+		variant.vt = type;
+		if (type == VT_UI1)
+			variant.bVal = (uint8_t)value;
+		else if (type == VT_UI2)
+			variant.uiVal = (uint16_t)value;
+		else
+			variant.boolVal = value ? VARIANT_TRUE : VARIANT_FALSE;
+		return metadataWriter->SetMetadataByName(name, &variant);
+	}
+
+	HRESULT SetMetadata(IWICMetadataQueryWriter* metadataWriter, const wchar_t* name, const void* bytes, ULONG size)
+	{
+		PROPVARIANT variant;
+
+		PropVariantInit(&variant);
+		variant.vt = VT_UI1 | VT_VECTOR;
+		variant.caub.cElems = size;
+		variant.caub.pElems = (BYTE*)bytes;
+		return metadataWriter->SetMetadataByName(name, &variant);
+	}
+
+	// Frames go into the one GIF encoder in order, only the pixel data handed to it was prepared in parallel
+	HRESULT EncodeGif(const std::vector<AnimationFrame>& frames, const uint8_t* firstIndexes, long width, long height, double frameRate, MemoryStream* stream)
+	{
+		HRESULT						result = S_OK;
+		IWICBitmapEncoder*			bitmapEncoder = NULL;
+		IWICBitmapFrameEncode*		bitmapFrame = NULL;
+		IWICMetadataQueryWriter*	metadataWriter = NULL;
+		IWICPalette*				palette = NULL;
+		WICColor					colors[256];
+		const char					application[] = "NETSCAPE2.0";
+		const uint8_t				loop[] = { 3, 1, 0, 0, 0 };		// sub-block 1, loop count 0: forever
+
+		Animation::GetPalette(colors);
+
+		result = ImageWriter::g_wicFactory->CreatePalette(&palette);
+		if (FAILED(result))
+			goto bail;
+
+		result = palette->InitializeCustom(colors, 256);
+		if (FAILED(result))
+			goto bail;
+
+		result = ImageWriter::g_wicFactory->CreateEncoder(GUID_ContainerFormatGif, NULL, &bitmapEncoder);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapEncoder->Initialize(stream, WICBitmapEncoderNoCache);
+		if (FAILED(result))
+			goto bail;
+
+		// One global color table, the logical screen is the first frame and the animation loops
+		result = bitmapEncoder->SetPalette(palette);
+		if (FAILED(result))
+			goto bail;
+
+		result = bitmapEncoder->GetMetadataQueryWriter(&metadataWriter);
+		if (FAILED(result))
+			goto bail;
+
+		result = SetMetadata(metadataWriter, L"/appext/Application", application, sizeof(application) - 1);
+		if (SUCCEEDED(result))
+			result = SetMetadata(metadataWriter, L"/appext/Data", loop, sizeof(loop));
+		if (SUCCEEDED(result))
+			result = SetMetadata(metadataWriter, L"/logscrdesc/Width", VT_UI2, (unsigned)width);
+		if (SUCCEEDED(result))
+			result = SetMetadata(metadataWriter, L"/logscrdesc/Height", VT_UI2, (unsigned)height);
+		if (FAILED(result))
+			goto bail;
+
+		metadataWriter->Release();
+		metadataWriter = NULL;
+
+		for (const AnimationFrame& frame : frames)
+		{
+			WICPixelFormatGUID	pixelFormat = GUID_WICPixelFormat8bppIndexed;
+			const uint8_t*		indexes = frame.pixels.empty() ? firstIndexes : frame.pixels.data();
+			long				rowBytes = frame.rect.width;
+
+			result = bitmapEncoder->CreateNewFrame(&bitmapFrame, NULL);
+			if (FAILED(result))
+				goto bail;
+
+			result = bitmapFrame->Initialize(NULL);
+			if (FAILED(result))
+				goto bail;
+
+			result = bitmapFrame->SetSize(frame.rect.width, frame.rect.height);
+			if (FAILED(result))
+				goto bail;
+
+			result = bitmapFrame->SetPixelFormat(&pixelFormat);
+			if (FAILED(result))
+				goto bail;
+
+			result = bitmapFrame->SetPalette(palette);
+			if (FAILED(result))
+				goto bail;
+
+			// Frames are drawn over the ones before at their offset, transparent indexes leave those showing
+			result = bitmapFrame->GetMetadataQueryWriter(&metadataWriter);
+			if (FAILED(result))
+				goto bail;
+
+			result = SetMetadata(metadataWriter, L"/grctlext/Delay", VT_UI2, GetDelay(frame.first, frame.count, frameRate, 100));
+			if (SUCCEEDED(result))
+				result = SetMetadata(metadataWriter, L"/grctlext/Disposal", VT_UI1, 1);
+			if (SUCCEEDED(result))
+				result = SetMetadata(metadataWriter, L"/grctlext/TransparencyFlag", VT_BOOL, frame.pixels.empty() ? 0 : 1);
+			if (SUCCEEDED(result))
+				result = SetMetadata(metadataWriter, L"/grctlext/TransparentColorIndex", VT_UI1, Animation::kTransparentIndex);
+			if (SUCCEEDED(result))
+				result = SetMetadata(metadataWriter, L"/imgdesc/Left", VT_UI2, (unsigned)frame.rect.x);
+			if (SUCCEEDED(result))
+				result = SetMetadata(metadataWriter, L"/imgdesc/Top", VT_UI2, (unsigned)frame.rect.y);
+			if (FAILED(result))
+				goto bail;
+
+			metadataWriter->Release();
+			metadataWriter = NULL;
+
+			result = bitmapFrame->WritePixels(frame.rect.height, rowBytes, rowBytes * frame.rect.height, (BYTE*)indexes);
+			if (FAILED(result))
+				goto bail;
+
+			result = bitmapFrame->Commit();
+			if (FAILED(result))
+				goto bail;
+
+			bitmapFrame->Release();
+			bitmapFrame = NULL;
+		}
+
+		result = bitmapEncoder->Commit();
+
+	bail:
+		if (metadataWriter != NULL)
+			metadataWriter->Release();
+
+		if (bitmapFrame != NULL)
+			bitmapFrame->Release();
+
+		if (bitmapEncoder != NULL)
+			bitmapEncoder->Release();
+
+		if (palette != NULL)
+			palette->Release();
+
+		return result;
+	}
 }
 
 HRESULT ImageWriter::Initialize()
@@ -63,25 +323,71 @@ HRESULT ImageWriter::UnInitialize()
 std::string ImageWriter::GetFilepath(const std::string& path, const std::string& prefix, const std::string& extension)
 {
 	const char*					fmt = "%Y%m%d%H%M%S";
+	char						suffix[32];
+	std::string					filepath = path + "\\" + prefix;
 
-	std::string filepath = path + "\\" + prefix + CurrentDateTime(fmt) + "." + extension;
+	auto now = std::chrono::system_clock::now();
+	time_t nowSeconds = std::chrono::system_clock::to_time_t(now);
+	int64_t nowMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+	int milliseconds = (int)(nowMilliseconds % 1000);
+
+	{
+		std::lock_guard<std::mutex> lock(g_filepathMutex);
+
+		// Only reformat the date when the second changes
+		if (nowSeconds != g_cachedSecond)
+		{
+			struct tm tstruct;
+			localtime_s(&tstruct, &nowSeconds);
+			strftime(g_cachedTimestamp, sizeof(g_cachedTimestamp), fmt, &tstruct);
+			g_cachedSecond = nowSeconds;
+		}
+
+		// The sequence number keeps names unique even for requests within the same millisecond. Names of another
+		// millisecond cannot collide, so the counters restart with each one and only the current prefixes are kept.
+		if (nowMilliseconds != g_sequenceMillisecond)
+		{
+			g_filepathSequences.clear();
+			g_sequenceMillisecond = nowMilliseconds;
+		}
+		uint32_t sequence = g_filepathSequences[filepath]++;
+		snprintf(suffix, sizeof(suffix), "_%03d_%06u.", milliseconds, sequence);
+		filepath += g_cachedTimestamp;
+	}
+
+	filepath += suffix;
+	filepath += extension;
 	return filepath;
 }
 
-HRESULT ImageWriter::WriteVideoFrameToImage(IDeckLinkVideoFrame* videoFrame, const std::string& imgFilename, const std::string& imageFormat)
+HRESULT ImageWriter::WriteVideoFrameToImage(IDeckLinkVideoFrame* videoFrame, const std::string& imgFilename, const std::string& imageFormat, time_t captureTime)
 {
 	HRESULT								result = S_OK;
 	void*								frameBytes = NULL;
 
 	IWICBitmapEncoder*					bitmapEncoder = NULL;
 	IWICBitmapFrameEncode*				bitmapFrame = NULL;
-	IWICStream*							fileStream = NULL;
+	MemoryStream*						memoryStream = NULL;
 	WICPixelFormatGUID					pixelFormat;
 
-	CString filename = imgFilename.c_str();
+	// Raw frames are written in whatever pixel format they arrive in
+	if (imageFormat == "raw")
+		return WriteRawVideoFrame(videoFrame, imgFilename, captureTime);
+
+	// A single frame of an animated format is a still image of one frame
+	if ((imageFormat == "apng") || (imageFormat == "gif"))
+		return WriteAnimation(std::vector<IDeckLinkVideoFrame*>(1, videoFrame), 1.0, imgFilename, imageFormat);
 
-	// Ensure video frame has expected pixel format
-	if (videoFrame->GetPixelFormat() != bmdFormat8BitBGRA)
+	// Ensure video frame has expected pixel format: 8-bit BGRA, or 16-bit RGB for formats that can store it
+	if (videoFrame->GetPixelFormat() == kPixelFormat16BitRGB)
+	{
+		if ((imageFormat != "png") && (imageFormat != "tiff"))
+		{
+			spdlog::error("16-bit output is only supported for png and tiff");
+			return E_INVALIDARG;
+		}
+	}
+	else if (videoFrame->GetPixelFormat() != bmdFormat8BitBGRA)
 	{
 		spdlog::error("Video frame is not in 8-Bit BGRA pixel format");
 		return E_FAIL;
@@ -95,13 +401,8 @@ HRESULT ImageWriter::WriteVideoFrameToImage(IDeckLinkVideoFrame* videoFrame, con
 		goto bail;
 	}
 
-	result = g_wicFactory->CreateStream(&fileStream);
-	if (FAILED(result))
-		goto bail;
-
-	result = fileStream->InitializeFromFilename(filename, GENERIC_WRITE);
-	if (FAILED(result))
-		goto bail;
+	// Encode into memory first, the file only appears once the image is complete
+	memoryStream = new MemoryStream(videoFrame->GetHeight() * videoFrame->GetRowBytes() + 4096);
 
 	if (imageFormat == "bmp")
 	{
@@ -127,7 +428,10 @@ HRESULT ImageWriter::WriteVideoFrameToImage(IDeckLinkVideoFrame* videoFrame, con
 	if (FAILED(result))
 		goto bail;
 
-	result = bitmapEncoder->Initialize(fileStream, WICBitmapEncoderNoCache);
+	if (videoFrame->GetPixelFormat() == kPixelFormat16BitRGB)
+		pixelFormat = GUID_WICPixelFormat48bppRGB;
+
+	result = bitmapEncoder->Initialize(memoryStream, WICBitmapEncoderNoCache);
 	if (FAILED(result))
 		goto bail;
 
@@ -162,6 +466,8 @@ HRESULT ImageWriter::WriteVideoFrameToImage(IDeckLinkVideoFrame* videoFrame, con
 	if (FAILED(result))
 		goto bail;
 
+	result = PublishImage(imgFilename, memoryStream);
+
 bail:
 	if (bitmapFrame != NULL)
 		bitmapFrame->Release();
@@ -169,8 +475,226 @@ bail:
 	if (bitmapEncoder != NULL)
 		bitmapEncoder->Release();
 
-	if (fileStream != NULL)
-		fileStream->Release();
+	if (memoryStream != NULL)
+		memoryStream->Release();
+
+	return result;
+}
+
+std::string ImageWriter::MakeRawSidecar(IDeckLinkVideoFrame* videoFrame, time_t captureTime, int64_t timeScale, const std::string& fields)
+{
+	char			number[64];
+	std::string		sidecar;
+
+	sidecar.reserve(512);
+	sidecar += "{\"width\":";
+	sidecar += std::to_string(videoFrame->GetWidth());
+	sidecar += ",\"height\":";
+	sidecar += std::to_string(videoFrame->GetHeight());
+	sidecar += ",\"row_bytes\":";
+	sidecar += std::to_string(videoFrame->GetRowBytes());
+	sidecar += ",\"buffer_size\":";
+	sidecar += std::to_string((size_t)videoFrame->GetRowBytes() * videoFrame->GetHeight());
+	sidecar += ",\"pixel_format\":\"";
+	sidecar += RawVideoFrame::GetPixelFormatTag(videoFrame->GetPixelFormat());
+	snprintf(number, sizeof(number), "\",\"pixel_format_code\":%u,\"flags\":%u", (unsigned)videoFrame->GetPixelFormat(), (unsigned)videoFrame->GetFlags());
+	sidecar += number;
+	sidecar += ",\"capture_time\":\"";
+	sidecar += FormatDateTime((captureTime != 0) ? captureTime : time(NULL), "%Y-%m-%dT%H:%M:%S");
+	sidecar += "\",\"time_scale\":";
+	sidecar += std::to_string(timeScale);
+	sidecar += fields;
+	sidecar += "}\n";
+	return sidecar;
+}
+
+HRESULT ImageWriter::WriteRawVideoFrame(IDeckLinkVideoFrame* videoFrame, const std::string& filepath, time_t captureTime)
+{
+	HRESULT								result = S_OK;
+	void*								frameBytes = NULL;
+	IDeckLinkVideoInputFrame*			inputFrame = NULL;
+	BMDTimeValue						streamTime = 0;
+	BMDTimeValue						streamDuration = 0;
+	BMDTimeValue						hardwareTime = 0;
+	BMDTimeValue						hardwareDuration = 0;
+	bool								hasStreamTime = false;
+	bool								hasHardwareTime = false;
+	char								number[64];
+
+	size_t bufferSize = (size_t)videoFrame->GetRowBytes() * videoFrame->GetHeight();
+	std::string sidecarFilepath = filepath.substr(0, filepath.find_last_of('.')) + ".json";
+	std::string timestamps;
+
+	videoFrame->GetBytes(&frameBytes);
+	if (frameBytes == NULL)
+	{
+		spdlog::error("Could not get DeckLinkVideoFrame buffer pointer");
+		return E_OUTOFMEMORY;
+	}
+
+	// Timestamps are only available on frames delivered by the input
+	if (videoFrame->QueryInterface(IID_IDeckLinkVideoInputFrame, (void**)&inputFrame) == S_OK)
+	{
+		hasStreamTime = (inputFrame->GetStreamTime(&streamTime, &streamDuration, kRawTimeScale) == S_OK);
+		hasHardwareTime = (inputFrame->GetHardwareReferenceTimestamp(kRawTimeScale, &hardwareTime, &hardwareDuration) == S_OK);
+		inputFrame->Release();
+	}
+
+	if (hasStreamTime)
+	{
+		snprintf(number, sizeof(number), ",\"stream_time\":%lld,\"stream_duration\":%lld", (long long)streamTime, (long long)streamDuration);
+		timestamps += number;
+	}
+	if (hasHardwareTime)
+	{
+		snprintf(number, sizeof(number), ",\"hardware_reference_time\":%lld", (long long)hardwareTime);
+		timestamps += number;
+	}
+	std::string sidecar = MakeRawSidecar(videoFrame, captureTime, kRawTimeScale, timestamps);
+
+	// The sidecar goes first, so that it is always there once the raw file appears
+	result = FileWriter::WriteFileAtomic(sidecarFilepath, sidecar.data(), sidecar.size());
+	if (FAILED(result))
+		return result;
+
+	// Straight from the capture buffer in one sequential write; the frame is released once this returns,
+	// so raw frames never go through the async writer
+	result = FileWriter::WriteFileAtomic(filepath, frameBytes, bufferSize);
+	if (FAILED(result))
+		DeleteFileA(sidecarFilepath.c_str());
+
+	return result;
+}
+
+HRESULT ImageWriter::WriteAnimation(const std::vector<IDeckLinkVideoFrame*>& videoFrames, double frameRate, const std::string& filepath, const std::string& imageFormat)
+{
+	HRESULT							result = S_OK;
+	bool							gif = (imageFormat == "gif");
+	int								pixelBytes = gif ? 1 : 4;
+	std::vector<const uint8_t*>		planes;				// compared and written per frame: palette indexes for GIF, BGRA for APNG
+	std::vector<std::vector<uint8_t>>	indexes;
+	std::vector<AnimationFrame>		frames;
+	MemoryStream*					memoryStream = NULL;
+
+	if (videoFrames.empty() || !(frameRate > 0.0) || (!gif && (imageFormat != "apng")))
+		return E_INVALIDARG;
+
+	long width = videoFrames[0]->GetWidth();
+	long height = videoFrames[0]->GetHeight();
+	long rowBytes = videoFrames[0]->GetRowBytes();
+
+	for (IDeckLinkVideoFrame* videoFrame : videoFrames)
+	{
+		void* frameBytes = NULL;
+
+		if ((videoFrame->GetPixelFormat() != bmdFormat8BitBGRA) || (videoFrame->GetWidth() != width) ||
+			(videoFrame->GetHeight() != height) || (videoFrame->GetRowBytes() != rowBytes))
+		{
+			spdlog::error("Animation frames must be 8-bit BGRA of one size");
+			return E_INVALIDARG;
+		}
+
+		videoFrame->GetBytes(&frameBytes);
+		if (frameBytes == NULL)
+		{
+			spdlog::error("Could not get DeckLinkVideoFrame buffer pointer");
+			return E_OUTOFMEMORY;
+		}
+		planes.push_back((const uint8_t*)frameBytes);
+	}
+
+	// GIF frames are quantized to the fixed palette first, so that differencing works on what is displayed
+	long stride = gif ? width : rowBytes;
+	if (gif)
+	{
+		indexes.resize(planes.size());
+		Animation::ParallelFrames(planes.size(), [&](size_t i) {
+			indexes[i].resize((size_t)width * height);
+			Animation::Quantize(planes[i], rowBytes, width, height, indexes[i].data());
+		});
+		for (size_t i = 0; i < planes.size(); i++)
+			planes[i] = indexes[i].data();
+	}
+
+	// Frames only cover what changed from the one before, frames without changes extend the display time of the one before
+	std::vector<PixelConverter::Rect> rects(planes.size());
+	rects[0] = { 0, 0, width, height };
+	Animation::ParallelFrames(planes.size() - 1, [&](size_t i) {
+		rects[i + 1] = Animation::GetChangedRect(planes[i], planes[i + 1], stride, width, height, pixelBytes);
+	});
+
+	for (size_t i = 0; i < planes.size(); i++)
+	{
+		if ((i > 0) && (rects[i].width == 0))
+			frames.back().count++;
+		else
+			frames.push_back({ i, 1, rects[i], {}, NULL, S_OK });
+	}
+
+	// Unchanged pixels made transparent and, for APNG, each frame encoded to its own PNG
+	Animation::ParallelFrames(frames.size(), [&](size_t k) {
+		AnimationFrame&		frame = frames[k];
+		const uint8_t*		pixels = planes[0];
+		long				pixelsRowBytes = stride;
+
+		if (frame.first > 0)
+		{
+			pixelsRowBytes = frame.rect.width * pixelBytes;
+			frame.pixels.resize((size_t)pixelsRowBytes * frame.rect.height);
+			Animation::CopyChanged(planes[frame.first - 1], planes[frame.first], stride, frame.rect, pixelBytes, frame.pixels.data(), pixelsRowBytes);
+			pixels = frame.pixels.data();
+		}
+
+		if (!gif)
+			frame.result = EncodePng(pixels, frame.rect.width, frame.rect.height, pixelsRowBytes, &frame.png);
+	});
+
+	if (gif)
+	{
+		memoryStream = new MemoryStream((size_t)width * height * frames.size() / 2 + 4096);
+		result = EncodeGif(frames, planes[0], width, height, frameRate, memoryStream);
+	}
+	else
+	{
+		std::vector<Animation::ApngFrame>	apngFrames;
+		std::vector<uint8_t>				apng;
+
+		for (const AnimationFrame& frame : frames)
+		{
+			if (FAILED(frame.result))
+			{
+				result = frame.result;
+				goto bail;
+			}
+			apngFrames.push_back({ frame.png->GetData(), frame.png->GetSize(), frame.rect,
+				GetDelay(frame.first, frame.count, frameRate, 1000), 1000, frame.first > 0 });
+		}
+
+		if (!Animation::AssembleApng(apngFrames, apng))
+		{
+			spdlog::error("APNG frames could not be assembled");
+			result = E_FAIL;
+			goto bail;
+		}
+
+		memoryStream = new MemoryStream(apng.size());
+		result = memoryStream->Write(apng.data(), (ULONG)apng.size(), NULL);
+	}
+	if (FAILED(result))
+		goto bail;
+
+	spdlog::debug("Animation of {} captured frames written as {} frames, {} bytes", planes.size(), frames.size(), memoryStream->GetSize());
+	result = PublishImage(filepath, memoryStream);
+
+bail:
+	for (AnimationFrame& frame : frames)
+	{
+		if (frame.png != NULL)
+			frame.png->Release();
+	}
+
+	if (memoryStream != NULL)
+		memoryStream->Release();
 
 	return result;
 }
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+// Background housekeeping of the log directory, so that log files never grow without bound and
+// none of it runs on the logging or capture threads.
+namespace LogMaintenance
+{
+	// Every interval: keep the newest (maxFiles + 1) files matching <logDirectory>\<filePattern>,
+	// delete older ones, and optionally apply filesystem compression to all but the newest.
+	void Start(const std::string& logDirectory, const std::string& filePattern, size_t maxFiles, bool compress, std::chrono::seconds interval);
+	void Stop(void);
+};
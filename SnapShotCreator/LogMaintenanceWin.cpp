@@ -0,0 +1,126 @@
+#include <Windows.h>
+#include <winioctl.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "include/spdlog/spdlog.h"
+#include "LogMaintenance.h"
+
+namespace LogMaintenance
+{
+	std::thread					g_maintenanceThread;
+	std::mutex					g_maintenanceMutex;
+	std::condition_variable		g_maintenanceCondition;
+	bool						g_stopMaintenance = false;
+
+	struct LogFile
+	{
+		std::string		filepath;
+		ULONGLONG		lastWriteTime;
+		bool			compressed;
+	};
+
+	std::vector<LogFile> ListLogFiles(const std::string& logDirectory, const std::string& filePattern)
+	{
+		std::vector<LogFile>	logFiles;
+		WIN32_FIND_DATAA		findData;
+		HANDLE					findHandle = FindFirstFileA((logDirectory + "\\" + filePattern).c_str(), &findData);
+
+		if (findHandle == INVALID_HANDLE_VALUE)
+			return logFiles;
+
+		do
+		{
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+
+			logFiles.push_back({
+				logDirectory + "\\" + findData.cFileName,
+				((ULONGLONG)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime,
+				(findData.dwFileAttributes & FILE_ATTRIBUTE_COMPRESSED) != 0
+			});
+		} while (FindNextFileA(findHandle, &findData));
+
+		FindClose(findHandle);
+
+		// Newest first
+		std::sort(logFiles.begin(), logFiles.end(), [](const LogFile& a, const LogFile& b) { return a.lastWriteTime > b.lastWriteTime; });
+		return logFiles;
+	}
+
+	// NTFS compression keeps the filename, so rotated files stay readable by log shippers as-is
+	bool CompressFile(const std::string& filepath)
+	{
+		USHORT		compressionFormat = COMPRESSION_FORMAT_DEFAULT;
+		DWORD		bytesReturned = 0;
+		BOOL		succeeded;
+
+		// Share everything so that the logging thread can still rotate (rename) the file meanwhile
+		HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		succeeded = DeviceIoControl(file, FSCTL_SET_COMPRESSION, &compressionFormat, sizeof(compressionFormat), NULL, 0, &bytesReturned, NULL);
+		CloseHandle(file);
+		return succeeded != FALSE;
+	}
+
+	void RunMaintenance(const std::string& logDirectory, const std::string& filePattern, size_t maxFiles, bool compress)
+	{
+		std::vector<LogFile> logFiles = ListLogFiles(logDirectory, filePattern);
+
+		for (size_t i = 0; i < logFiles.size(); i++)
+		{
+			// The newest file is the one being written
+			if (i == 0)
+				continue;
+
+			if (i > maxFiles)
+			{
+				if (DeleteFileA(logFiles[i].filepath.c_str()))
+					spdlog::debug("Deleted old log file {}", logFiles[i].filepath);
+			}
+			else if (compress && !logFiles[i].compressed)
+			{
+				if (CompressFile(logFiles[i].filepath))
+					spdlog::debug("Compressed log file {}", logFiles[i].filepath);
+				else
+					spdlog::debug("Unable to compress log file {}, error {}", logFiles[i].filepath, GetLastError());
+			}
+		}
+	}
+}
+
+void LogMaintenance::Start(const std::string& logDirectory, const std::string& filePattern, size_t maxFiles, bool compress, std::chrono::seconds interval)
+{
+	Stop();
+
+	g_stopMaintenance = false;
+	g_maintenanceThread = std::thread([=] {
+		std::unique_lock<std::mutex> lock(g_maintenanceMutex);
+		do
+		{
+			lock.unlock();
+			RunMaintenance(logDirectory, filePattern, maxFiles, compress);
+			lock.lock();
+		} while (!g_maintenanceCondition.wait_for(lock, interval, [] { return g_stopMaintenance; }));
+	});
+}
+
+void LogMaintenance::Stop()
+{
+	if (!g_maintenanceThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(g_maintenanceMutex);
+		g_stopMaintenance = true;
+	}
+	g_maintenanceCondition.notify_one();
+	g_maintenanceThread.join();
+}
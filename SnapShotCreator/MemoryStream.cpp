@@ -0,0 +1,161 @@
+#include <Windows.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "MemoryStream.h"
+
+/* MemoryStream class */
+
+MemoryStream::MemoryStream(size_t initialCapacity) :
+	m_buffer(NULL), m_capacity(0), m_size(0), m_position(0), m_refCount(1)
+{
+	Reserve(initialCapacity);
+}
+
+MemoryStream::~MemoryStream()
+{
+	_aligned_free(m_buffer);
+}
+
+HRESULT MemoryStream::Reserve(size_t capacity)
+{
+	if (capacity <= m_capacity)
+		return S_OK;
+
+	// Grow geometrically so that encoders writing in small pieces do not trigger repeated copies
+	capacity = (std::max)(capacity, m_capacity + m_capacity / 2);
+	capacity = (capacity + kAlignment - 1) & ~(kAlignment - 1);
+
+	uint8_t* buffer = (uint8_t*)_aligned_realloc(m_buffer, capacity, kAlignment);
+	if (buffer == NULL)
+		return E_OUTOFMEMORY;
+
+	m_buffer = buffer;
+	m_capacity = capacity;
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MemoryStream::Read(void* pv, ULONG cb, ULONG* pcbRead)
+{
+	size_t available = (m_position < m_size) ? m_size - m_position : 0;
+	ULONG bytesRead = (ULONG)(std::min)((size_t)cb, available);
+
+	memcpy(pv, m_buffer + m_position, bytesRead);
+	m_position += bytesRead;
+
+	if (pcbRead != NULL)
+		*pcbRead = bytesRead;
+
+	return (bytesRead == cb) ? S_OK : S_FALSE;
+}
+
+HRESULT STDMETHODCALLTYPE MemoryStream::Write(const void* pv, ULONG cb, ULONG* pcbWritten)
+{
+	HRESULT result = Reserve(m_position + cb);
+	if (FAILED(result))
+		return STG_E_MEDIUMFULL;
+
+	// Seeking past the end leaves a gap, which must read back as zeros
+	if (m_position > m_size)
+		memset(m_buffer + m_size, 0, m_position - m_size);
+
+	memcpy(m_buffer + m_position, pv, cb);
+	m_position += cb;
+	m_size = (std::max)(m_size, m_position);
+
+	if (pcbWritten != NULL)
+		*pcbWritten = cb;
+
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MemoryStream::Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition)
+{
+	LONGLONG base;
+
+	switch (dwOrigin)
+	{
+		case STREAM_SEEK_SET:	base = 0; break;
+		case STREAM_SEEK_CUR:	base = (LONGLONG)m_position; break;
+		case STREAM_SEEK_END:	base = (LONGLONG)m_size; break;
+		default:				return STG_E_INVALIDFUNCTION;
+	}
+
+	if (base + dlibMove.QuadPart < 0)
+		return STG_E_INVALIDFUNCTION;
+
+	m_position = (size_t)(base + dlibMove.QuadPart);
+
+	if (plibNewPosition != NULL)
+		plibNewPosition->QuadPart = m_position;
+
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MemoryStream::SetSize(ULARGE_INTEGER libNewSize)
+{
+	size_t newSize = (size_t)libNewSize.QuadPart;
+
+	HRESULT result = Reserve(newSize);
+	if (FAILED(result))
+		return STG_E_MEDIUMFULL;
+
+	if (newSize > m_size)
+		memset(m_buffer + m_size, 0, newSize - m_size);
+
+	m_size = newSize;
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MemoryStream::Stat(STATSTG* pstatstg, DWORD grfStatFlag)
+{
+	if (pstatstg == NULL)
+		return STG_E_INVALIDPOINTER;
+
+	memset(pstatstg, 0, sizeof(STATSTG));
+	pstatstg->type = STGTY_STREAM;
+	pstatstg->cbSize.QuadPart = m_size;
+	return S_OK;
+}
+
+HRESULT	STDMETHODCALLTYPE MemoryStream::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	HRESULT 		result = E_NOINTERFACE;
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	// Initialise the return result
+	*ppv = NULL;
+
+	// Obtain the IUnknown interface and compare it the provided REFIID
+	if (iid == IID_IUnknown || iid == IID_ISequentialStream || iid == IID_IStream)
+	{
+		*ppv = (IStream*)this;
+		AddRef();
+		result = S_OK;
+	}
+
+	return result;
+}
+
+ULONG STDMETHODCALLTYPE MemoryStream::AddRef(void)
+{
+	return m_refCount.fetch_add(1) + 1;
+}
+
+ULONG STDMETHODCALLTYPE MemoryStream::Release(void)
+{
+	ULONG		newRefValue;
+
+	newRefValue = m_refCount.fetch_sub(1) - 1;
+	if (newRefValue == 0)
+	{
+		delete this;
+		return 0;
+	}
+
+	return newRefValue;
+}
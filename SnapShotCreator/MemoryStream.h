@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <objidl.h>
+
+// Growable in-memory IStream, so that encoders can produce a complete image before anything touches the filesystem.
+// Tracks the highest offset written, which is the encoded size even when an encoder seeks back to patch headers.
+// Storage is page aligned so that the encoded image can be handed to unbuffered file writes without a copy.
+class MemoryStream : public IStream
+{
+public:
+	static const size_t		kAlignment = 4096;
+
+private:
+	uint8_t*				m_buffer;
+	size_t					m_capacity;
+	size_t					m_size;
+	size_t					m_position;
+
+	std::atomic<uint32_t>	m_refCount;
+
+	HRESULT					Reserve(size_t capacity);
+
+public:
+	MemoryStream(size_t initialCapacity);
+	virtual ~MemoryStream();
+
+	const uint8_t*			GetData(void) const	{ return m_buffer; };
+	size_t					GetSize(void) const	{ return m_size; };
+
+	// ISequentialStream interface
+	virtual HRESULT STDMETHODCALLTYPE	Read(void* pv, ULONG cb, ULONG* pcbRead);
+	virtual HRESULT STDMETHODCALLTYPE	Write(const void* pv, ULONG cb, ULONG* pcbWritten);
+
+	// IStream interface
+	virtual HRESULT STDMETHODCALLTYPE	Seek(LARGE_INTEGER dlibMove, DWORD dwOrigin, ULARGE_INTEGER* plibNewPosition);
+	virtual HRESULT STDMETHODCALLTYPE	SetSize(ULARGE_INTEGER libNewSize);
+	virtual HRESULT STDMETHODCALLTYPE	Stat(STATSTG* pstatstg, DWORD grfStatFlag);
+
+	// Dummy implementations of remaining methods in IStream
+	virtual HRESULT STDMETHODCALLTYPE	CopyTo(IStream* pstm, ULARGE_INTEGER cb, ULARGE_INTEGER* pcbRead, ULARGE_INTEGER* pcbWritten) { return E_NOTIMPL; };
+	virtual HRESULT STDMETHODCALLTYPE	Commit(DWORD grfCommitFlags) { return S_OK; };
+	virtual HRESULT STDMETHODCALLTYPE	Revert(void) { return E_NOTIMPL; };
+	virtual HRESULT STDMETHODCALLTYPE	LockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb, DWORD dwLockType) { return STG_E_INVALIDFUNCTION; };
+	virtual HRESULT STDMETHODCALLTYPE	UnlockRegion(ULARGE_INTEGER libOffset, ULARGE_INTEGER cb, DWORD dwLockType) { return STG_E_INVALIDFUNCTION; };
+	virtual HRESULT STDMETHODCALLTYPE	Clone(IStream** ppstm) { return E_NOTIMPL; };
+
+	// IUnknown interface
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG	STDMETHODCALLTYPE	AddRef();
+	virtual ULONG	STDMETHODCALLTYPE	Release();
+};
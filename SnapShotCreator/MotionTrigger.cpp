@@ -0,0 +1,436 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MOTIONTRIGGER_SSE2
+#endif
+
+#include "include/spdlog/spdlog.h"
+#include "platform.h"
+#include "utils.h"
+#include "RawVideoFrame.h"
+#include "MotionTrigger.h"
+
+namespace
+{
+	// Luma is sampled at every kSampleStep-th pixel and row of the region
+	const long		kSampleStep = 4;
+
+	// Blocks of kBlockSize x kBlockSize samples, 32x32 pixels of the frame
+	const long		kBlockSize = 8;
+
+	// Mean absolute 8-bit luma difference of the samples of a block above which it has changed
+	const uint32_t	kBlockThreshold = 12;
+
+	const int		kMaxPreTriggerFrames = 8;
+
+	// 8-bit luma samples of a region, rows padded with zeros to a multiple of 16 samples
+	struct LumaPlane
+	{
+		PixelConverter::Rect	region = { 0, 0, 0, 0 };
+		BMDPixelFormat			pixelFormat = (BMDPixelFormat)0;
+		long					width = 0;
+		long					height = 0;
+		long					stride = 0;
+		std::vector<uint8_t>	samples;
+	};
+
+	std::atomic<bool>					g_running{ false };
+
+	// Guarded by g_mutex, which the capture callback holds while it compares a frame
+	std::mutex							g_mutex;
+	MotionTrigger::Options				g_options;
+	MotionTrigger::Stats				g_stats;
+	LumaPlane							g_current;
+	LumaPlane							g_previous;
+	std::vector<uint16_t>				g_rgbRow;
+	std::vector<RawVideoFrame*>			g_preTriggerRing;		// copies of the last frames, the next one goes to g_preTriggerNext
+	std::vector<time_t>					g_preTriggerTimes;		// wall-clock arrival time of each copy in the ring
+	size_t								g_preTriggerNext = 0;
+	size_t								g_preTriggerCount = 0;
+	uint64_t							g_preTriggerGeneration = 0;	// changed by Start, so a copy made across a restart is dropped
+	bool								g_hasTriggered = false;
+	std::chrono::steady_clock::time_point	g_lastTrigger;
+
+	// Writer thread, guarded by g_mutex
+	MotionTrigger::CaptureHandler		g_captureHandler;
+	std::thread							g_writerThread;
+	std::condition_variable				g_writerCondition;		// signalled when frames are handed over or stop is requested
+	std::vector<IDeckLinkVideoFrame*>	g_pendingFrames;		// pre-trigger frames first, the triggering frame last
+	std::vector<time_t>					g_pendingTimes;			// wall-clock arrival time of each pending frame
+	bool								g_writerBusy = false;
+	bool								g_stopWriter = false;
+
+	// The configured region clipped to the frame, the whole frame if nothing is left
+	PixelConverter::Rect GetRegion(IDeckLinkVideoFrame* videoFrame, const PixelConverter::Rect& region)
+	{
+		long x = (std::max)(0L, region.x);
+		long y = (std::max)(0L, region.y);
+		// Clipped before adding, the sums of huge requested values would overflow a long
+		long endX = region.x + (std::min)(videoFrame->GetWidth() - region.x, region.width);
+		long endY = region.y + (std::min)(videoFrame->GetHeight() - region.y, region.height);
+
+		if ((endX <= x) || (endY <= y))
+			return { 0, 0, videoFrame->GetWidth(), videoFrame->GetHeight() };
+
+		return { x, y, endX - x, endY - y };
+	}
+
+	// Returns false for pixel formats that cannot be read
+	bool SampleLuma(IDeckLinkVideoFrame* videoFrame, const PixelConverter::Rect& region, LumaPlane& plane)
+	{
+		void*				bytes = NULL;
+		BMDPixelFormat		pixelFormat = videoFrame->GetPixelFormat();
+		long				rowBytes = videoFrame->GetRowBytes();
+
+		videoFrame->GetBytes(&bytes);
+		if ((bytes == NULL) || !PixelConverter::IsSupported(pixelFormat))
+			return false;
+
+		plane.region = region;
+		plane.pixelFormat = pixelFormat;
+		plane.width = (region.width + kSampleStep - 1) / kSampleStep;
+		plane.height = (region.height + kSampleStep - 1) / kSampleStep;
+		plane.stride = (plane.width + 15) & ~15L;
+
+		// The padding is zeroed once and never written
+		if (plane.samples.size() != (size_t)plane.stride * plane.height)
+			plane.samples.assign((size_t)plane.stride * plane.height, 0);
+
+		for (long sampleY = 0; sampleY < plane.height; sampleY++)
+		{
+			const uint8_t*	row = (const uint8_t*)bytes + (size_t)(region.y + sampleY * kSampleStep) * rowBytes;
+			uint8_t*		dst = plane.samples.data() + (size_t)sampleY * plane.stride;
+
+			if (pixelFormat == bmdFormat8BitYUV)
+			{
+				for (long sampleX = 0; sampleX < plane.width; sampleX++)
+					dst[sampleX] = row[2 * (region.x + sampleX * kSampleStep) + 1];
+			}
+			else if (pixelFormat == bmdFormat10BitYUV)
+			{
+				for (long sampleX = 0; sampleX < plane.width; sampleX++)
+					dst[sampleX] = (uint8_t)(PixelConverter::GetV210Luma(row, region.x + sampleX * kSampleStep) >> 2);
+			}
+			else
+			{
+				// RGB formats have no luma to pick, unpack the region columns and weigh
+				g_rgbRow.resize(region.width * 3);
+				PixelConverter::UnpackRow(pixelFormat, PixelConverter::GetColorimetry(videoFrame->GetHeight()), row, region.x, region.width, g_rgbRow.data());
+
+				for (long sampleX = 0; sampleX < plane.width; sampleX++)
+				{
+					const uint16_t* rgb = g_rgbRow.data() + sampleX * kSampleStep * 3;
+					dst[sampleX] = (uint8_t)((77 * (uint32_t)rgb[0] + 150 * (uint32_t)rgb[1] + 29 * (uint32_t)rgb[2]) >> 16);
+				}
+			}
+		}
+
+		return true;
+	}
+
+	bool SameGeometry(const LumaPlane& a, const LumaPlane& b)
+	{
+		return (a.pixelFormat == b.pixelFormat) && (a.region.x == b.region.x) && (a.region.y == b.region.y) &&
+			(a.region.width == b.region.width) && (a.region.height == b.region.height);
+	}
+
+	// Share of the blocks whose mean absolute difference exceeds kBlockThreshold
+	double GetChangedShare(const LumaPlane& current, const LumaPlane& previous)
+	{
+		long					blocksX = (current.width + kBlockSize - 1) / kBlockSize;
+		long					blocksY = (current.height + kBlockSize - 1) / kBlockSize;
+		long					changedBlocks = 0;
+		std::vector<uint32_t>	blockSads(current.stride / kBlockSize);
+
+		for (long blockY = 0; blockY < blocksY; blockY++)
+		{
+			long firstRow = blockY * kBlockSize;
+			long endRow = (std::min)(firstRow + kBlockSize, current.height);
+
+			std::fill(blockSads.begin(), blockSads.end(), 0);
+
+			for (long y = firstRow; y < endRow; y++)
+			{
+				const uint8_t* a = current.samples.data() + (size_t)y * current.stride;
+				const uint8_t* b = previous.samples.data() + (size_t)y * previous.stride;
+
+#ifdef MOTIONTRIGGER_SSE2
+				// One 16 byte SAD covers two blocks, one per 64-bit lane
+				for (long x = 0; x < current.stride; x += 16)
+				{
+					__m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a + x)), _mm_loadu_si128((const __m128i*)(b + x)));
+					blockSads[x / kBlockSize] += (uint32_t)_mm_cvtsi128_si32(sad);
+					blockSads[x / kBlockSize + 1] += (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+				}
+#else
+				for (long x = 0; x < current.stride; x++)
+					blockSads[x / kBlockSize] += (uint32_t)abs((int)a[x] - (int)b[x]);
+#endif
+			}
+
+			// Blocks at the right and bottom edges may hold fewer samples
+			for (long blockX = 0; blockX < blocksX; blockX++)
+			{
+				long samples = ((std::min)(kBlockSize, current.width - blockX * kBlockSize)) * (endRow - firstRow);
+				if (blockSads[blockX] > kBlockThreshold * (uint32_t)samples)
+					changedBlocks++;
+			}
+		}
+
+		return (double)changedBlocks / (double)(blocksX * blocksY);
+	}
+
+	// Take the buffer the next copy goes to out of the pre-trigger ring: the oldest copy once the ring is full,
+	// NULL until then. Called with g_mutex held.
+	RawVideoFrame* TakePreTriggerSlot()
+	{
+		RawVideoFrame* slot = g_preTriggerRing[g_preTriggerNext];
+
+		g_preTriggerRing[g_preTriggerNext] = NULL;
+		if ((slot != NULL) && (g_preTriggerCount == g_preTriggerRing.size()))
+			g_preTriggerCount--;
+		return slot;
+	}
+
+	// Copy the frame into slot, reusing its buffer if it matches. Called without g_mutex, returns NULL on failure.
+	RawVideoFrame* CopyPreTriggerFrame(IDeckLinkVideoFrame* videoFrame, RawVideoFrame* slot)
+	{
+		void*				srcBytes = NULL;
+		void*				dstBytes = NULL;
+
+		if ((slot != NULL) && ((slot->GetWidth() != videoFrame->GetWidth()) || (slot->GetHeight() != videoFrame->GetHeight()) ||
+			(slot->GetPixelFormat() != videoFrame->GetPixelFormat())))
+		{
+			slot->Release();
+			slot = NULL;
+		}
+		if (slot == NULL)
+			slot = new RawVideoFrame(videoFrame->GetWidth(), videoFrame->GetHeight(), videoFrame->GetPixelFormat(), videoFrame->GetFlags());
+
+		videoFrame->GetBytes(&srcBytes);
+		slot->GetBytes(&dstBytes);
+		if ((srcBytes == NULL) || (slot->GetRowBytes() != videoFrame->GetRowBytes()))
+		{
+			slot->Release();
+			return NULL;
+		}
+
+		memcpy(dstBytes, srcBytes, slot->GetBufferSize());
+		return slot;
+	}
+
+	// Put a copy into the slot taken by TakePreTriggerSlot. Called with g_mutex held.
+	void PushPreTriggerFrame(RawVideoFrame* copy, time_t arrivalTime)
+	{
+		g_preTriggerRing[g_preTriggerNext] = copy;
+		g_preTriggerTimes[g_preTriggerNext] = arrivalTime;
+		g_preTriggerNext = (g_preTriggerNext + 1) % g_preTriggerRing.size();
+		g_preTriggerCount = (std::min)(g_preTriggerCount + 1, g_preTriggerRing.size());
+	}
+
+	// Hand the frame and the pre-trigger frames to the writer, returns false if rate limited or the writer is busy
+	bool Fire(IDeckLinkVideoFrame* videoFrame, time_t arrivalTime, double difference)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		if (g_hasTriggered && (now - g_lastTrigger < std::chrono::duration<double>(g_options.minInterval)))
+		{
+			g_stats.rateLimited++;
+			return false;
+		}
+		if (g_writerBusy)
+		{
+			g_stats.dropped++;
+			spdlog::warn("Motion trigger dropped, the last capture is still being written");
+			return false;
+		}
+
+		g_hasTriggered = true;
+		g_lastTrigger = now;
+		g_stats.triggers++;
+		g_stats.lastTriggerTime = CurrentDateTime("%Y-%m-%dT%H:%M:%S");
+		spdlog::info("Motion trigger fired, {:.1f}% of blocks changed", difference * 100.0);
+
+		// Oldest first, the writer owns the copies from here on
+		for (size_t i = 0; i < g_preTriggerCount; i++)
+		{
+			size_t index = (g_preTriggerNext + g_preTriggerRing.size() - g_preTriggerCount + i) % g_preTriggerRing.size();
+			g_pendingFrames.push_back(g_preTriggerRing[index]);
+			g_pendingTimes.push_back(g_preTriggerTimes[index]);
+			g_preTriggerRing[index] = NULL;
+		}
+		g_preTriggerCount = 0;
+
+		videoFrame->AddRef();
+		g_pendingFrames.push_back(videoFrame);
+		g_pendingTimes.push_back(arrivalTime);
+		g_writerBusy = true;
+		g_writerCondition.notify_one();
+		return true;
+	}
+
+	void WriterThread()
+	{
+		std::unique_lock<std::mutex> lock(g_mutex);
+
+		while (true)
+		{
+			g_writerCondition.wait(lock, [] { return !g_pendingFrames.empty() || g_stopWriter; });
+			if (g_stopWriter)
+				break;
+
+			std::vector<IDeckLinkVideoFrame*>	videoFrames;
+			std::vector<time_t>					arrivalTimes;
+			std::vector<std::string>			filepaths;
+
+			videoFrames.swap(g_pendingFrames);
+			arrivalTimes.swap(g_pendingTimes);
+			lock.unlock();
+
+			for (size_t i = 0; i < videoFrames.size(); i++)
+			{
+				try
+				{
+					std::vector<std::string> frameFilepaths = g_captureHandler(videoFrames[i], arrivalTimes[i], i + 1 < videoFrames.size());
+					filepaths.insert(filepaths.end(), frameFilepaths.begin(), frameFilepaths.end());
+				}
+				catch (const std::exception& ex)
+				{
+					spdlog::error("Motion triggered capture failed: {}", ex.what());
+				}
+				videoFrames[i]->Release();
+			}
+
+			lock.lock();
+			g_stats.lastFilepaths = filepaths;
+			g_writerBusy = false;
+		}
+	}
+}
+
+void MotionTrigger::Start(const Options& options, const CaptureHandler& captureHandler)
+{
+	Stop();
+
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		g_options = options;
+		g_options.preTriggerFrames = (std::min)((std::max)(0, options.preTriggerFrames), kMaxPreTriggerFrames);
+		g_stats = Stats();
+		g_previous = LumaPlane();
+		g_preTriggerRing.assign(g_options.preTriggerFrames, NULL);
+		g_preTriggerTimes.assign(g_options.preTriggerFrames, 0);
+		g_preTriggerNext = 0;
+		g_preTriggerCount = 0;
+		g_preTriggerGeneration++;
+		g_hasTriggered = false;
+		g_captureHandler = captureHandler;
+		g_writerBusy = false;
+		g_stopWriter = false;
+	}
+
+	g_writerThread = std::thread(WriterThread);
+	g_running.store(true, std::memory_order_release);
+	spdlog::info("Motion trigger started, threshold {:.1f}% of blocks, {} pre-trigger frames", g_options.threshold * 100.0, g_options.preTriggerFrames);
+}
+
+void MotionTrigger::Stop()
+{
+	if (!g_running.exchange(false))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		g_stopWriter = true;
+	}
+	g_writerCondition.notify_one();
+
+	if (g_writerThread.joinable())
+		g_writerThread.join();
+
+	std::lock_guard<std::mutex> lock(g_mutex);
+	for (IDeckLinkVideoFrame* videoFrame : g_pendingFrames)
+		videoFrame->Release();
+	g_pendingFrames.clear();
+	g_pendingTimes.clear();
+
+	for (RawVideoFrame* videoFrame : g_preTriggerRing)
+	{
+		if (videoFrame != NULL)
+			videoFrame->Release();
+	}
+	g_preTriggerRing.clear();
+	g_preTriggerTimes.clear();
+	g_captureHandler = nullptr;
+	spdlog::info("Motion trigger stopped");
+}
+
+bool MotionTrigger::IsRunning()
+{
+	return g_running.load();
+}
+
+void MotionTrigger::FrameArrived(IDeckLinkVideoFrame* videoFrame)
+{
+	if (!g_running.load(std::memory_order_acquire))
+		return;
+
+	time_t arrivalTime = time(NULL);
+	std::unique_lock<std::mutex> lock(g_mutex);
+
+	// Stopped while waiting for the lock
+	if (!g_running.load())
+		return;
+
+	if (!SampleLuma(videoFrame, GetRegion(videoFrame, g_options.region), g_current))
+		return;
+
+	bool fired = false;
+	if (SameGeometry(g_current, g_previous))
+	{
+		double difference = GetChangedShare(g_current, g_previous);
+
+		g_stats.comparedFrames++;
+		g_stats.difference = difference;
+		g_stats.peakDifference = (std::max)(g_stats.peakDifference, difference);
+
+		if (difference >= g_options.threshold)
+			fired = Fire(videoFrame, arrivalTime, difference);
+	}
+	std::swap(g_current, g_previous);
+
+	// The triggering frame is written already, the ring starts over after it
+	if (fired || g_preTriggerRing.empty())
+		return;
+
+	// Only this thread fills the ring or fires, so the slot stays free while the frame is copied without the lock,
+	// which the writer thread and GetStats need meanwhile
+	RawVideoFrame*	slot = TakePreTriggerSlot();
+	uint64_t		generation = g_preTriggerGeneration;
+
+	lock.unlock();
+	RawVideoFrame* copy = CopyPreTriggerFrame(videoFrame, slot);
+	lock.lock();
+
+	if ((copy != NULL) && g_running.load() && (generation == g_preTriggerGeneration))
+		PushPreTriggerFrame(copy, arrivalTime);
+	else if (copy != NULL)
+		copy->Release();
+}
+
+MotionTrigger::Stats MotionTrigger::GetStats()
+{
+	std::lock_guard<std::mutex> lock(g_mutex);
+	Stats stats = g_stats;
+
+	stats.running = g_running.load();
+	return stats;
+}
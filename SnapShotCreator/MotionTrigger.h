@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "PixelConverter.h"
+
+// Capture triggered by picture changes between consecutive frames, such as a scene cut or a graphic appearing.
+// Frames are compared on the capture callback thread by the luma of every 4th pixel and row of the region,
+// as the share of 8x8 sample blocks whose mean absolute difference exceeds a fixed level.
+namespace MotionTrigger
+{
+	struct Options
+	{
+		double					threshold = 0.25;		// share of changed blocks that fires a capture
+		PixelConverter::Rect	region = { 0, 0, 0, 0 };	// compared part of the frame, zero size for the whole frame
+		double					minInterval = 1.0;		// seconds from one capture to the next
+		int						preTriggerFrames = 0;	// frames before the triggering one written along with it
+	};
+
+	struct Stats
+	{
+		bool						running;
+		uint64_t					comparedFrames;
+		uint64_t					triggers;			// captures handed to the writer
+		uint64_t					rateLimited;		// triggers within minInterval of the last capture
+		uint64_t					dropped;			// triggers while the writer was still busy
+		double						difference;			// share of changed blocks of the last compared frame
+		double						peakDifference;
+		std::string					lastTriggerTime;	// local time, ISO 8601
+		std::vector<std::string>	lastFilepaths;		// of the last capture, pre-trigger frames first
+	};
+
+	// Writes one frame of a capture and returns the filepaths written. Called on a worker thread,
+	// for the pre-trigger frames first and the triggering frame last, with the wall-clock time each frame arrived.
+	typedef std::function<std::vector<std::string>(IDeckLinkVideoFrame* videoFrame, time_t captureTime, bool preTrigger)> CaptureHandler;
+
+	void Start(const Options& options, const CaptureHandler& captureHandler);
+	void Stop(void);
+	bool IsRunning(void);
+
+	// Called by the input callback for every valid frame
+	void FrameArrived(IDeckLinkVideoFrame* videoFrame);
+
+	Stats GetStats(void);
+};
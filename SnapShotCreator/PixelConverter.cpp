@@ -0,0 +1,849 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PIXELCONVERTER_SSE2
+#endif
+
+#include "platform.h"
+#include "Rgb48VideoFrame.h"
+#include "PixelConverter.h"
+
+namespace
+{
+	// Fixed point Y'CbCr -> R'G'B' coefficients for 10-bit studio range input and 16-bit full range output
+	const int		kYuvShift = 12;
+
+	struct YuvCoefficients
+	{
+		int32_t		y;
+		int32_t		rv;
+		int32_t		gu;
+		int32_t		gv;
+		int32_t		bu;
+	};
+
+	YuvCoefficients MakeYuvCoefficients(double kr, double kb)
+	{
+		double				kg = 1.0 - kr - kb;
+		double				scale = (double)(1 << kYuvShift) * 65535.0;
+		YuvCoefficients		coefficients;
+
+		coefficients.y = (int32_t)lround(scale / 876.0);
+		coefficients.rv = (int32_t)lround(scale / 896.0 * 2.0 * (1.0 - kr));
+		coefficients.gu = (int32_t)lround(scale / 896.0 * 2.0 * (1.0 - kb) * kb / kg);
+		coefficients.gv = (int32_t)lround(scale / 896.0 * 2.0 * (1.0 - kr) * kr / kg);
+		coefficients.bu = (int32_t)lround(scale / 896.0 * 2.0 * (1.0 - kb));
+		return coefficients;
+	}
+
+	// Indexed by PixelConverter::Colorimetry
+	const YuvCoefficients	kYuvCoefficients[] =
+	{
+		MakeYuvCoefficients(0.299, 0.114),
+		MakeYuvCoefficients(0.2126, 0.0722),
+	};
+
+	// Fewer rows than this per thread are not worth a thread
+	const long		kMinRowsPerThread = 64;
+	int				g_threadCount = (std::max)(1, (int)(std::min)(std::thread::hardware_concurrency(), 8u));
+
+	inline uint32_t ReadLE32(const uint8_t* p)
+	{
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	inline uint32_t ReadBE32(const uint8_t* p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+	}
+
+	inline uint16_t RoundClamp16(int32_t value)
+	{
+		value = (value + (1 << (kYuvShift - 1))) >> kYuvShift;
+		return (uint16_t)((value < 0) ? 0 : ((value > 65535) ? 65535 : value));
+	}
+
+	// Full range 12-bit components widened to 16 bits by bit replication, so that full scale maps to 65535
+	inline uint16_t Expand12(uint32_t value)	{ return (uint16_t)((value << 4) | (value >> 8)); }
+
+	// 10-bit RGB with SMPTE video levels, black at 64 and white at kVideoWhite, stretched to 16-bit full range
+	// as YuvToRgb48 does for luma: (value - 64) * scale / 65536, rounded and clamped
+	template<int kVideoWhite>
+	struct VideoLevels10
+	{
+		static const uint32_t	kScale = (uint32_t)((65535ULL * 65536 + (kVideoWhite - 64) / 2) / (kVideoWhite - 64));
+
+		static uint16_t Expand(uint32_t value)
+		{
+			if (value <= 64)
+				return 0;
+
+			uint64_t expanded = ((uint64_t)(value - 64) * kScale + 32768) >> 16;
+			return (uint16_t)((expanded > 65535) ? 65535 : expanded);
+		}
+	};
+
+	inline void YuvToRgb48(const YuvCoefficients& c, int32_t y, int32_t cb, int32_t cr, uint16_t* dst)
+	{
+		int32_t luma = c.y * (y - 64);
+
+		cb -= 512;
+		cr -= 512;
+		dst[0] = RoundClamp16(luma + c.rv * cr);
+		dst[1] = RoundClamp16(luma - c.gu * cb - c.gv * cr);
+		dst[2] = RoundClamp16(luma + c.bu * cb);
+	}
+
+#if defined(PIXELCONVERTER_SSE2)
+	// Coefficient c as (c / 32, c % 32) for madd with (value * 32, value) pairs, which gives the exact 32-bit product
+	// of a coefficient of up to 20 bits and a signed 10-bit component
+	inline __m128i SplitCoefficient(int32_t c)
+	{
+		return _mm_set1_epi32((c >> 5) | ((c & 31) << 16));
+	}
+
+	// Four 32-bit results as 16-bit, rounded and clamped like RoundClamp16, in the low half
+	inline __m128i RoundClamp16(__m128i value)
+	{
+		value = _mm_srai_epi32(_mm_add_epi32(value, _mm_set1_epi32(1 << (kYuvShift - 1))), kYuvShift);
+		return _mm_sub_epi32(value, _mm_set1_epi32(32768));
+	}
+
+	// YuvToRgb48 of count pixels, a multiple of 8, from components with their offsets removed
+	// (y - 64, cb - 512, cr - 512); the results are identical to the scalar ones
+	void YuvToRgb48Block(const YuvCoefficients& c, const int16_t* y, const int16_t* cb, const int16_t* cr, long count, uint16_t* dst)
+	{
+		const __m128i		yc = SplitCoefficient(c.y);
+		const __m128i		rv = SplitCoefficient(c.rv);
+		const __m128i		gu = SplitCoefficient(c.gu);
+		const __m128i		gv = SplitCoefficient(c.gv);
+		const __m128i		bu = SplitCoefficient(c.bu);
+		const __m128i		bias = _mm_set1_epi16((short)0x8000);
+		alignas(16) uint16_t	planes[3][8];
+
+		for (long i = 0; i < count; i += 8, dst += 24)
+		{
+			__m128i components[3] = { _mm_loadu_si128((const __m128i*)(y + i)), _mm_loadu_si128((const __m128i*)(cb + i)), _mm_loadu_si128((const __m128i*)(cr + i)) };
+			__m128i results[3][2];
+
+			for (int half = 0; half < 2; half++)
+			{
+				__m128i pairs[3];
+				for (int k = 0; k < 3; k++)
+				{
+					__m128i scaled = _mm_slli_epi16(components[k], 5);
+					pairs[k] = half ? _mm_unpackhi_epi16(scaled, components[k]) : _mm_unpacklo_epi16(scaled, components[k]);
+				}
+
+				__m128i luma = _mm_madd_epi16(pairs[0], yc);
+				results[0][half] = RoundClamp16(_mm_add_epi32(luma, _mm_madd_epi16(pairs[2], rv)));
+				results[1][half] = RoundClamp16(_mm_sub_epi32(_mm_sub_epi32(luma, _mm_madd_epi16(pairs[1], gu)), _mm_madd_epi16(pairs[2], gv)));
+				results[2][half] = RoundClamp16(_mm_add_epi32(luma, _mm_madd_epi16(pairs[1], bu)));
+			}
+
+			// Signed saturation of the values biased by -32768 clamps them to [0, 65535]
+			for (int k = 0; k < 3; k++)
+				_mm_store_si128((__m128i*)planes[k], _mm_xor_si128(_mm_packs_epi32(results[k][0], results[k][1]), bias));
+
+			for (int k = 0; k < 8; k++)
+			{
+				dst[k * 3] = planes[0][k];
+				dst[k * 3 + 1] = planes[1][k];
+				dst[k * 3 + 2] = planes[2][k];
+			}
+		}
+	}
+#endif
+
+	// 8-bit 4:2:2, Cb Y0 Cr Y1 per pixel pair
+	void Unpack2vuy(const YuvCoefficients& c, const uint8_t* row, long x, long width, uint16_t* dst)
+	{
+		for (long i = x; i < x + width; i++, dst += 3)
+		{
+			const uint8_t* pair = row + (i >> 1) * 4;
+			YuvToRgb48(c, pair[1 + 2 * (i & 1)] << 2, pair[0] << 2, pair[2] << 2, dst);
+		}
+	}
+
+	// 10-bit 4:2:2, 6 pixels in four little-endian words
+	void UnpackV210(const YuvCoefficients& c, const uint8_t* row, long x, long width, uint16_t* dst)
+	{
+		long		i = x;
+		long		end = x + width;
+
+		while (i < end)
+		{
+#if defined(PIXELCONVERTER_SSE2)
+			// Four whole groups at a time: components gathered as below, the matrix applied in vectors
+			if ((i % 6 == 0) && (i + 24 <= end))
+			{
+				alignas(16) int16_t		lumas[24];
+				alignas(16) int16_t		cbs[24];
+				alignas(16) int16_t		crs[24];
+
+				for (int g = 0; g < 4; g++)
+				{
+					const uint8_t*	group = row + (i / 6 + g) * 16;
+					uint32_t		w0 = ReadLE32(group);
+					uint32_t		w1 = ReadLE32(group + 4);
+					uint32_t		w2 = ReadLE32(group + 8);
+					uint32_t		w3 = ReadLE32(group + 12);
+					int16_t*		luma = lumas + g * 6;
+					int16_t*		cb = cbs + g * 6;
+					int16_t*		cr = crs + g * 6;
+
+					const uint32_t	lumaFields[6] = { (w0 >> 10), w1, (w1 >> 20), (w2 >> 10), w3, (w3 >> 20) };
+					const uint32_t	cbFields[3] = { w0, (w1 >> 10), (w2 >> 20) };
+					const uint32_t	crFields[3] = { (w0 >> 20), w2, (w3 >> 10) };
+
+					for (int k = 0; k < 6; k++)
+					{
+						luma[k] = (int16_t)((int32_t)(lumaFields[k] & 0x3ff) - 64);
+						cb[k] = (int16_t)((int32_t)(cbFields[k >> 1] & 0x3ff) - 512);
+						cr[k] = (int16_t)((int32_t)(crFields[k >> 1] & 0x3ff) - 512);
+					}
+				}
+
+				YuvToRgb48Block(c, lumas, cbs, crs, 24, dst);
+				i += 24;
+				dst += 72;
+				continue;
+			}
+#endif
+			const uint8_t*	group = row + (i / 6) * 16;
+			uint32_t		w0 = ReadLE32(group);
+			uint32_t		w1 = ReadLE32(group + 4);
+			uint32_t		w2 = ReadLE32(group + 8);
+			uint32_t		w3 = ReadLE32(group + 12);
+
+			const int32_t	luma[6] = { (int32_t)((w0 >> 10) & 0x3ff), (int32_t)(w1 & 0x3ff), (int32_t)((w1 >> 20) & 0x3ff),
+										(int32_t)((w2 >> 10) & 0x3ff), (int32_t)(w3 & 0x3ff), (int32_t)((w3 >> 20) & 0x3ff) };
+			const int32_t	cb[3] = { (int32_t)(w0 & 0x3ff), (int32_t)((w1 >> 10) & 0x3ff), (int32_t)((w2 >> 20) & 0x3ff) };
+			const int32_t	cr[3] = { (int32_t)((w0 >> 20) & 0x3ff), (int32_t)(w2 & 0x3ff), (int32_t)((w3 >> 10) & 0x3ff) };
+
+			for (long k = i % 6; (k < 6) && (i < end); k++, i++, dst += 3)
+				YuvToRgb48(c, luma[k], cb[k >> 1], cr[k >> 1], dst);
+		}
+	}
+
+	// 8-bit RGB with alpha, channel byte offsets within each 4-byte pixel
+	template<int kRed, int kGreen, int kBlue>
+	void Unpack8BitRgb(const uint8_t* row, long x, long width, uint16_t* dst)
+	{
+		const uint8_t* src = row + x * 4;
+
+		for (long i = 0; i < width; i++, src += 4, dst += 3)
+		{
+			dst[0] = (uint16_t)(src[kRed] * 257);
+			dst[1] = (uint16_t)(src[kGreen] * 257);
+			dst[2] = (uint16_t)(src[kBlue] * 257);
+		}
+	}
+
+#if defined(PIXELCONVERTER_SSE2)
+	inline __m128i ByteSwap32(__m128i value)
+	{
+		__m128i outer = _mm_or_si128(_mm_slli_epi32(value, 24), _mm_srli_epi32(value, 24));
+		__m128i inner = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(value, 8), _mm_set1_epi32(0x00ff0000)),
+			_mm_and_si128(_mm_srli_epi32(value, 8), _mm_set1_epi32(0x0000ff00)));
+		return _mm_or_si128(outer, inner);
+	}
+
+	// VideoLevels10::Expand of four 10-bit values in 32-bit lanes
+	template<int kVideoWhite>
+	inline __m128i ExpandVideo10(__m128i value)
+	{
+		const __m128i	white = _mm_set1_epi32(65535);
+
+		const __m128i	scale = _mm_set1_epi32((int)VideoLevels10<kVideoWhite>::kScale);
+		const __m128i	round = _mm_set1_epi64x(32768);
+
+		// Below black clamps to 0, then 64-bit products of the even and the odd lanes
+		value = _mm_sub_epi32(value, _mm_set1_epi32(64));
+		value = _mm_andnot_si128(_mm_srai_epi32(value, 31), value);
+
+		__m128i even = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(value, scale), round), 16);
+		__m128i odd = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(value, 32), scale), round), 16);
+		value = _mm_or_si128(_mm_and_si128(even, _mm_set1_epi64x(0xffffffff)), _mm_slli_epi64(odd, 32));
+
+		__m128i above = _mm_cmpgt_epi32(value, white);
+		return _mm_or_si128(_mm_andnot_si128(above, value), _mm_and_si128(above, white));
+	}
+#endif
+
+	// 10-bit RGB, one 32-bit word per pixel with red at bit kRedShift, then green and blue 10 bits below,
+	// video levels with white at kVideoWhite
+	template<bool kBigEndian, int kRedShift, int kVideoWhite>
+	void Unpack10BitRgb(const uint8_t* row, long x, long width, uint16_t* dst)
+	{
+		const uint8_t*	src = row + x * 4;
+		long			i = 0;
+
+#if defined(PIXELCONVERTER_SSE2)
+		// Four pixels per step: field extraction and widening in vector registers, R and G packed into one word
+		const __m128i	mask = _mm_set1_epi32(0x3ff);
+		alignas(16) uint32_t	redGreen[4];
+		alignas(16) uint32_t	blue[4];
+
+		for (; i + 4 <= width; i += 4, src += 16, dst += 12)
+		{
+			__m128i words = _mm_loadu_si128((const __m128i*)src);
+			if (kBigEndian)
+				words = ByteSwap32(words);
+
+			__m128i r = ExpandVideo10<kVideoWhite>(_mm_and_si128(_mm_srli_epi32(words, kRedShift), mask));
+			__m128i g = ExpandVideo10<kVideoWhite>(_mm_and_si128(_mm_srli_epi32(words, kRedShift - 10), mask));
+			__m128i b = ExpandVideo10<kVideoWhite>(_mm_and_si128(_mm_srli_epi32(words, kRedShift - 20), mask));
+
+			_mm_store_si128((__m128i*)redGreen, _mm_or_si128(r, _mm_slli_epi32(g, 16)));
+			_mm_store_si128((__m128i*)blue, b);
+
+			for (int k = 0; k < 4; k++)
+			{
+				memcpy(dst + k * 3, &redGreen[k], 4);
+				dst[k * 3 + 2] = (uint16_t)blue[k];
+			}
+		}
+#endif
+
+		for (; i < width; i++, src += 4, dst += 3)
+		{
+			uint32_t word = kBigEndian ? ReadBE32(src) : ReadLE32(src);
+
+			dst[0] = VideoLevels10<kVideoWhite>::Expand((word >> kRedShift) & 0x3ff);
+			dst[1] = VideoLevels10<kVideoWhite>::Expand((word >> (kRedShift - 10)) & 0x3ff);
+			dst[2] = VideoLevels10<kVideoWhite>::Expand((word >> (kRedShift - 20)) & 0x3ff);
+		}
+	}
+
+	// 12-bit RGB, 8 pixels in nine 32-bit words forming one continuous R, G, B bit stream
+	template<bool kBigEndian>
+	void Unpack12BitRgb(const uint8_t* row, long x, long width, uint16_t* dst)
+	{
+		long		i = x;
+		long		end = x + width;
+		uint32_t	words[10];
+
+		// Spare last word, so that components straddling two words need no bounds check
+		words[9] = 0;
+
+		while (i < end)
+		{
+			const uint8_t* group = row + (i / 8) * 36;
+
+#if defined(PIXELCONVERTER_SSE2)
+			// Whole groups while the next one is in the row too, as the last 16-byte load reads 4 bytes past the group.
+			// Components follow each other in R, G, B order, two in every 3 bytes of the little-endian bit stream:
+			// four such triplets are gathered into the 32-bit lanes of a vector from byte shifted copies of one load.
+			if ((i % 8 == 0) && (i + 16 <= end))
+			{
+				const __m128i mask = _mm_set1_epi32(0xfff);
+
+				for (int step = 0; step < 3; step++, dst += 8)
+				{
+					__m128i bytes = _mm_loadu_si128((const __m128i*)(group + step * 12));
+					if (kBigEndian)
+						bytes = ByteSwap32(bytes);
+
+					__m128i triplets = _mm_unpacklo_epi64(_mm_unpacklo_epi32(bytes, _mm_srli_si128(bytes, 3)),
+						_mm_unpacklo_epi32(_mm_srli_si128(bytes, 6), _mm_srli_si128(bytes, 9)));
+					__m128i first = _mm_and_si128(triplets, mask);
+					__m128i second = _mm_and_si128(_mm_srli_epi32(triplets, 12), mask);
+
+					// Bit replication of both, the second one into the high half of each lane
+					first = _mm_or_si128(_mm_slli_epi32(first, 4), _mm_srli_epi32(first, 8));
+					second = _mm_or_si128(_mm_slli_epi32(second, 20), _mm_slli_epi32(_mm_srli_epi32(second, 8), 16));
+					_mm_storeu_si128((__m128i*)dst, _mm_or_si128(first, second));
+				}
+
+				i += 8;
+				continue;
+			}
+#endif
+
+			for (int w = 0; w < 9; w++)
+				words[w] = kBigEndian ? ReadBE32(group + w * 4) : ReadLE32(group + w * 4);
+
+			for (long k = i % 8; (k < 8) && (i < end); k++, i++, dst += 3)
+			{
+				for (int component = 0; component < 3; component++)
+				{
+					int			bit = (int)(k * 3 + component) * 12;
+					uint64_t	bits = (((uint64_t)words[bit / 32 + 1] << 32) | words[bit / 32]) >> (bit % 32);
+					dst[component] = Expand12((uint32_t)bits & 0xfff);
+				}
+			}
+		}
+	}
+
+	// Largest amount, in 16-bit steps, by which adaptive deinterlacing lets a second field row stand out from the rows
+	// above and below it; about 6 levels of 8-bit video, so noise and fine detail stay but combing is clipped away
+	const uint16_t	kAdaptiveThreshold = 0x0600;
+
+	// Rows of a frame unpacked and deinterlaced for a conversion, one instance per thread.
+	// Unpacked rows are cached by row modulo 3, which holds a row and both of its neighbours,
+	// so reading consecutive rows unpacks each source row once.
+	struct RowSource
+	{
+		BMDPixelFormat					pixelFormat;
+		PixelConverter::Colorimetry		colorimetry;
+		const uint8_t*					frameBytes;
+		long							rowBytes;
+		long							frameHeight;
+		long							x;
+		long							width;
+		PixelConverter::Deinterlace		deinterlace;
+		long							firstFieldParity;	// 0 if the upper field comes first, 1 if the lower one does
+		std::vector<uint16_t>			cache[3];
+		long							cachedRows[3];
+
+		RowSource(IDeckLinkVideoFrame* frame, const uint8_t* bytes, long srcX, long srcWidth,
+			PixelConverter::Deinterlace deinterlaceMethod, BMDFieldDominance fieldDominance)
+			: pixelFormat(frame->GetPixelFormat()), colorimetry(PixelConverter::GetColorimetry(frame->GetHeight())),
+			frameBytes(bytes), rowBytes(frame->GetRowBytes()), frameHeight(frame->GetHeight()), x(srcX), width(srcWidth),
+			deinterlace(PixelConverter::IsInterlaced(fieldDominance) ? deinterlaceMethod : PixelConverter::kDeinterlaceNone),
+			firstFieldParity((fieldDominance == bmdLowerFieldFirst) ? 1 : 0), cachedRows{ -1, -1, -1 }
+		{
+		}
+
+		void Unpack(long y, uint16_t* dst)
+		{
+			PixelConverter::UnpackRow(pixelFormat, colorimetry, frameBytes + (size_t)y * rowBytes, x, width, dst);
+		}
+
+		const uint16_t* GetUnpacked(long y)
+		{
+			int slot = (int)(y % 3);
+
+			if (cachedRows[slot] != y)
+			{
+				cache[slot].resize(width * 3);
+				Unpack(y, cache[slot].data());
+				cachedRows[slot] = y;
+			}
+			return cache[slot].data();
+		}
+
+		// Row y of the frame, width * 3 values at dst
+		void Read(long y, uint16_t* dst)
+		{
+			bool	secondField = (y % 2) != firstFieldParity;
+			long	above = (y > 0) ? y - 1 : y + 1;
+			long	below = (y + 1 < frameHeight) ? y + 1 : y - 1;
+
+			// Single row frames have no neighbours to take from
+			if ((deinterlace == PixelConverter::kDeinterlaceNone) || (frameHeight < 2))
+			{
+				Unpack(y, dst);
+			}
+			else if (deinterlace == PixelConverter::kDeinterlaceField)
+			{
+				// The row of the first field above, or below at the top edge
+				Unpack(secondField ? above : y, dst);
+			}
+			else if (deinterlace == PixelConverter::kDeinterlaceBlend)
+			{
+				Blend(GetUnpacked(above), GetUnpacked(y), GetUnpacked(below), dst);
+			}
+			else if (secondField)
+			{
+				Clip(GetUnpacked(above), GetUnpacked(y), GetUnpacked(below), dst);
+			}
+			else
+			{
+				memcpy(dst, GetUnpacked(y), width * 3 * sizeof(uint16_t));
+			}
+		}
+
+		// (above + 2 * row + below) / 4, rounded up by the two averages
+		void Blend(const uint16_t* above, const uint16_t* row, const uint16_t* below, uint16_t* dst)
+		{
+			long count = width * 3;
+			long i = 0;
+
+#if defined(PIXELCONVERTER_SSE2)
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i outer = _mm_avg_epu16(_mm_loadu_si128((const __m128i*)(above + i)), _mm_loadu_si128((const __m128i*)(below + i)));
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_avg_epu16(outer, _mm_loadu_si128((const __m128i*)(row + i))));
+			}
+#endif
+			for (; i < count; i++)
+				dst[i] = (uint16_t)((((above[i] + below[i] + 1) >> 1) + row[i] + 1) >> 1);
+		}
+
+		// row clipped to [min(above, below) - threshold, max(above, below) + threshold]: a static row keeps its detail,
+		// a moving one that combs against its neighbours is pulled back between them
+		void Clip(const uint16_t* above, const uint16_t* row, const uint16_t* below, uint16_t* dst)
+		{
+			long count = width * 3;
+			long i = 0;
+
+#if defined(PIXELCONVERTER_SSE2)
+			// Unsigned 16-bit min and max from saturating subtraction, SSE2 has signed ones only
+			const __m128i threshold = _mm_set1_epi16((short)kAdaptiveThreshold);
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i*)(above + i));
+				__m128i b = _mm_loadu_si128((const __m128i*)(below + i));
+				__m128i value = _mm_loadu_si128((const __m128i*)(row + i));
+				__m128i difference = _mm_subs_epu16(a, b);
+				__m128i low = _mm_subs_epu16(_mm_sub_epi16(a, difference), threshold);
+				__m128i high = _mm_adds_epu16(_mm_add_epi16(b, difference), threshold);
+
+				value = _mm_add_epi16(low, _mm_subs_epu16(value, low));
+				value = _mm_sub_epi16(value, _mm_subs_epu16(value, high));
+				_mm_storeu_si128((__m128i*)(dst + i), value);
+			}
+#endif
+			for (; i < count; i++)
+			{
+				int low = (std::max)((int)(std::min)(above[i], below[i]) - kAdaptiveThreshold, 0);
+				int high = (std::min)((int)(std::max)(above[i], below[i]) + kAdaptiveThreshold, 0xffff);
+				dst[i] = (uint16_t)(std::min)((std::max)((int)row[i], low), high);
+			}
+		}
+	};
+
+#if defined(PIXELCONVERTER_SSE2)
+	// Downscaling with each R, G, B pixel in the low three 32-bit lanes of a vector, which is exact while a box
+	// of at most kMaxBoxArea 16-bit pixels plus half of it for rounding fits in 32 bits
+	const long		kMaxBoxArea = 65536;
+
+	// Unsigned 32-bit division by a divisor shared by all lanes as a multiply and two shifts (Granlund and Montgomery)
+	struct Divider
+	{
+		__m128i		multiplier;
+		__m128i		shift1;
+		__m128i		shift2;
+
+		explicit Divider(uint32_t divisor)
+		{
+			int log2 = 0;
+			while (((uint64_t)1 << log2) < divisor)
+				log2++;
+
+			multiplier = _mm_set1_epi32((int)(uint32_t)((((uint64_t)1 << 32) * (((uint64_t)1 << log2) - divisor)) / divisor + 1));
+			shift1 = _mm_cvtsi32_si128((log2 > 0) ? 1 : 0);
+			shift2 = _mm_cvtsi32_si128((log2 > 0) ? log2 - 1 : 0);
+		}
+
+		__m128i Divide(__m128i value) const
+		{
+			__m128i even = _mm_srli_epi64(_mm_mul_epu32(value, multiplier), 32);
+			__m128i odd = _mm_mul_epu32(_mm_srli_epi64(value, 32), multiplier);
+			__m128i high = _mm_or_si128(even, _mm_and_si128(odd, _mm_set_epi32(-1, 0, -1, 0)));
+
+			return _mm_srl_epi32(_mm_add_epi32(high, _mm_srl_epi32(_mm_sub_epi32(value, high), shift1)), shift2);
+		}
+	};
+
+	// Add the box sums of one unpacked source row into sums, four lanes per destination column.
+	// Each pixel is read as four 16-bit values, so the row needs one value of padding.
+	void SumColumns(const uint16_t* src, const long* columnStart, long dstWidth, uint32_t* sums)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		for (long x = 0; x < dstWidth; x++, sums += 4)
+		{
+			__m128i sum = _mm_loadu_si128((const __m128i*)sums);
+			for (long srcX = columnStart[x]; srcX < columnStart[x + 1]; srcX++, src += 3)
+				sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)src), zero));
+			_mm_storeu_si128((__m128i*)sums, sum);
+		}
+	}
+
+	// Rounded box averages of one destination row, as 16-bit R, G, B into rgb (one value of padding) or as B, G, R, A
+	// into bgra. Columns are one of two widths, dividers holds those of the narrow and the wide ones.
+	void AverageColumns(const uint32_t* sums, const long* columnStart, long dstWidth, long rows, const Divider* dividers,
+		uint16_t* rgb, uint8_t* bgra)
+	{
+		long		narrowWidth = columnStart[1] - columnStart[0];
+		__m128i		bias = _mm_set1_epi32(32768);
+		__m128i		opaque = _mm_cvtsi32_si128((int)0xff000000);
+
+		for (long x = 0; x < dstWidth; x++, sums += 4)
+		{
+			long	width = columnStart[x + 1] - columnStart[x];
+			__m128i	half = _mm_set1_epi32((int)(width * rows / 2));
+			__m128i	average = dividers[width - narrowWidth].Divide(_mm_add_epi32(_mm_loadu_si128((const __m128i*)sums), half));
+
+			if (rgb != NULL)
+			{
+				// Biased to signed for the saturating pack, the fourth value is overwritten by the next pixel
+				__m128i packed = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(average, bias), bias), _mm_set1_epi16((short)0x8000));
+				_mm_storel_epi64((__m128i*)(rgb + x * 3), packed);
+				continue;
+			}
+
+			// 16 -> 8 bits with rounding, (v * 255 + 32767) / 65535 as shifts and adds
+			__m128i scaled = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(average, 8), average), _mm_set1_epi32(32767));
+			__m128i value = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(scaled, _mm_srli_epi32(scaled, 16)), _mm_set1_epi32(1)), 16);
+
+			value = _mm_shuffle_epi32(value, _MM_SHUFFLE(3, 0, 1, 2));
+			value = _mm_packus_epi16(_mm_packs_epi32(value, value), value);
+			uint32_t pixel = (uint32_t)_mm_cvtsi128_si32(_mm_or_si128(value, opaque));
+			memcpy(bgra + x * 4, &pixel, 4);
+		}
+	}
+#endif
+}
+
+PixelConverter::Colorimetry PixelConverter::GetColorimetry(long height)
+{
+	return (height > 576) ? kColorimetryRec709 : kColorimetryRec601;
+}
+
+bool PixelConverter::IsSupported(BMDPixelFormat pixelFormat)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+		case bmdFormat10BitYUV:
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:
+		case bmdFormat10BitRGB:
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:
+		case bmdFormat10BitRGBX:
+		case bmdFormat10BitRGBXLE:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+void PixelConverter::UnpackRow(BMDPixelFormat pixelFormat, Colorimetry colorimetry, const uint8_t* row, long x, long width, uint16_t* dst)
+{
+	const YuvCoefficients& coefficients = kYuvCoefficients[colorimetry];
+
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:		Unpack2vuy(coefficients, row, x, width, dst); break;
+		case bmdFormat10BitYUV:		UnpackV210(coefficients, row, x, width, dst); break;
+		case bmdFormat8BitARGB:		Unpack8BitRgb<1, 2, 3>(row, x, width, dst); break;
+		case bmdFormat8BitBGRA:		Unpack8BitRgb<2, 1, 0>(row, x, width, dst); break;
+		case bmdFormat10BitRGB:		Unpack10BitRgb<true, 20, 960>(row, x, width, dst); break;
+		case bmdFormat10BitRGBX:	Unpack10BitRgb<true, 22, 940>(row, x, width, dst); break;
+		case bmdFormat10BitRGBXLE:	Unpack10BitRgb<false, 22, 940>(row, x, width, dst); break;
+		case bmdFormat12BitRGB:		Unpack12BitRgb<true>(row, x, width, dst); break;
+		case bmdFormat12BitRGBLE:	Unpack12BitRgb<false>(row, x, width, dst); break;
+		default:					break;
+	}
+}
+
+namespace
+{
+	// v210 packs 6 pixels in 4 words, Y at these word and bit offsets, Cb and Cr per pixel pair
+	const int		kV210LumaWord[6] = { 0, 1, 1, 2, 3, 3 };
+	const int		kV210LumaShift[6] = { 10, 0, 20, 10, 0, 20 };
+	const int		kV210CbWord[3] = { 0, 1, 2 };
+	const int		kV210CbShift[3] = { 0, 10, 20 };
+	const int		kV210CrWord[3] = { 0, 2, 3 };
+	const int		kV210CrShift[3] = { 20, 0, 10 };
+}
+
+void PixelConverter::UnpackV210Components(const uint8_t* row, long x, long width, uint16_t* luma, uint16_t* cb, uint16_t* cr)
+{
+	long i = 0;
+
+	while (i < width)
+	{
+		const uint8_t*	group = row + ((x + i) / 6) * 16;
+
+		for (int k = (int)((x + i) % 6); (k < 6) && (i < width); k++, i++)
+		{
+			luma[i] = (uint16_t)((ReadLE32(group + 4 * kV210LumaWord[k]) >> kV210LumaShift[k]) & 0x3ff);
+			if (cb != NULL)
+				cb[i] = (uint16_t)((ReadLE32(group + 4 * kV210CbWord[k >> 1]) >> kV210CbShift[k >> 1]) & 0x3ff);
+			if (cr != NULL)
+				cr[i] = (uint16_t)((ReadLE32(group + 4 * kV210CrWord[k >> 1]) >> kV210CrShift[k >> 1]) & 0x3ff);
+		}
+	}
+}
+
+uint16_t PixelConverter::GetV210Luma(const uint8_t* row, long x)
+{
+	return (uint16_t)((ReadLE32(row + (x / 6) * 16 + 4 * kV210LumaWord[x % 6]) >> kV210LumaShift[x % 6]) & 0x3ff);
+}
+
+bool PixelConverter::IsInterlaced(BMDFieldDominance fieldDominance)
+{
+	return (fieldDominance == bmdUpperFieldFirst) || (fieldDominance == bmdLowerFieldFirst);
+}
+
+void PixelConverter::SetThreadCount(int threadCount)
+{
+	g_threadCount = (std::max)(1, threadCount);
+}
+
+int PixelConverter::GetThreadCount()
+{
+	return g_threadCount;
+}
+
+void PixelConverter::ParallelRows(long rows, const std::function<void(long firstRow, long endRow)>& work)
+{
+	long						threadCount = (std::min)((long)g_threadCount, (std::max)(1L, rows / kMinRowsPerThread));
+	std::vector<std::thread>	threads;
+
+	// The calling thread takes the first block
+	for (long t = 1; t < threadCount; t++)
+		threads.emplace_back(work, rows * t / threadCount, rows * (t + 1) / threadCount);
+
+	work(0, rows / threadCount);
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+HRESULT PixelConverter::ConvertScaled(IDeckLinkVideoFrame* srcFrame, const Rect& srcRect, BMDPixelFormat dstPixelFormat, long dstWidth, long dstHeight, void* dst, long dstRowBytes,
+	Deinterlace deinterlace, BMDFieldDominance fieldDominance)
+{
+	void*				srcBytes = NULL;
+	BMDPixelFormat		pixelFormat = srcFrame->GetPixelFormat();
+	long				srcX = srcRect.x;
+	long				srcWidth = srcRect.width;
+	long				srcHeight = srcRect.height;
+
+	if (!IsSupported(pixelFormat) || ((dstPixelFormat != bmdFormat8BitBGRA) && (dstPixelFormat != kPixelFormat16BitRGB)) ||
+		(srcRect.x < 0) || (srcRect.y < 0) || (srcWidth <= 0) || (srcHeight <= 0) ||
+		(srcWidth > srcFrame->GetWidth() - srcRect.x) || (srcHeight > srcFrame->GetHeight() - srcRect.y) ||
+		(dstWidth <= 0) || (dstHeight <= 0) || (dstWidth > srcWidth) || (dstHeight > srcHeight))
+		return E_INVALIDARG;
+
+	srcFrame->GetBytes(&srcBytes);
+	if ((srcBytes == NULL) || (dst == NULL))
+		return E_POINTER;
+
+	bool scaled = (dstWidth != srcWidth) || (dstHeight != srcHeight);
+
+	// Source columns [columnStart[x], columnStart[x + 1]) average into destination column x
+	std::vector<long> columnStart(dstWidth + 1);
+	for (long x = 0; x <= dstWidth; x++)
+		columnStart[x] = x * srcWidth / dstWidth;
+
+#if defined(PIXELCONVERTER_SSE2)
+	// Every box is at most one column and one row wider than the narrowest ones
+	bool vectorBoxes = scaled && ((srcWidth / dstWidth + 1) * (srcHeight / dstHeight + 1) <= kMaxBoxArea);
+#endif
+
+	ParallelRows(dstHeight, [&](long firstRow, long endRow) {
+		std::vector<uint16_t>	row(srcWidth * 3 + 1);
+		std::vector<uint64_t>	sums(scaled ? dstWidth * 3 : 0);
+		RowSource				source(srcFrame, (const uint8_t*)srcBytes, srcX, srcWidth, deinterlace, fieldDominance);
+#if defined(PIXELCONVERTER_SSE2)
+		std::vector<uint32_t>	boxSums(vectorBoxes ? dstWidth * 4 : 0);
+#endif
+
+		for (long y = firstRow; y < endRow; y++)
+		{
+			uint8_t*		dstRow = (uint8_t*)dst + (size_t)y * dstRowBytes;
+			const uint16_t*	rgb = row.data();
+			long			firstSrcRow = y * srcHeight / dstHeight;
+			long			endSrcRow = (y + 1) * srcHeight / dstHeight;
+
+			if (!scaled)
+			{
+				// Same size: 16-bit output is unpacked in place, 8-bit goes through the row buffer
+				uint16_t* target = (dstPixelFormat == kPixelFormat16BitRGB) ? (uint16_t*)dstRow : row.data();
+				source.Read(srcRect.y + y, target);
+				if (dstPixelFormat == kPixelFormat16BitRGB)
+					continue;
+			}
+#if defined(PIXELCONVERTER_SSE2)
+			else if (vectorBoxes)
+			{
+				long		narrowWidth = columnStart[1] - columnStart[0];
+				Divider		dividers[2] = { Divider((uint32_t)(narrowWidth * (endSrcRow - firstSrcRow))),
+					Divider((uint32_t)((narrowWidth + 1) * (endSrcRow - firstSrcRow))) };
+				bool		rgb48 = (dstPixelFormat == kPixelFormat16BitRGB);
+
+				std::fill(boxSums.begin(), boxSums.end(), 0);
+				for (long srcY = firstSrcRow; srcY < endSrcRow; srcY++)
+				{
+					source.Read(srcRect.y + srcY, row.data());
+					SumColumns(row.data(), columnStart.data(), dstWidth, boxSums.data());
+				}
+
+				AverageColumns(boxSums.data(), columnStart.data(), dstWidth, endSrcRow - firstSrcRow, dividers,
+					rgb48 ? row.data() : NULL, rgb48 ? NULL : dstRow);
+				if (rgb48)
+					memcpy(dstRow, rgb, dstWidth * 6);
+				continue;
+			}
+#endif
+			else
+			{
+				std::fill(sums.begin(), sums.end(), 0);
+
+				for (long srcY = firstSrcRow; srcY < endSrcRow; srcY++)
+				{
+					const uint16_t* src = row.data();
+
+					source.Read(srcRect.y + srcY, row.data());
+					for (long x = 0; x < dstWidth; x++)
+					{
+						uint64_t r = 0, g = 0, b = 0;
+						for (long srcX = columnStart[x]; srcX < columnStart[x + 1]; srcX++, src += 3)
+						{
+							r += src[0];
+							g += src[1];
+							b += src[2];
+						}
+						sums[x * 3] += r;
+						sums[x * 3 + 1] += g;
+						sums[x * 3 + 2] += b;
+					}
+				}
+
+				// Averages go back into the start of the row buffer, which is at least as wide
+				for (long x = 0; x < dstWidth; x++)
+				{
+					uint64_t count = (uint64_t)(columnStart[x + 1] - columnStart[x]) * (endSrcRow - firstSrcRow);
+					for (int c = 0; c < 3; c++)
+						row[x * 3 + c] = (uint16_t)((sums[x * 3 + c] + count / 2) / count);
+				}
+
+				if (dstPixelFormat == kPixelFormat16BitRGB)
+				{
+					memcpy(dstRow, rgb, dstWidth * 6);
+					continue;
+				}
+			}
+
+			// 16 -> 8 bits with rounding, into B, G, R, A byte order
+			for (long x = 0; x < dstWidth; x++, rgb += 3)
+			{
+				dstRow[x * 4] = (uint8_t)((rgb[2] * 255u + 32767u) / 65535u);
+				dstRow[x * 4 + 1] = (uint8_t)((rgb[1] * 255u + 32767u) / 65535u);
+				dstRow[x * 4 + 2] = (uint8_t)((rgb[0] * 255u + 32767u) / 65535u);
+				dstRow[x * 4 + 3] = 0xff;
+			}
+		}
+	});
+
+	return S_OK;
+}
+
+HRESULT PixelConverter::ConvertFrame(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame)
+{
+	Rect wholeFrame = { 0, 0, srcFrame->GetWidth(), srcFrame->GetHeight() };
+	return ConvertFrame(srcFrame, wholeFrame, dstFrame);
+}
+
+HRESULT PixelConverter::ConvertFrame(IDeckLinkVideoFrame* srcFrame, const Rect& srcRect, IDeckLinkVideoFrame* dstFrame,
+	Deinterlace deinterlace, BMDFieldDominance fieldDominance)
+{
+	void*				dstBytes = NULL;
+
+	dstFrame->GetBytes(&dstBytes);
+	return ConvertScaled(srcFrame, srcRect, dstFrame->GetPixelFormat(), dstFrame->GetWidth(), dstFrame->GetHeight(), dstBytes, dstFrame->GetRowBytes(),
+		deinterlace, fieldDominance);
+}
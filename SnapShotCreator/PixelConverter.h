@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include "DeckLinkAPI.h"
+
+// Conversion of native DeckLink pixel formats to 16 bits per channel RGB, row by row,
+// keeping the full precision of 10 and 12-bit sources
+namespace PixelConverter
+{
+	// Y'CbCr to R'G'B' matrix applied to YUV sources
+	enum Colorimetry
+	{
+		kColorimetryRec601 = 0,
+		kColorimetryRec709,
+	};
+
+	// Rec. 709 for HD and larger frames, Rec. 601 for SD
+	Colorimetry GetColorimetry(long height);
+
+	bool IsSupported(BMDPixelFormat pixelFormat);
+
+	// Deinterlacing applied to the unpacked rows of a conversion. The first field in time is the reference:
+	// the upper one, even rows, unless the field dominance is lower field first.
+	enum Deinterlace
+	{
+		kDeinterlaceNone = 0,
+		kDeinterlaceField,			// first field only, each of its rows doubled
+		kDeinterlaceBlend,			// every row blended 1:2:1 with the rows above and below
+		kDeinterlaceAdaptive,		// second field rows kept where they fit between their neighbours, clipped to them where they comb
+	};
+
+	// Progressive frames are never deinterlaced, nor frames of unknown field dominance
+	bool IsInterlaced(BMDFieldDominance fieldDominance);
+
+	// Unpack pixels [x, x + width) of one source row into interleaved 16-bit R, G, B at dst.
+	// x may fall inside a packing group (6 pixels for v210, 2 for 8-bit YUV, 8 for 12-bit RGB).
+	void UnpackRow(BMDPixelFormat pixelFormat, Colorimetry colorimetry, const uint8_t* row, long x, long width, uint16_t* dst);
+
+	// Native 10-bit Y'CbCr codes of pixels [x, x + width) of a v210 row, chroma repeated for both pixels of a pair.
+	// cb and cr may be NULL when only the luma is needed.
+	void UnpackV210Components(const uint8_t* row, long x, long width, uint16_t* luma, uint16_t* cb, uint16_t* cr);
+	// Native 10-bit Y code of pixel x of a v210 row
+	uint16_t GetV210Luma(const uint8_t* row, long x);
+
+	// Worker threads used per frame, rows are split evenly between them
+	void SetThreadCount(int threadCount);
+	int GetThreadCount(void);
+	void ParallelRows(long rows, const std::function<void(long firstRow, long endRow)>& work);
+
+	// Source rectangle in pixels
+	struct Rect
+	{
+		long		x;
+		long		y;
+		long		width;
+		long		height;
+	};
+
+	// Convert srcRect of a frame in any supported pixel format to dstWidth x dstHeight pixels at dst, rows dstRowBytes apart,
+	// in bmdFormat8BitBGRA or kPixelFormat16BitRGB. Only the rectangle is read, and a smaller destination is area averaged
+	// in the same pass, one source row at a time, so no full size intermediate is ever allocated.
+	// Deinterlacing reads the rows next to the rectangle too, and only applies if the field dominance is interlaced.
+	HRESULT ConvertScaled(IDeckLinkVideoFrame* srcFrame, const Rect& srcRect, BMDPixelFormat dstPixelFormat, long dstWidth, long dstHeight, void* dst, long dstRowBytes,
+		Deinterlace deinterlace = kDeinterlaceNone, BMDFieldDominance fieldDominance = bmdUnknownFieldDominance);
+
+	// Convert a whole frame, or srcRect of it, into a Bgra32VideoFrame or Rgb48VideoFrame, scaled down to the destination frame size
+	HRESULT ConvertFrame(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame);
+	HRESULT ConvertFrame(IDeckLinkVideoFrame* srcFrame, const Rect& srcRect, IDeckLinkVideoFrame* dstFrame,
+		Deinterlace deinterlace = kDeinterlaceNone, BMDFieldDominance fieldDominance = bmdUnknownFieldDominance);
+};
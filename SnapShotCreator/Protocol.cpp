@@ -0,0 +1,679 @@
+#include <json/json.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <charconv>
+#include <memory>
+#include <string_view>
+
+#include "Protocol.h"
+
+namespace
+{
+	const char			kHexDigits[] = "0123456789abcdef";
+	const std::string	kOkResponse = "{\"body\":null,\"response\":\"OK\"}";
+
+	// Code point of the UTF-8 sequence starting at value[i], advancing i to its last byte. Decodes like the
+	// jsoncpp writer did: truncated, overlong and surrogate sequences give U+FFFD, continuation bytes are not checked.
+	uint32_t DecodeUtf8(const std::string& value, size_t& i)
+	{
+		const uint32_t	kReplacement = 0xfffd;
+		uint32_t		first = (unsigned char)value[i];
+		size_t			left = value.size() - i;
+
+		if (first < 0xe0)
+		{
+			if (left < 2)
+				return kReplacement;
+			uint32_t codepoint = ((first & 0x1f) << 6) | ((unsigned char)value[i + 1] & 0x3f);
+			i += 1;
+			return (codepoint < 0x80) ? kReplacement : codepoint;
+		}
+		if (first < 0xf0)
+		{
+			if (left < 3)
+				return kReplacement;
+			uint32_t codepoint = ((first & 0x0f) << 12) | (((unsigned char)value[i + 1] & 0x3f) << 6) |
+				((unsigned char)value[i + 2] & 0x3f);
+			i += 2;
+			return ((codepoint < 0x800) || ((codepoint >= 0xd800) && (codepoint <= 0xdfff))) ? kReplacement : codepoint;
+		}
+		if (first < 0xf8)
+		{
+			if (left < 4)
+				return kReplacement;
+			uint32_t codepoint = ((first & 0x07) << 18) | (((unsigned char)value[i + 1] & 0x3f) << 12) |
+				(((unsigned char)value[i + 2] & 0x3f) << 6) | ((unsigned char)value[i + 3] & 0x3f);
+			i += 3;
+			return (codepoint < 0x10000) ? kReplacement : codepoint;
+		}
+		return kReplacement;
+	}
+
+	void AppendUnicodeEscape(std::string& out, uint32_t codeUnit)
+	{
+		out += "\\u";
+		out += kHexDigits[(codeUnit >> 12) & 0xf];
+		out += kHexDigits[(codeUnit >> 8) & 0xf];
+		out += kHexDigits[(codeUnit >> 4) & 0xf];
+		out += kHexDigits[codeUnit & 0xf];
+	}
+
+	// Single-pass scanner over a request body for the flat command schema.
+	// Every method returns false when the input leaves the shape it understands.
+	class RequestScanner
+	{
+	private:
+		const char*		m_pos;
+		const char*		m_end;
+
+	public:
+		RequestScanner(const std::string& body) : m_pos(body.data()), m_end(body.data() + body.size()) {};
+
+		void SkipWhitespace(void)
+		{
+			while (m_pos < m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r'))
+				m_pos++;
+		}
+
+		bool Consume(char c)
+		{
+			SkipWhitespace();
+			if (m_pos < m_end && *m_pos == c)
+			{
+				m_pos++;
+				return true;
+			}
+			return false;
+		}
+
+		bool AtEnd(void)
+		{
+			SkipWhitespace();
+			return m_pos == m_end;
+		}
+
+		bool PeekString(void)
+		{
+			SkipWhitespace();
+			return m_pos < m_end && *m_pos == '"';
+		}
+
+		// Read a string without escapes as a view into the body, or unescape it into scratch
+		bool ReadString(std::string_view& value, std::string& scratch)
+		{
+			if (!Consume('"'))
+				return false;
+
+			const char* start = m_pos;
+			while (m_pos < m_end && *m_pos != '"' && *m_pos != '\\')
+			{
+				if ((unsigned char)*m_pos < 0x20)
+					return false;
+				m_pos++;
+			}
+			if (m_pos < m_end && *m_pos == '"')
+			{
+				value = std::string_view(start, m_pos - start);
+				m_pos++;
+				return true;
+			}
+
+			scratch.assign(start, m_pos - start);
+			while (m_pos < m_end && *m_pos != '"')
+			{
+				char c = *m_pos++;
+				if ((unsigned char)c < 0x20)
+					return false;
+				if (c != '\\')
+				{
+					scratch += c;
+					continue;
+				}
+				if (m_pos == m_end)
+					return false;
+				switch (*m_pos++)
+				{
+					case '"':	scratch += '"'; break;
+					case '\\':	scratch += '\\'; break;
+					case '/':	scratch += '/'; break;
+					case 'b':	scratch += '\b'; break;
+					case 'f':	scratch += '\f'; break;
+					case 'n':	scratch += '\n'; break;
+					case 'r':	scratch += '\r'; break;
+					case 't':	scratch += '\t'; break;
+					default:	return false;	// unicode escapes are left to jsoncpp
+				}
+			}
+			if (m_pos == m_end)
+				return false;
+			m_pos++;
+			value = scratch;
+			return true;
+		}
+
+		// Read an integer in int range; fractions and exponents are left to jsoncpp
+		bool ReadInteger(int& value)
+		{
+			long long	result = 0;
+			bool		negative = false;
+
+			SkipWhitespace();
+			if (m_pos < m_end && *m_pos == '-')
+			{
+				negative = true;
+				m_pos++;
+			}
+
+			const char* start = m_pos;
+			while (m_pos < m_end && *m_pos >= '0' && *m_pos <= '9' && (m_pos - start) < 10)
+				result = result * 10 + (*m_pos++ - '0');
+
+			if (m_pos == start || (m_pos < m_end && strchr("0123456789.eE", *m_pos) != NULL && *m_pos != '\0'))
+				return false;
+
+			result = negative ? -result : result;
+			if (result < INT_MIN || result > INT_MAX)
+				return false;
+
+			value = (int)result;
+			return true;
+		}
+
+		// End of the JSON number at the current position, or NULL if it does not follow the JSON number grammar
+		// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, which rules out nan, inf and hexadecimal
+		const char* ScanNumber(void)
+		{
+			const char* p = m_pos;
+
+			if (p < m_end && *p == '-')
+				p++;
+			if (p == m_end || *p < '0' || *p > '9')
+				return NULL;
+			if (*p++ != '0')
+			{
+				while (p < m_end && *p >= '0' && *p <= '9')
+					p++;
+			}
+			if (p < m_end && *p == '.')
+			{
+				if (++p == m_end || *p < '0' || *p > '9')
+					return NULL;
+				while (p < m_end && *p >= '0' && *p <= '9')
+					p++;
+			}
+			if (p < m_end && (*p == 'e' || *p == 'E'))
+			{
+				if (++p < m_end && (*p == '+' || *p == '-'))
+					p++;
+				if (p == m_end || *p < '0' || *p > '9')
+					return NULL;
+				while (p < m_end && *p >= '0' && *p <= '9')
+					p++;
+			}
+			return p;
+		}
+
+		// Read a JSON number; out of range values are left to jsoncpp
+		bool ReadNumber(double& value)
+		{
+			SkipWhitespace();
+			const char* end = ScanNumber();
+			if (end == NULL)
+				return false;
+
+			std::from_chars_result result = std::from_chars(m_pos, end, value);
+			if (result.ec != std::errc() || result.ptr != end)
+				return false;
+			m_pos = end;
+			return true;
+		}
+
+		// Consume literal if it is next in the input
+		bool ConsumeLiteral(const char* literal)
+		{
+			size_t length = strlen(literal);
+			if (((size_t)(m_end - m_pos) < length) || (memcmp(m_pos, literal, length) != 0))
+				return false;
+			m_pos += length;
+			return true;
+		}
+
+		bool ReadBool(bool& value)
+		{
+			SkipWhitespace();
+			if (ConsumeLiteral("true"))
+			{
+				value = true;
+				return true;
+			}
+			if (ConsumeLiteral("false"))
+			{
+				value = false;
+				return true;
+			}
+			return false;
+		}
+
+		// Skip a number, true, false or null
+		bool SkipScalar(void)
+		{
+			SkipWhitespace();
+			if (ConsumeLiteral("true") || ConsumeLiteral("false") || ConsumeLiteral("null"))
+				return true;
+
+			const char* end = ScanNumber();
+			if (end == NULL)
+				return false;
+			m_pos = end;
+			return true;
+		}
+	};
+
+	// Read a string value into field, rejecting other value types
+	bool ReadStringField(RequestScanner& scanner, std::string& field, std::string& scratch)
+	{
+		std::string_view value;
+		if (!scanner.ReadString(value, scratch))
+			return false;
+		field.assign(value.data(), value.size());
+		return true;
+	}
+
+	// Read an integer value into field, rejecting other value types
+	bool ReadIntField(RequestScanner& scanner, int& field)
+	{
+		return scanner.ReadInteger(field);
+	}
+
+	// Integer field of a jsoncpp document, see CommandRequest
+	void GetIntField(const Json::Value& data, const char* key, int& field)
+	{
+		const Json::Value& value = data[key];
+		if (!value.isNull())
+			field = value.isInt() ? value.asInt() : 0;
+	}
+
+	// Number field of a jsoncpp document, see CommandRequest
+	void GetNumberField(const Json::Value& data, const char* key, double& field)
+	{
+		const Json::Value& value = data[key];
+		if (!value.isNull())
+			field = value.isNumeric() ? value.asDouble() : 0.0;
+	}
+
+	// Boolean field of a jsoncpp document, see CommandRequest
+	void GetBoolField(const Json::Value& data, const char* key, bool& field)
+	{
+		const Json::Value& value = data[key];
+		if (!value.isNull())
+			field = value.isBool() && value.asBool();
+	}
+
+	// Skip a value of an unknown key, accepting only strings and scalars
+	bool SkipValue(RequestScanner& scanner, std::string& scratch)
+	{
+		std::string_view value;
+		if (scanner.PeekString())
+			return scanner.ReadString(value, scratch);
+		return scanner.SkipScalar();
+	}
+
+	bool DecodeRegion(RequestScanner& scanner, Protocol::Region& region, std::string& scratch)
+	{
+		std::string_view key;
+
+		if (!scanner.Consume('{'))
+			return false;
+		if (scanner.Consume('}'))
+			return true;
+
+		do
+		{
+			if (!scanner.ReadString(key, scratch) || !scanner.Consume(':'))
+				return false;
+
+			bool ok;
+			if (key == "x")
+				ok = ReadIntField(scanner, region.x);
+			else if (key == "y")
+				ok = ReadIntField(scanner, region.y);
+			else if (key == "w")
+				ok = ReadIntField(scanner, region.width);
+			else if (key == "h")
+				ok = ReadIntField(scanner, region.height);
+			else
+				ok = SkipValue(scanner, scratch);
+
+			if (!ok)
+				return false;
+		} while (scanner.Consume(','));
+
+		return scanner.Consume('}');
+	}
+
+	// Region field of a jsoncpp document, see CommandRequest
+	void GetRegionField(const Json::Value& data, const char* key, Protocol::Region& field)
+	{
+		const Json::Value& value = data[key];
+		if (value.isNull())
+			return;
+
+		if (!value.isObject())
+		{
+			field.width = -1;
+			return;
+		}
+		GetIntField(value, "x", field.x);
+		GetIntField(value, "y", field.y);
+		GetIntField(value, "w", field.width);
+		GetIntField(value, "h", field.height);
+	}
+
+	// String field of a jsoncpp document, left unchanged if absent
+	void GetStringField(const Json::Value& data, const char* key, std::string& field)
+	{
+		field = data.get(key, field).asString();
+	}
+
+	// Output fields of a jsoncpp object, fields absent from data keep their value in output
+	void GetOutputFields(const Json::Value& data, Protocol::OutputRequest& output)
+	{
+		GetStringField(data, "output_directory", output.captureDirectory);
+		GetStringField(data, "filename_prefix", output.filenamePrefix);
+		GetStringField(data, "image_format", output.imageFormat);
+		GetIntField(data, "bit_depth", output.bitDepth);
+		GetNumberField(data, "scale", output.scale);
+		GetIntField(data, "max_width", output.maxWidth);
+		GetRegionField(data, "roi", output.roi);
+	}
+
+	bool DecodeData(RequestScanner& scanner, Protocol::CommandRequest& request, std::string& scratch)
+	{
+		std::string_view key;
+		std::string keyScratch;
+
+		if (!scanner.Consume('{'))
+			return false;
+		if (scanner.Consume('}'))
+			return true;
+
+		do
+		{
+			if (!scanner.ReadString(key, keyScratch) || !scanner.Consume(':'))
+				return false;
+
+			bool ok;
+			if (key == "output_directory")
+				ok = ReadStringField(scanner, request.captureDirectory, scratch);
+			else if (key == "filename_prefix")
+				ok = ReadStringField(scanner, request.filenamePrefix, scratch);
+			else if (key == "image_format")
+				ok = ReadStringField(scanner, request.imageFormat, scratch);
+			else if (key == "bit_depth")
+				ok = ReadIntField(scanner, request.bitDepth);
+			else if (key == "scale")
+				ok = scanner.ReadNumber(request.scale);
+			else if (key == "max_width")
+				ok = ReadIntField(scanner, request.maxWidth);
+			else if (key == "thumbnail")
+				ok = scanner.ReadBool(request.thumbnail);
+			else if (key == "roi")
+				ok = DecodeRegion(scanner, request.roi, scratch);
+			else if (key == "skip_if_unchanged")
+				ok = scanner.ReadBool(request.skipIfUnchanged);
+			else if (key == "change_threshold")
+				ok = ReadIntField(scanner, request.changeThreshold);
+			else if (key == "threshold")
+				ok = scanner.ReadNumber(request.triggerThreshold);
+			else if (key == "trigger_region")
+				ok = DecodeRegion(scanner, request.triggerRegion, scratch);
+			else if (key == "min_interval")
+				ok = scanner.ReadNumber(request.minInterval);
+			else if (key == "pre_trigger_frames")
+				ok = ReadIntField(scanner, request.preTriggerFrames);
+			else if (key == "histogram_bins")
+				ok = ReadIntField(scanner, request.histogramBins);
+			else if (key == "frames")
+				ok = ReadIntField(scanner, request.sheetFrames);
+			else if (key == "interval")
+				ok = scanner.ReadNumber(request.sheetInterval);
+			else if (key == "columns")
+				ok = ReadIntField(scanner, request.sheetColumns);
+			else if (key == "clip_format")
+				ok = ReadStringField(scanner, request.clipFormat, scratch);
+			else if (key == "duration")
+				ok = scanner.ReadNumber(request.clipDuration);
+			else if (key == "frame_count")
+				ok = ReadIntField(scanner, request.clipFrames);
+			else if (key == "frame_rate")
+				ok = scanner.ReadNumber(request.animationFrameRate);
+			else if (key == "accumulate")
+				ok = ReadIntField(scanner, request.accumulateFrames);
+			else if (key == "accumulate_mode")
+				ok = ReadStringField(scanner, request.accumulateMode, scratch);
+			else if (key == "deinterlace")
+				ok = ReadStringField(scanner, request.deinterlace, scratch);
+			else
+				ok = SkipValue(scanner, scratch);
+
+			if (!ok)
+				return false;
+		} while (scanner.Consume(','));
+
+		return scanner.Consume('}');
+	}
+}
+
+bool Protocol::ParseRequest(const std::string& body, CommandRequest& request)
+{
+	if (DecodeRequestFast(body, request))
+		return true;
+
+	request = CommandRequest();
+	return DecodeRequestJson(body, request);
+}
+
+bool Protocol::DecodeRequestFast(const std::string& body, CommandRequest& request)
+{
+	RequestScanner		scanner(body);
+	std::string_view	key;
+	std::string			keyScratch;
+	std::string			scratch;
+
+	if (!scanner.Consume('{'))
+		return false;
+
+	if (!scanner.Consume('}'))
+	{
+		do
+		{
+			if (!scanner.ReadString(key, keyScratch) || !scanner.Consume(':'))
+				return false;
+
+			bool ok;
+			if (key == "command")
+				ok = ReadStringField(scanner, request.command, scratch);
+			else if (key == "data")
+				ok = DecodeData(scanner, request, scratch);
+			else
+				ok = SkipValue(scanner, scratch);
+
+			if (!ok)
+				return false;
+		} while (scanner.Consume(','));
+
+		if (!scanner.Consume('}'))
+			return false;
+	}
+
+	return scanner.AtEnd();
+}
+
+bool Protocol::DecodeRequestJson(const std::string& body, CommandRequest& request)
+{
+	Json::Value 							root;
+	Json::CharReaderBuilder 				jsonBuilder;
+	const std::unique_ptr<Json::CharReader>	jsonReader(jsonBuilder.newCharReader());
+	std::string								err;
+
+	if (!jsonReader->parse(body.c_str(), body.c_str() + body.length(), &root, &err))
+	{
+		return false;
+	}
+
+	request.command = root["command"].asString();
+	GetOutputFields(root["data"], request);
+	GetBoolField(root["data"], "thumbnail", request.thumbnail);
+	GetBoolField(root["data"], "skip_if_unchanged", request.skipIfUnchanged);
+	GetIntField(root["data"], "change_threshold", request.changeThreshold);
+	GetNumberField(root["data"], "threshold", request.triggerThreshold);
+	GetRegionField(root["data"], "trigger_region", request.triggerRegion);
+	GetNumberField(root["data"], "min_interval", request.minInterval);
+	GetIntField(root["data"], "pre_trigger_frames", request.preTriggerFrames);
+	GetIntField(root["data"], "histogram_bins", request.histogramBins);
+	GetIntField(root["data"], "frames", request.sheetFrames);
+	GetNumberField(root["data"], "interval", request.sheetInterval);
+	GetIntField(root["data"], "columns", request.sheetColumns);
+	GetStringField(root["data"], "clip_format", request.clipFormat);
+	GetNumberField(root["data"], "duration", request.clipDuration);
+	GetIntField(root["data"], "frame_count", request.clipFrames);
+	GetNumberField(root["data"], "frame_rate", request.animationFrameRate);
+	GetIntField(root["data"], "accumulate", request.accumulateFrames);
+	GetStringField(root["data"], "accumulate_mode", request.accumulateMode);
+	GetStringField(root["data"], "deinterlace", request.deinterlace);
+
+	// Each entry of data.outputs starts from the fields given in data
+	const Json::Value& outputs = root["data"]["outputs"];
+	if (!outputs.isNull())
+	{
+		request.outputsValid = outputs.isArray();
+		for (Json::ArrayIndex i = 0; request.outputsValid && (i < outputs.size()); i++)
+		{
+			Protocol::OutputRequest output = request;
+			if (!outputs[i].isObject())
+			{
+				request.outputsValid = false;
+				break;
+			}
+			GetOutputFields(outputs[i], output);
+			request.outputs.push_back(output);
+		}
+	}
+	return true;
+}
+
+const std::string& Protocol::OkResponse()
+{
+	return kOkResponse;
+}
+
+std::string Protocol::MakeOkResponse(const std::string& filepath, const std::string& thumbnailFilepath)
+{
+	std::string response;
+
+	if (filepath.empty())
+		return kOkResponse;
+
+	response.reserve(72 + filepath.size() + thumbnailFilepath.size());
+	response += "{\"body\":{\"filepath\":";
+	AppendJsonString(response, filepath);
+	if (!thumbnailFilepath.empty())
+	{
+		response += ",\"thumbnail_filepath\":";
+		AppendJsonString(response, thumbnailFilepath);
+	}
+	response += "},\"response\":\"OK\"}";
+	return response;
+}
+
+std::string Protocol::MakeOkResponse(const std::vector<std::string>& filepaths)
+{
+	std::string response;
+
+	if (filepaths.empty())
+		return kOkResponse;
+
+	response.reserve(64 + filepaths.size() * (filepaths[0].size() + 3));
+	response += "{\"body\":{\"filepath\":";
+	AppendJsonString(response, filepaths[0]);
+	response += ",\"filepaths\":[";
+	for (size_t i = 0; i < filepaths.size(); i++)
+	{
+		if (i > 0)
+			response += ',';
+		AppendJsonString(response, filepaths[i]);
+	}
+	response += "]},\"response\":\"OK\"}";
+	return response;
+}
+
+std::string Protocol::MakeOkResponse(const Json::Value& body)
+{
+	Json::StreamWriterBuilder	jsonBuilder;
+
+	jsonBuilder["indentation"] = "";
+	jsonBuilder["precision"] = 6;
+	return "{\"body\":" + Json::writeString(jsonBuilder, body) + ",\"response\":\"OK\"}";
+}
+
+std::string Protocol::MakeErrorResponse(int errCode, const std::string& errMsg)
+{
+	std::string response;
+
+	response.reserve(64 + errMsg.size());
+	response += "{\"body\":{\"code\":";
+	response += std::to_string(errCode);
+	response += ",\"message\":";
+	AppendJsonString(response, errMsg);
+	response += "},\"response\":\"NG\"}";
+	return response;
+}
+
+void Protocol::AppendJsonString(std::string& out, const std::string& value)
+{
+	size_t runStart = 0;
+
+	out += '"';
+	for (size_t i = 0; i < value.size(); i++)
+	{
+		unsigned char c = (unsigned char)value[i];
+		if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+			continue;
+
+		// Copy the run of characters that need no escaping in one go
+		out.append(value, runStart, i - runStart);
+
+		// Non-ASCII is escaped as UTF-16, as jsoncpp does by default
+		if (c >= 0x80)
+		{
+			uint32_t codepoint = DecodeUtf8(value, i);
+			if (codepoint < 0x10000)
+				AppendUnicodeEscape(out, codepoint);
+			else
+			{
+				AppendUnicodeEscape(out, ((codepoint - 0x10000) >> 10) + 0xd800);
+				AppendUnicodeEscape(out, ((codepoint - 0x10000) & 0x3ff) + 0xdc00);
+			}
+			runStart = i + 1;
+			continue;
+		}
+		runStart = i + 1;
+
+		switch (c)
+		{
+			case '"':	out += "\\\""; break;
+			case '\\':	out += "\\\\"; break;
+			case '\b':	out += "\\b"; break;
+			case '\f':	out += "\\f"; break;
+			case '\n':	out += "\\n"; break;
+			case '\r':	out += "\\r"; break;
+			case '\t':	out += "\\t"; break;
+			default:
+				AppendUnicodeEscape(out, c);
+				break;
+		}
+	}
+	out.append(value, runStart, value.size() - runStart);
+	out += '"';
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Json
+{
+	class Value;
+}
+
+// Parsing and serialization of the JSON command protocol spoken over POST /
+namespace Protocol
+{
+	// Rectangle in pixels of the captured frame, empty (zero size) for the whole frame
+	struct Region
+	{
+		int				x = 0;
+		int				y = 0;
+		int				width = 0;
+		int				height = 0;
+	};
+
+	// Fields describing one image written from the captured frame
+	struct OutputRequest
+	{
+		std::string		captureDirectory;	// output_directory
+		std::string		filenamePrefix;		// filename_prefix
+		std::string		imageFormat;		// image_format
+		int				bitDepth = 8;		// bit_depth, bits per channel of the output image
+		double			scale = 1.0;		// scale, output size relative to the captured frame
+		int				maxWidth = 0;		// max_width, 0 for no limit
+		Region			roi;				// roi {"x", "y", "w", "h"}, a non-object value reads as width -1
+	};
+
+	// Fields of a command request, the output fields are read from data.
+	// Absent fields are left empty or at their default.
+	// Numeric fields present with a value of the wrong type are set to 0 so that validation rejects them,
+	// boolean fields read as false.
+	struct CommandRequest : OutputRequest
+	{
+		std::string					command;
+		bool						thumbnail = false;			// data.thumbnail, scale applies to an extra image instead of the main one
+		std::vector<OutputRequest>	outputs;					// data.outputs, entries default to the fields of data
+		bool						outputsValid = true;		// false if data.outputs is not an array of objects
+		bool						skipIfUnchanged = false;	// data.skip_if_unchanged, return the previous filepaths if the frame matches the last one
+		int							changeThreshold = 0;		// data.change_threshold, perceptual hash bits that must differ for a change, 0 for identical frames only
+		double						triggerThreshold = 0.25;	// data.threshold, share of changed blocks that fires a motion triggered capture
+		Region						triggerRegion;				// data.trigger_region {"x", "y", "w", "h"}, compared part of the frame
+		double						minInterval = 1.0;			// data.min_interval, seconds from one motion triggered capture to the next
+		int							preTriggerFrames = 0;		// data.pre_trigger_frames, frames before the triggering one written along with it
+		int							histogramBins = 256;		// data.histogram_bins, bins per channel of frame statistics, 0 for none
+		int							sheetFrames = 9;			// data.frames, frames on a contact sheet
+		double						sheetInterval = 1.0;		// data.interval, seconds between the frames of a contact sheet
+		int							sheetColumns = 0;			// data.columns, tiles per row of a contact sheet, 0 for a square grid
+		std::string					clipFormat = "y4m";			// data.clip_format, container of a recorded clip, "y4m" or "raw"
+		double						clipDuration = 0.0;			// data.duration, seconds of a recorded clip or an animated image, 0 for 2 s of animation
+		int							clipFrames = 0;				// data.frame_count, frames of a recorded clip, instead of duration
+		double						animationFrameRate = 10.0;	// data.frame_rate, frames per second of an animated image
+		int							accumulateFrames = 0;		// data.accumulate, consecutive frames combined into one snapshot, 0 or 1 for a single frame
+		std::string					accumulateMode = "mean";	// data.accumulate_mode, how accumulated frames are combined, "mean" or "median"
+		std::string					deinterlace = "none";		// data.deinterlace, "none", "field", "blend" or "adaptive", applied to interlaced display modes only
+	};
+
+	// Parse a request body. Returns false if the body is not valid JSON.
+	// Bodies matching the fixed command schema are decoded in a single pass without building a document:
+	// string, integer, number and boolean fields, roi and trigger_region objects, and unknown keys with string,
+	// number, true, false or null values. Anything else (data.outputs and other arrays or nested objects,
+	// unicode escapes, fields of an unexpected type, numbers out of range) falls back to jsoncpp.
+	bool ParseRequest(const std::string& body, CommandRequest& request);
+
+	// The two decoding paths of ParseRequest, exposed for benchmarking
+	bool DecodeRequestFast(const std::string& body, CommandRequest& request);
+	bool DecodeRequestJson(const std::string& body, CommandRequest& request);
+
+	// Compact responses, byte-compatible in content and key order with the former jsoncpp output,
+	// including its \u escapes of control characters and non-ASCII:
+	//   {"body":null,"response":"OK"}
+	//   {"body":{"filepath":"..."},"response":"OK"}
+	//   {"body":{"filepath":"...","thumbnail_filepath":"..."},"response":"OK"}
+	//   {"body":{"filepath":"...","filepaths":["...","..."]},"response":"OK"}
+	//   {"body":{"code":911,"message":"..."},"response":"NG"}
+	// The constant OK body, by reference so callers can copy it straight into the response
+	const std::string& OkResponse(void);
+	std::string MakeOkResponse(const std::string& filepath, const std::string& thumbnailFilepath = "");
+	std::string MakeOkResponse(const std::vector<std::string>& filepaths);
+	// {"body":{...},"response":"OK"} for bodies built as a jsoncpp document, such as statistics, numbers to 6 significant digits
+	std::string MakeOkResponse(const Json::Value& body);
+	std::string MakeErrorResponse(int errCode, const std::string& errMsg);
+
+	// Append value to out as a quoted JSON string, escaping UTF-8 beyond ASCII as UTF-16 \u escapes
+	void AppendJsonString(std::string& out, const std::string& value);
+};
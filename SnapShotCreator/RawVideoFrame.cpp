@@ -0,0 +1,111 @@
+#include "platform.h"
+#include "RawVideoFrame.h"
+
+/* RawVideoFrame class */
+
+// Constructor generates empty pixel buffer
+RawVideoFrame::RawVideoFrame(long width, long height, BMDPixelFormat pixelFormat, BMDFrameFlags flags) :
+	m_width(width), m_height(height), m_rowBytes(GetRowBytes(pixelFormat, width)), m_pixelFormat(pixelFormat), m_flags(flags), m_refCount(1)
+{
+	// Allocate pixel buffer
+	m_pixelBuffer.resize(m_rowBytes*m_height);
+}
+
+long RawVideoFrame::GetRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	// Row strides follow the pixel format descriptions in the DeckLink SDK manual
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return width * 2;
+
+		case bmdFormat10BitYUV:
+			return ((width + 47) / 48) * 128;
+
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:
+			return width * 4;
+
+		case bmdFormat10BitRGB:
+		case bmdFormat10BitRGBX:
+		case bmdFormat10BitRGBXLE:
+			return ((width + 63) / 64) * 256;
+
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:
+			return ((width + 7) / 8) * 36;
+
+		default:
+			return 0;
+	}
+}
+
+const char* RawVideoFrame::GetPixelFormatTag(BMDPixelFormat pixelFormat)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:		return "2vuy";
+		case bmdFormat10BitYUV:		return "v210";
+		case bmdFormat8BitARGB:		return "argb";
+		case bmdFormat8BitBGRA:		return "bgra";
+		case bmdFormat10BitRGB:		return "r210";
+		case bmdFormat12BitRGB:		return "R12B";
+		case bmdFormat12BitRGBLE:	return "R12L";
+		case bmdFormat10BitRGBX:	return "R10b";
+		case bmdFormat10BitRGBXLE:	return "R10l";
+		default:					return "unknown";
+	}
+}
+
+HRESULT RawVideoFrame::GetBytes(void **buffer)
+{
+	*buffer = (void*)m_pixelBuffer.data();
+	return S_OK;
+}
+
+HRESULT	STDMETHODCALLTYPE RawVideoFrame::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	HRESULT 		result = E_NOINTERFACE;
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	// Initialise the return result
+	*ppv = NULL;
+
+	// Obtain the IUnknown interface and compare it the provided REFIID
+	if (iid == IID_IUnknown)
+	{
+		*ppv = this;
+		AddRef();
+		result = S_OK;
+	}
+
+	else if (iid == IID_IDeckLinkVideoFrame)
+	{
+		*ppv = (IDeckLinkVideoFrame*)this;
+		AddRef();
+		result = S_OK;
+	}
+
+	return result;
+}
+
+ULONG STDMETHODCALLTYPE RawVideoFrame::AddRef(void)
+{
+	return m_refCount.fetch_add(1) + 1;
+}
+
+ULONG STDMETHODCALLTYPE RawVideoFrame::Release(void)
+{
+	ULONG		newRefValue;
+
+	newRefValue = m_refCount.fetch_sub(1) - 1;
+	if (newRefValue == 0)
+	{
+		delete this;
+		return 0;
+	}
+
+	return newRefValue;
+}
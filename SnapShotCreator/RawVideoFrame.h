@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Video frame owning a buffer in any native DeckLink pixel format.
+// Used to feed recorded or synthesised frames through the same conversion and encoding paths as captured frames.
+class RawVideoFrame : public IDeckLinkVideoFrame
+{
+private:
+	long					m_width;
+	long					m_height;
+	long					m_rowBytes;
+	BMDPixelFormat			m_pixelFormat;
+	BMDFrameFlags			m_flags;
+	std::vector<uint8_t>	m_pixelBuffer;
+
+	std::atomic<uint32_t>	m_refCount;
+
+public:
+	RawVideoFrame(long width, long height, BMDPixelFormat pixelFormat, BMDFrameFlags flags);
+	virtual ~RawVideoFrame() {};
+
+	// Row stride in bytes as laid out by DeckLink for the given pixel format, or 0 if unknown
+	static long				GetRowBytes(BMDPixelFormat pixelFormat, long width);
+	// Short tag such as "v210" naming the pixel format in filenames and metadata, or "unknown"
+	static const char*		GetPixelFormatTag(BMDPixelFormat pixelFormat);
+
+	size_t					GetBufferSize(void) const	{ return m_pixelBuffer.size(); };
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void)			{ return m_width; };
+	virtual long			STDMETHODCALLTYPE	GetHeight(void)			{ return m_height; };
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void)		{ return m_rowBytes; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer);
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void)			{ return m_flags; };
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void)	{ return m_pixelFormat; };
+
+	// Dummy implementations of remaining methods in IDeckLinkVideoFrame
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode) { return E_NOTIMPL;	};
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG			STDMETHODCALLTYPE	AddRef();
+	virtual ULONG			STDMETHODCALLTYPE	Release();
+};
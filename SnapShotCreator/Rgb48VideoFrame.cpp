@@ -0,0 +1,65 @@
+#include "platform.h"
+#include "Rgb48VideoFrame.h"
+
+/* Rgb48VideoFrame class */
+
+// Constructor generates empty pixel buffer
+Rgb48VideoFrame::Rgb48VideoFrame(long width, long height, BMDFrameFlags flags) :
+	m_width(width), m_height(height), m_flags(flags), m_refCount(1)
+{
+	// Allocate pixel buffer
+	m_pixelBuffer.resize(m_width*m_height*3);
+}
+
+HRESULT Rgb48VideoFrame::GetBytes(void **buffer)
+{
+	*buffer = (void*)m_pixelBuffer.data();
+	return S_OK;
+}
+
+HRESULT	STDMETHODCALLTYPE Rgb48VideoFrame::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	HRESULT 		result = E_NOINTERFACE;
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	// Initialise the return result
+	*ppv = NULL;
+
+	// Obtain the IUnknown interface and compare it the provided REFIID
+	if (iid == IID_IUnknown)
+	{
+		*ppv = this;
+		AddRef();
+		result = S_OK;
+	}
+
+	else if (iid == IID_IDeckLinkVideoFrame)
+	{
+		*ppv = (IDeckLinkVideoFrame*)this;
+		AddRef();
+		result = S_OK;
+	}
+
+	return result;
+}
+
+ULONG STDMETHODCALLTYPE Rgb48VideoFrame::AddRef(void)
+{
+	return m_refCount.fetch_add(1) + 1;
+}
+
+ULONG STDMETHODCALLTYPE Rgb48VideoFrame::Release(void)
+{
+	ULONG		newRefValue;
+
+	newRefValue = m_refCount.fetch_sub(1) - 1;
+	if (newRefValue == 0)
+	{
+		delete this;
+		return 0;
+	}
+
+	return newRefValue;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Not a DeckLink pixel format: 16 bits per channel R, G, B, as produced by PixelConverter for high bit depth output
+const BMDPixelFormat kPixelFormat16BitRGB = (BMDPixelFormat)0x52423438;	// 'RB48'
+
+// Video frame of interleaved 16-bit R, G, B samples in native byte order (WIC 48bppRGB)
+class Rgb48VideoFrame : public IDeckLinkVideoFrame
+{
+private:
+	long					m_width;
+	long					m_height;
+	BMDFrameFlags			m_flags;
+	std::vector<uint16_t>	m_pixelBuffer;
+
+	std::atomic<uint32_t>	m_refCount;
+
+public:
+	Rgb48VideoFrame(long width, long height, BMDFrameFlags flags);
+	virtual ~Rgb48VideoFrame() {};
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void)			{ return m_width; };
+	virtual long			STDMETHODCALLTYPE	GetHeight(void)			{ return m_height; };
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void)		{ return m_width * 6; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer);
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void)			{ return m_flags; };
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void)	{ return kPixelFormat16BitRGB; };
+
+	// Dummy implementations of remaining methods in IDeckLinkVideoFrame
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode) { return E_NOTIMPL;	};
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG			STDMETHODCALLTYPE	AddRef();
+	virtual ULONG			STDMETHODCALLTYPE	Release();
+};
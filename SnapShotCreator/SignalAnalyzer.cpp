@@ -0,0 +1,510 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SIGNALANALYZER_SSE2
+#endif
+
+#include "include/spdlog/spdlog.h"
+#include "platform.h"
+#include "utils.h"
+#include "PixelConverter.h"
+#include "SignalAnalyzer.h"
+
+namespace
+{
+	// Rows read per analyzed frame, evenly spaced over the frame
+	const long		kSampleRows = 64;
+
+	// Column blocks per sampled row whose mean luma is compared between frames
+	const long		kProfileColumns = 32;
+
+	const size_t	kMaxTransitions = 32;
+
+	// Luma of the sampled rows of a frame, as fractions of full range
+	struct LumaSample
+	{
+		double				mean;
+		double				deviation;
+		std::vector<float>	profile;	// kProfileColumns block means per sampled row
+	};
+
+	// Sums of the luma of one block of a row, in the code values of the pixel format
+	struct LumaSums
+	{
+		uint64_t	sum;
+		uint64_t	sumSquares;
+	};
+
+	std::atomic<bool>					g_running{ false };
+
+	// Analysis state, only touched by the capture callback thread while running
+	uint64_t							g_frameCount = 0;
+	std::vector<float>					g_previousProfile;
+	bool								g_still = false;
+	std::chrono::steady_clock::time_point	g_stillSince;
+	SignalAnalyzer::State				g_candidateState = SignalAnalyzer::kStateUnknown;
+	int									g_candidateCount = 0;
+
+	// Reported state and snapshot worker, guarded by g_mutex
+	std::mutex							g_mutex;
+	SignalAnalyzer::Options				g_options;
+	SignalAnalyzer::Stats				g_stats;
+	std::deque<SignalAnalyzer::Transition>	g_transitions;
+	uint64_t							g_transitionCount = 0;		// transitions since Start, the last is g_transitions.back()
+	SignalAnalyzer::SnapshotHandler		g_snapshotHandler;
+	std::thread							g_snapshotThread;
+	std::condition_variable				g_snapshotCondition;		// signalled when a frame is handed over or stop is requested
+	IDeckLinkVideoFrame*				g_snapshotFrame = NULL;		// frame waiting for or being written by the worker
+	SignalAnalyzer::Transition			g_snapshotTransition;
+	time_t								g_snapshotTime = 0;			// wall-clock arrival time of g_snapshotFrame
+	uint64_t							g_snapshotTransitionNumber = 0;
+	bool								g_stopSnapshots = false;
+
+	// 8-bit Y code values of pixels [x, endX) of a 2vuy row, read straight from the packed bytes
+	LumaSums SumLuma2vuy(const uint8_t* row, long x, long endX)
+	{
+		const uint8_t*	p = row + 2 * x;
+		long			count = endX - x;
+		long			i = 0;
+		LumaSums		sums = { 0, 0 };
+
+#ifdef SIGNALANALYZER_SSE2
+		// Cb Y Cr Y: the high byte of every 16-bit lane is a Y sample
+		__m128i		sum = _mm_setzero_si128();
+		__m128i		sumSquares = _mm_setzero_si128();
+
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i luma = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(p + 2 * i)), 8);
+			__m128i squares = _mm_madd_epi16(luma, luma);
+
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(luma, _mm_setzero_si128()));
+			sumSquares = _mm_add_epi64(sumSquares, _mm_unpacklo_epi32(squares, _mm_setzero_si128()));
+			sumSquares = _mm_add_epi64(sumSquares, _mm_unpackhi_epi32(squares, _mm_setzero_si128()));
+		}
+
+		uint64_t lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, sum);
+		sums.sum = lanes[0] + lanes[1];
+		_mm_storeu_si128((__m128i*)lanes, sumSquares);
+		sums.sumSquares = lanes[0] + lanes[1];
+#endif
+
+		for (; i < count; i++)
+		{
+			uint32_t luma = p[2 * i + 1];
+			sums.sum += luma;
+			sums.sumSquares += luma * luma;
+		}
+
+		return sums;
+	}
+
+	// 10-bit Y code values of pixels [x, endX) of a v210 row, 6 pixels per 4 words
+	LumaSums SumLumaV210(const uint8_t* row, long x, long endX)
+	{
+		LumaSums sums = { 0, 0 };
+
+#ifdef SIGNALANALYZER_SSE2
+		// Pixels up to the first whole group one at a time, below
+		for (; (x < endX) && (x % 6 != 0); x++)
+		{
+			uint64_t luma = PixelConverter::GetV210Luma(row, x);
+			sums.sum += luma;
+			sums.sumSquares += luma * luma;
+		}
+
+		// One group per vector: Y0 and Y3 are bits 10-19 of words 0 and 2, Y1 and Y4 bits 0-9 and Y2 and Y5 bits 20-29 of words 1 and 3
+		const __m128i	evenWords = _mm_set_epi32(0, 0x3ff, 0, 0x3ff);
+		const __m128i	oddWords = _mm_set_epi32(0x3ff, 0, 0x3ff, 0);
+		__m128i			sum = _mm_setzero_si128();
+		__m128i			sumSquares = _mm_setzero_si128();
+
+		for (; x + 6 <= endX; x += 6)
+		{
+			__m128i group = _mm_loadu_si128((const __m128i*)(row + (x / 6) * 16));
+			__m128i middle = _mm_and_si128(_mm_srli_epi32(group, 10), evenWords);
+			__m128i low = _mm_and_si128(group, oddWords);
+			__m128i high = _mm_and_si128(_mm_srli_epi32(group, 20), oddWords);
+
+			// Every lane holds at most 10 bits, so madd squares it in place
+			__m128i squares = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(middle, middle), _mm_madd_epi16(low, low)), _mm_madd_epi16(high, high));
+
+			sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_add_epi32(middle, low), high));
+			sumSquares = _mm_add_epi64(sumSquares, _mm_unpacklo_epi32(squares, _mm_setzero_si128()));
+			sumSquares = _mm_add_epi64(sumSquares, _mm_unpackhi_epi32(squares, _mm_setzero_si128()));
+		}
+
+		// Lanes of sum gain at most 3 * 1023 per group, far from overflowing across one row
+		uint32_t lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, sum);
+		sums.sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+		uint64_t squareLanes[2];
+		_mm_storeu_si128((__m128i*)squareLanes, sumSquares);
+		sums.sumSquares += squareLanes[0] + squareLanes[1];
+#endif
+
+		for (; x < endX; x++)
+		{
+			uint64_t luma = PixelConverter::GetV210Luma(row, x);
+			sums.sum += luma;
+			sums.sumSquares += luma * luma;
+		}
+
+		return sums;
+	}
+
+	// 16-bit full range luma of pixels [x, endX) of a row unpacked to 16-bit RGB, which is padded by one value
+	// so that the last pixel can be read as four
+	LumaSums SumLumaRgb48(const uint16_t* rgb, long x, long endX)
+	{
+		LumaSums sums = { 0, 0 };
+
+		rgb += x * 3;
+
+#ifdef SIGNALANALYZER_SSE2
+		// Two pixels per vector as R G B and the next R, the fourth weighed 0. madd is signed, so the values are
+		// offset by -32768, which takes 32768 * (77 + 150 + 29) off every weighted sum, added back before the shift.
+		const __m128i	offset = _mm_set1_epi16((short)0x8000);
+		const __m128i	weights = _mm_set_epi16(0, 29, 150, 77, 0, 29, 150, 77);
+		const __m128i	restore = _mm_set1_epi32(32768 * 256);
+		__m128i			sum = _mm_setzero_si128();
+		__m128i			sumSquares = _mm_setzero_si128();
+
+		for (; x + 4 <= endX; x += 4, rgb += 12)
+		{
+			__m128i pixels01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)rgb), _mm_loadl_epi64((const __m128i*)(rgb + 3)));
+			__m128i pixels23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(rgb + 6)), _mm_loadl_epi64((const __m128i*)(rgb + 9)));
+			__m128 weighted01 = _mm_castsi128_ps(_mm_madd_epi16(_mm_xor_si128(pixels01, offset), weights));
+			__m128 weighted23 = _mm_castsi128_ps(_mm_madd_epi16(_mm_xor_si128(pixels23, offset), weights));
+
+			// R + G of the four pixels plus their B
+			__m128i weighted = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(weighted01, weighted23, _MM_SHUFFLE(2, 0, 2, 0))),
+				_mm_castps_si128(_mm_shuffle_ps(weighted01, weighted23, _MM_SHUFFLE(3, 1, 3, 1))));
+			__m128i luma = _mm_srli_epi32(_mm_add_epi32(weighted, restore), 8);
+
+			sum = _mm_add_epi32(sum, luma);
+			sumSquares = _mm_add_epi64(sumSquares, _mm_mul_epu32(luma, luma));
+			sumSquares = _mm_add_epi64(sumSquares, _mm_mul_epu32(_mm_srli_epi64(luma, 32), _mm_srli_epi64(luma, 32)));
+		}
+
+		// Lanes of sum gain at most 65535 per 4 pixels, far from overflowing across one row
+		uint32_t lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, sum);
+		sums.sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+		uint64_t squareLanes[2];
+		_mm_storeu_si128((__m128i*)squareLanes, sumSquares);
+		sums.sumSquares += squareLanes[0] + squareLanes[1];
+#endif
+
+		for (; x < endX; x++, rgb += 3)
+		{
+			uint64_t luma = (77 * (uint32_t)rgb[0] + 150 * (uint32_t)rgb[1] + 29 * (uint32_t)rgb[2]) >> 8;
+			sums.sum += luma;
+			sums.sumSquares += luma * luma;
+		}
+
+		return sums;
+	}
+
+	// Returns false for pixel formats that cannot be read
+	bool MeasureLuma(IDeckLinkVideoFrame* videoFrame, LumaSample& sample)
+	{
+		void*				bytes = NULL;
+		long				width = videoFrame->GetWidth();
+		long				height = videoFrame->GetHeight();
+		long				rowBytes = videoFrame->GetRowBytes();
+		BMDPixelFormat		pixelFormat = videoFrame->GetPixelFormat();
+		bool				is2vuy = (pixelFormat == bmdFormat8BitYUV);
+		bool				isV210 = (pixelFormat == bmdFormat10BitYUV);
+
+		videoFrame->GetBytes(&bytes);
+		if ((bytes == NULL) || (width <= 0) || (height <= 0) || !PixelConverter::IsSupported(pixelFormat))
+			return false;
+
+		// Studio range Y codes read straight from YUV formats, 16-bit luma of RGB formats, which UnpackRow
+		// returns at full range with the video levels of r210, R10b and R10l expanded so black is code 0
+		double				blackCode = is2vuy ? 16.0 : isV210 ? 64.0 : 0.0;
+		double				codeRange = is2vuy ? 219.0 : isV210 ? 876.0 : 65535.0;
+		long				sampleRows = (std::min)(kSampleRows, height);
+		long				profileColumns = (std::min)(kProfileColumns, width);
+		long				columnStart[kProfileColumns + 1];
+		std::vector<uint16_t>	rgb((is2vuy || isV210) ? 0 : width * 3 + 1);
+		uint64_t			sum = 0;
+		uint64_t			sumSquares = 0;
+
+		for (long column = 0; column <= profileColumns; column++)
+			columnStart[column] = column * width / profileColumns;
+
+		sample.profile.resize(sampleRows * profileColumns);
+
+		for (long sampleRow = 0; sampleRow < sampleRows; sampleRow++)
+		{
+			long			y = (2 * sampleRow + 1) * height / (2 * sampleRows);
+			const uint8_t*	row = (const uint8_t*)bytes + (size_t)y * rowBytes;
+
+			if (!rgb.empty())
+				PixelConverter::UnpackRow(pixelFormat, PixelConverter::GetColorimetry(height), row, 0, width, rgb.data());
+
+			for (long column = 0; column < profileColumns; column++)
+			{
+				LumaSums blockSums = is2vuy ? SumLuma2vuy(row, columnStart[column], columnStart[column + 1]) :
+					isV210 ? SumLumaV210(row, columnStart[column], columnStart[column + 1]) :
+					SumLumaRgb48(rgb.data(), columnStart[column], columnStart[column + 1]);
+				long blockWidth = columnStart[column + 1] - columnStart[column];
+
+				sample.profile[sampleRow * profileColumns + column] = (float)(((double)blockSums.sum / blockWidth - blackCode) / codeRange);
+				sum += blockSums.sum;
+				sumSquares += blockSums.sumSquares;
+			}
+		}
+
+		double count = (double)sampleRows * width;
+		double meanCode = sum / count;
+		sample.mean = (meanCode - blackCode) / codeRange;
+		sample.deviation = sqrt((std::max)(0.0, sumSquares / count - meanCode * meanCode)) / codeRange;
+		return true;
+	}
+
+	// Mean absolute difference of two profiles, 1 if they are not comparable
+	double GetDifference(const std::vector<float>& profile, const std::vector<float>& previousProfile)
+	{
+		double difference = 0.0;
+
+		if (profile.empty() || (profile.size() != previousProfile.size()))
+			return 1.0;
+
+		for (size_t i = 0; i < profile.size(); i++)
+			difference += fabs(profile[i] - previousProfile[i]);
+
+		return difference / profile.size();
+	}
+
+	void SnapshotWorker()
+	{
+		std::unique_lock<std::mutex> lock(g_mutex);
+
+		while (true)
+		{
+			g_snapshotCondition.wait(lock, [] { return (g_snapshotFrame != NULL) || g_stopSnapshots; });
+			if (g_stopSnapshots)
+				break;
+
+			IDeckLinkVideoFrame*		videoFrame = g_snapshotFrame;
+			SignalAnalyzer::Transition	transition = g_snapshotTransition;
+			time_t						captureTime = g_snapshotTime;
+			uint64_t					transitionNumber = g_snapshotTransitionNumber;
+			std::string					filepath;
+
+			lock.unlock();
+			try
+			{
+				filepath = g_snapshotHandler(transition.from, transition.to, videoFrame, captureTime);
+			}
+			catch (const std::exception& ex)
+			{
+				spdlog::error("Snapshot on signal transition failed: {}", ex.what());
+			}
+			lock.lock();
+
+			// The transition may have dropped out of the history meanwhile
+			uint64_t age = g_transitionCount - transitionNumber;
+			if (age < g_transitions.size())
+				g_transitions[g_transitions.size() - 1 - (size_t)age].filepath = filepath;
+
+			// New transitions get a snapshot again from here on
+			g_snapshotFrame->Release();
+			g_snapshotFrame = NULL;
+		}
+	}
+}
+
+const char* SignalAnalyzer::GetStateName(State state)
+{
+	switch (state)
+	{
+		case kStateNoSignal:	return "no_signal";
+		case kStateBlack:		return "black";
+		case kStateFrozen:		return "frozen";
+		case kStateOk:			return "ok";
+		default:				return "unknown";
+	}
+}
+
+void SignalAnalyzer::Start(const Options& options, const SnapshotHandler& snapshotHandler)
+{
+	Stop();
+
+	// Nothing else touches the analysis state until g_running is set
+	g_frameCount = 0;
+	g_previousProfile.clear();
+	g_still = false;
+	g_candidateState = kStateUnknown;
+	g_candidateCount = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		g_options = options;
+		g_options.interval = (std::max)(1, options.interval);
+		g_stats = Stats();
+		g_stats.state = kStateUnknown;
+		g_stats.since = CurrentDateTime("%Y-%m-%dT%H:%M:%S");
+		g_transitions.clear();
+		g_transitionCount = 0;
+		g_snapshotHandler = snapshotHandler;
+		g_stopSnapshots = false;
+	}
+
+	if (snapshotHandler)
+		g_snapshotThread = std::thread(SnapshotWorker);
+
+	g_running.store(true, std::memory_order_release);
+	spdlog::info("Signal analysis started, every {} frames", g_options.interval);
+}
+
+void SignalAnalyzer::Stop()
+{
+	if (!g_running.exchange(false))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		g_stopSnapshots = true;
+	}
+	g_snapshotCondition.notify_one();
+
+	if (g_snapshotThread.joinable())
+		g_snapshotThread.join();
+
+	std::lock_guard<std::mutex> lock(g_mutex);
+	if (g_snapshotFrame != NULL)
+	{
+		g_snapshotFrame->Release();
+		g_snapshotFrame = NULL;
+	}
+	g_snapshotHandler = nullptr;
+}
+
+bool SignalAnalyzer::IsRunning()
+{
+	return g_running.load();
+}
+
+void SignalAnalyzer::FrameArrived(IDeckLinkVideoFrame* videoFrame, bool inputValid)
+{
+	if (!g_running.load(std::memory_order_acquire) || ((g_frameCount++ % g_options.interval) != 0))
+		return;
+
+	State			measured;
+	LumaSample		sample = {};
+	double			difference = 0.0;
+
+	if (!inputValid)
+	{
+		// The frame holds no picture, start over once the signal is back
+		measured = kStateNoSignal;
+		g_previousProfile.clear();
+		g_still = false;
+	}
+	else if (!MeasureLuma(videoFrame, sample))
+	{
+		return;
+	}
+	else
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		difference = GetDifference(sample.profile, g_previousProfile);
+		g_previousProfile.swap(sample.profile);
+
+		if (difference >= g_options.frozenDifference)
+		{
+			g_still = false;
+		}
+		else if (!g_still)
+		{
+			g_still = true;
+			g_stillSince = now;
+		}
+
+		// A black picture does not move either, black takes precedence
+		if ((sample.mean <= g_options.blackLevel) && (sample.deviation <= g_options.blackDeviation))
+			measured = kStateBlack;
+		else if (g_still && (now - g_stillSince >= std::chrono::duration<double>(g_options.frozenSeconds)))
+			measured = kStateFrozen;
+		else
+			measured = kStateOk;
+	}
+
+	std::lock_guard<std::mutex> lock(g_mutex);
+
+	g_stats.analyzedFrames++;
+	if (inputValid)
+	{
+		g_stats.lumaMean = sample.mean;
+		g_stats.lumaDeviation = sample.deviation;
+		g_stats.difference = difference;
+	}
+
+	if (measured == g_stats.state)
+	{
+		g_candidateCount = 0;
+		return;
+	}
+
+	// A new state is reported once it persists, so that single odd frames do not flap the state
+	if (measured != g_candidateState)
+	{
+		g_candidateState = measured;
+		g_candidateCount = 0;
+	}
+	if ((++g_candidateCount < g_options.confirmCount) && (measured != kStateNoSignal))
+		return;
+
+	time_t arrivalTime = time(NULL);
+	Transition transition = { g_stats.state, measured, FormatDateTime(arrivalTime, "%Y-%m-%dT%H:%M:%S"), "" };
+	if (measured == kStateOk)
+		spdlog::info("Input signal changed from {} to {}", GetStateName(transition.from), GetStateName(transition.to));
+	else
+		spdlog::warn("Input signal changed from {} to {}", GetStateName(transition.from), GetStateName(transition.to));
+
+	g_stats.state = measured;
+	g_stats.since = transition.time;
+	g_candidateCount = 0;
+
+	g_transitions.push_back(transition);
+	if (g_transitions.size() > kMaxTransitions)
+		g_transitions.pop_front();
+	g_transitionCount++;
+
+	// Hand the frame to the snapshot worker unless it is busy, there is no picture or the analysis just started
+	if (g_snapshotHandler && (measured != kStateNoSignal) && (transition.from != kStateUnknown) && (g_snapshotFrame == NULL))
+	{
+		videoFrame->AddRef();
+		g_snapshotFrame = videoFrame;
+		g_snapshotTransition = transition;
+		g_snapshotTime = arrivalTime;
+		g_snapshotTransitionNumber = g_transitionCount;
+		g_snapshotCondition.notify_one();
+	}
+}
+
+SignalAnalyzer::Stats SignalAnalyzer::GetStats()
+{
+	std::lock_guard<std::mutex> lock(g_mutex);
+	Stats stats = g_stats;
+
+	stats.running = g_running.load();
+	stats.transitions.assign(g_transitions.begin(), g_transitions.end());
+	return stats;
+}
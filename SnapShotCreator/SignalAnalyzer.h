@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Classification of the live input as missing, black, frozen or ok. Frames are analyzed on the capture
+// callback thread, so only a sample of the rows of every Nth frame is read.
+namespace SignalAnalyzer
+{
+	enum State
+	{
+		kStateUnknown = 0,
+		kStateNoSignal,
+		kStateBlack,
+		kStateFrozen,
+		kStateOk,
+	};
+
+	const char* GetStateName(State state);
+
+	struct Options
+	{
+		int				interval = 10;				// analyze every Nth frame
+		double			blackLevel = 0.06;			// mean luma, as a fraction of full range, at or below which a frame can be black
+		double			blackDeviation = 0.02;		// luma standard deviation at or below which a frame can be black
+		double			frozenDifference = 0.002;	// mean absolute luma difference to the last analyzed frame below which nothing moved
+		double			frozenSeconds = 2.0;		// time without movement before the input counts as frozen
+		int				confirmCount = 3;			// consecutive analyses a new state needs before it is reported, no signal is immediate
+	};
+
+	struct Transition
+	{
+		State			from;
+		State			to;
+		std::string		time;		// local time, ISO 8601
+		std::string		filepath;	// snapshot written on the transition, empty if none
+	};
+
+	struct Stats
+	{
+		bool					running;
+		State					state;
+		std::string				since;			// time of the last transition
+		uint64_t				analyzedFrames;
+		double					lumaMean;		// of the last analyzed frame, as a fraction of full range
+		double					lumaDeviation;
+		double					difference;		// mean absolute luma difference to the analyzed frame before
+		std::vector<Transition>	transitions;	// most recent last
+	};
+
+	// Writes a snapshot of the frame that caused a transition, which arrived at captureTime, returns its filepath or an empty string
+	typedef std::function<std::string(State from, State to, IDeckLinkVideoFrame* videoFrame, time_t captureTime)> SnapshotHandler;
+
+	// snapshotHandler may be empty. It is called on a worker thread, for transitions to a state with a picture,
+	// and transitions arriving while it is busy get no snapshot.
+	void Start(const Options& options, const SnapshotHandler& snapshotHandler);
+	void Stop(void);
+	bool IsRunning(void);
+
+	// Called by the input callback for every frame, valid or not
+	void FrameArrived(IDeckLinkVideoFrame* videoFrame, bool inputValid);
+
+	Stats GetStats(void);
+};
@@ -10,17 +10,53 @@
 #include <vector>
 
 #include "include/spdlog/spdlog.h"
+#include "include/spdlog/async.h"
 #include "include/spdlog/sinks/basic_file_sink.h"
+#include "include/spdlog/sinks/daily_file_sink.h"
+#include "include/spdlog/sinks/rotating_file_sink.h"
 #include "utils.h"
 #include "exceptions.h"
 #include "platform.h"
 #include "ImageWriter.h"
 #include "CaptureStills.h"
+#include "Protocol.h"
+#include "LogMaintenance.h"
+#include "FileWriter.h"
+#include "PixelConverter.h"
+#include "SignalAnalyzer.h"
+#include "MotionTrigger.h"
+#include "RawVideoFrame.h"
+#include "ClipRecorder.h"
+#include "FrameAccumulator.h"
 
 
 const std::string						R_OK = "OK";
 const std::string						R_NG = "NG";
 
+// Interval of log directory housekeeping (pruning and compression of old log files)
+const std::chrono::seconds				kLogMaintenanceInterval{60};
+
+// Images one CREATE_SNAPSHOT request may write, each output is encoded on its own thread
+const size_t							kMaxOutputs = 8;
+
+// Frames one CREATE_CONTACT_SHEET request may sample, and the longest interval between them in seconds
+const int								kMaxContactSheetFrames = 64;
+const double							kMaxContactSheetInterval = 60.0;
+
+// Longest animated image and highest frame rate of one, its frames are all kept until they are encoded
+const double							kMaxAnimationDuration = 10.0;
+const double							kMaxAnimationFrameRate = 30.0;
+
+// Longest clip one RECORD_CLIP request may record, in seconds or frames (five minutes at 60 fps)
+const double							kMaxClipDuration = 300.0;
+const int								kMaxClipFrames = 18000;
+
+// Consecutive frames one CREATE_SNAPSHOT request may accumulate, the 8-bit mean sums them in 16 bits
+const int								kMaxAccumulateFrames = 256;
+
+// Frames before the triggering one a motion triggered capture may write, each is kept as a copy of the frame
+const int								kMaxPreTriggerFrames = 8;
+
 enum ServerStatus{
 	INITIALIZATION_ERROR = -1,
 	INITIALIZING = 0,
@@ -52,6 +88,42 @@ std::string dump_headers(const httplib::Headers &headers) {
 	return s;
 }
 
+// Textual bodies longer than this are truncated in the debug log
+const size_t							kMaxLoggedBodyBytes = 2048;
+
+uint64_t fnv1a_hash(const std::string &data) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : data) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+void dump_body(std::string &s, const std::string &body, const std::string &contentType) {
+	char buf[BUFSIZ];
+	bool isText = contentType.empty() || contentType.find("json") != std::string::npos || contentType.compare(0, 5, "text/") == 0;
+
+	if (body.empty()) {
+		return;
+	}
+
+	if (!isText) {
+		// Image or stream payloads: log size and a fingerprint instead of the bytes
+		snprintf(buf, sizeof(buf), "<%zu bytes %s, fnv1a=%016llx>", body.size(), contentType.c_str(),
+			(unsigned long long)fnv1a_hash(body));
+		s += buf;
+	}
+	else if (body.size() > kMaxLoggedBodyBytes) {
+		s.append(body, 0, kMaxLoggedBodyBytes);
+		snprintf(buf, sizeof(buf), "... <%zu more bytes>", body.size() - kMaxLoggedBodyBytes);
+		s += buf;
+	}
+	else {
+		s += body;
+	}
+}
+
 std::string dump_req_and_res(const httplib::Request &req, const httplib::Response &res) {
 	std::string s = "\n";
 	char buf[BUFSIZ];
@@ -73,7 +145,7 @@ std::string dump_req_and_res(const httplib::Request &req, const httplib::Respons
 
 	//s += dump_headers(req.headers);
 
-	if (!req.body.empty()) { s += req.body; }
+	dump_body(s, req.body, req.get_header_value("Content-Type"));
 	s += "\n";
 
 	s += "--------------------------------\n";
@@ -82,13 +154,17 @@ std::string dump_req_and_res(const httplib::Request &req, const httplib::Respons
 	s += buf;
 	//s += dump_headers(res.headers);
 
-	if (!res.body.empty()) { s += res.body; }
+	dump_body(s, res.body, res.get_header_value("Content-Type"));
 
 	return s;
 }
 
-void validate_request_params(const std::string captureDirectory, const std::string filenamePrefix, const std::string imageFormat)
+void validate_output_params(const Protocol::OutputRequest& request)
 {
+	const std::string&	captureDirectory = request.captureDirectory;
+	const std::string&	filenamePrefix = request.filenamePrefix;
+	const std::string&	imageFormat = request.imageFormat;
+
 	// validate captureDirectory
 	if (captureDirectory.empty())
 	{
@@ -114,31 +190,312 @@ void validate_request_params(const std::string captureDirectory, const std::stri
 	{
 		throw InvalidParams("Invalid image format specified '"+imageFormat+"'");
 	}
+
+	// validate bitDepth
+	if ((request.bitDepth != 8) && (request.bitDepth != 16))
+	{
+		throw InvalidParams("Invalid bit depth specified '"+std::to_string(request.bitDepth)+"'");
+	}
+	else if ((request.bitDepth == 16) && (imageFormat != "png") && (imageFormat != "tiff"))
+	{
+		throw InvalidParams("16-bit output is only supported for png and tiff");
+	}
+
+	// validate scaling
+	if (!((request.scale > 0.0) && (request.scale <= 1.0)))
+	{
+		throw InvalidParams("Invalid scale specified '"+std::to_string(request.scale)+"', must be in (0, 1]");
+	}
+	else if (request.maxWidth < 0)
+	{
+		throw InvalidParams("Invalid max width specified '"+std::to_string(request.maxWidth)+"'");
+	}
+	else if ((imageFormat == "raw") && ((request.scale != 1.0) || (request.maxWidth > 0)))
+	{
+		throw InvalidParams("raw output cannot be scaled");
+	}
+
+	// validate roi, the frame size is only checked once a frame is captured
+	bool hasRoi = (request.roi.width != 0) || (request.roi.height != 0);
+	if (hasRoi && ((request.roi.x < 0) || (request.roi.y < 0) || (request.roi.width <= 0) || (request.roi.height <= 0)))
+	{
+		throw InvalidParams("Invalid roi specified, x and y must be >= 0 and w and h > 0");
+	}
+	else if (hasRoi && (imageFormat == "raw"))
+	{
+		throw InvalidParams("raw output cannot be cropped");
+	}
 }
 
-std::string make_response(const std::string& result, const std::string& filepath="", const int& errCode=0, const std::string& errMsg="")
+void validate_roi_fits_frame(const Protocol::Region& roi, long frameWidth, long frameHeight)
+{
+	// compared as differences, the sums of huge requested values would overflow
+	bool hasRoi = (roi.width != 0) || (roi.height != 0);
+	if (hasRoi && ((roi.width > frameWidth - roi.x) || (roi.height > frameHeight - roi.y)))
+	{
+		throw InvalidParams("Invalid roi specified, "+std::to_string(roi.width)+"x"+std::to_string(roi.height)+"+"+std::to_string(roi.x)+"+"+std::to_string(roi.y)+
+			" does not fit the "+std::to_string(frameWidth)+"x"+std::to_string(frameHeight)+" frame");
+	}
+}
+
+void validate_frame_params(const Protocol::CommandRequest& request, DeckLinkInputDevice* deckLinkInput)
+{
+	// validate roi against the size of the frames arriving, a change of input format is only caught once a frame is captured
+	long frameWidth;
+	long frameHeight;
+	if (!deckLinkInput->GetFrameSize(frameWidth, frameHeight))
+	{
+		return;
+	}
+
+	validate_roi_fits_frame(request.roi, frameWidth, frameHeight);
+	for (const Protocol::OutputRequest& output : request.outputs)
+	{
+		validate_roi_fits_frame(output.roi, frameWidth, frameHeight);
+	}
+}
+
+bool is_animated_format(const std::string& imageFormat)
+{
+	return std::find(animatedImageFormats.begin(), animatedImageFormats.end(), imageFormat) != animatedImageFormats.end();
+}
+
+void validate_deinterlace_params(const Protocol::CommandRequest& request)
+{
+	// validate deinterlacing, ignored for progressive display modes
+	if ((request.deinterlace != "none") && (request.deinterlace != "field") && (request.deinterlace != "blend") && (request.deinterlace != "adaptive"))
+	{
+		throw InvalidParams("Invalid deinterlace specified '"+request.deinterlace+"', must be none, field, blend or adaptive");
+	}
+}
+
+void validate_request_params(const Protocol::CommandRequest& request)
 {
-	Json::StreamWriterBuilder builder;
-	std::string jsonString;
-	Json::Value root;
-	Json::Value body;
+	// validate change detection, the perceptual hash has 64 bits
+	if ((request.changeThreshold < 0) || (request.changeThreshold > 64))
+	{
+		throw InvalidParams("Invalid change threshold specified '"+std::to_string(request.changeThreshold)+"', must be in [0, 64]");
+	}
+
+	// validate accumulation, the median keeps a copy of each frame
+	if ((request.accumulateFrames < 0) || (request.accumulateFrames > kMaxAccumulateFrames))
+	{
+		throw InvalidParams("Invalid accumulate specified '"+std::to_string(request.accumulateFrames)+"', must be in [0, "+std::to_string(kMaxAccumulateFrames)+"]");
+	}
+	else if ((request.accumulateMode != "mean") && (request.accumulateMode != "median"))
+	{
+		throw InvalidParams("Invalid accumulate mode specified '"+request.accumulateMode+"', must be mean or median");
+	}
+	else if ((request.accumulateMode == "median") && (request.accumulateFrames > FrameAccumulator::kMaxMedianFrames))
+	{
+		throw InvalidParams("Invalid accumulate specified '"+std::to_string(request.accumulateFrames)+"', the median takes at most "+std::to_string(FrameAccumulator::kMaxMedianFrames)+" frames");
+	}
+	else if ((request.accumulateFrames > 1) && request.outputs.empty() && is_animated_format(request.imageFormat))
+	{
+		throw InvalidParams("accumulate cannot be used for an animated image");
+	}
 
-	if (result == R_OK) {
-		if (!filepath.empty())
+	validate_deinterlace_params(request);
+
+	// validate outputs, the fields of data only serve as defaults of the entries
+	if (!request.outputsValid)
+	{
+		throw InvalidParams("Invalid outputs specified, must be an array of objects");
+	}
+	else if (!request.outputs.empty())
+	{
+		if (request.outputs.size() > kMaxOutputs)
+		{
+			throw InvalidParams("Too many outputs specified, at most "+std::to_string(kMaxOutputs)+" are supported");
+		}
+		else if (request.thumbnail)
 		{
-			body["filepath"] = filepath;
+			throw InvalidParams("A thumbnail cannot be combined with outputs, add a scaled output instead");
 		}
+
+		for (const Protocol::OutputRequest& output : request.outputs)
+		{
+			validate_output_params(output);
+			if (is_animated_format(output.imageFormat))
+			{
+				throw InvalidParams(output.imageFormat+" cannot be used in outputs, it is captured from several frames");
+			}
+		}
+		return;
 	}
-	else
+
+	validate_output_params(request);
+
+	// validate thumbnail
+	if (request.thumbnail && (request.imageFormat == "raw"))
 	{
-		body["code"] = errCode;
-		body["message"] = errMsg;
+		throw InvalidParams("raw output cannot be scaled");
+	}
+	else if (request.thumbnail && (request.scale == 1.0) && (request.maxWidth == 0))
+	{
+		throw InvalidParams("A thumbnail needs a scale or max width");
 	}
 
-	root["response"] = result;
-	root["body"] = body;
-	jsonString = Json::writeString(builder, root);
-	return jsonString;
+	// validate animation, one image from a burst of frames
+	if (is_animated_format(request.imageFormat))
+	{
+		if (request.thumbnail)
+		{
+			throw InvalidParams("An animated image cannot have a thumbnail");
+		}
+		else if (request.skipIfUnchanged)
+		{
+			throw InvalidParams("skip_if_unchanged cannot be used for an animated image");
+		}
+		else if (!((request.animationFrameRate >= 1.0) && (request.animationFrameRate <= kMaxAnimationFrameRate)))
+		{
+			throw InvalidParams("Invalid frame rate specified '"+std::to_string(request.animationFrameRate)+"', must be in [1, "+std::to_string((int)kMaxAnimationFrameRate)+"]");
+		}
+		else if (!((request.clipDuration >= 0.0) && (request.clipDuration <= kMaxAnimationDuration)))
+		{
+			throw InvalidParams("Invalid duration specified '"+std::to_string(request.clipDuration)+"', must be in [0, "+std::to_string((int)kMaxAnimationDuration)+"]");
+		}
+	}
+}
+
+void validate_trigger_params(const Protocol::CommandRequest& request)
+{
+	const Protocol::Region& region = request.triggerRegion;
+
+	// validate threshold, a share of the compared blocks
+	if (!((request.triggerThreshold > 0.0) && (request.triggerThreshold <= 1.0)))
+	{
+		throw InvalidParams("Invalid threshold specified '"+std::to_string(request.triggerThreshold)+"', must be in (0, 1]");
+	}
+	else if (!(request.minInterval >= 0.0))
+	{
+		throw InvalidParams("Invalid min interval specified '"+std::to_string(request.minInterval)+"'");
+	}
+	else if ((request.preTriggerFrames < 0) || (request.preTriggerFrames > kMaxPreTriggerFrames))
+	{
+		throw InvalidParams("Invalid pre-trigger frames specified '"+std::to_string(request.preTriggerFrames)+"', must be in [0, "+std::to_string(kMaxPreTriggerFrames)+"]");
+	}
+
+	else if (is_animated_format(request.imageFormat))
+	{
+		throw InvalidParams(request.imageFormat+" cannot be written by the motion trigger");
+	}
+	else if (request.accumulateFrames > 1)
+	{
+		throw InvalidParams("accumulate cannot be used by the motion trigger");
+	}
+
+	// validate trigger region, clipped to the frame once frames arrive
+	bool hasRegion = (region.width != 0) || (region.height != 0);
+	if (hasRegion && ((region.x < 0) || (region.y < 0) || (region.width <= 0) || (region.height <= 0)))
+	{
+		throw InvalidParams("Invalid trigger region specified, x and y must be >= 0 and w and h > 0");
+	}
+}
+
+void validate_contact_sheet_params(const Protocol::CommandRequest& request)
+{
+	// validate frames and layout
+	if ((request.sheetFrames < 1) || (request.sheetFrames > kMaxContactSheetFrames))
+	{
+		throw InvalidParams("Invalid frames specified '"+std::to_string(request.sheetFrames)+"', must be in [1, "+std::to_string(kMaxContactSheetFrames)+"]");
+	}
+	else if (!((request.sheetInterval >= 0.0) && (request.sheetInterval <= kMaxContactSheetInterval)))
+	{
+		throw InvalidParams("Invalid interval specified '"+std::to_string(request.sheetInterval)+"', must be in [0, "+std::to_string((int)kMaxContactSheetInterval)+"]");
+	}
+	else if ((request.sheetColumns < 0) || (request.sheetColumns > request.sheetFrames))
+	{
+		throw InvalidParams("Invalid columns specified '"+std::to_string(request.sheetColumns)+"', must be in [0, frames]");
+	}
+
+	// validate output, a contact sheet is one scaled image
+	if (!request.outputs.empty() || request.thumbnail)
+	{
+		throw InvalidParams("A contact sheet cannot have outputs or a thumbnail");
+	}
+	else if ((request.imageFormat == "raw") || is_animated_format(request.imageFormat))
+	{
+		throw InvalidParams(request.imageFormat+" output cannot be used for a contact sheet");
+	}
+	validate_output_params(request);
+	validate_deinterlace_params(request);
+}
+
+void validate_analysis_params(const Protocol::CommandRequest& request)
+{
+	const Protocol::Region& roi = request.roi;
+
+	// validate histogram bins, merged from the 256 code values of 8-bit channels at most
+	int bins = request.histogramBins;
+	if ((bins < 0) || (bins > 256) || ((bins & (bins - 1)) != 0))
+	{
+		throw InvalidParams("Invalid histogram bins specified '"+std::to_string(bins)+"', must be 0 or a power of two up to 256");
+	}
+
+	// validate roi, the frame size is only checked once a frame is captured
+	bool hasRoi = (roi.width != 0) || (roi.height != 0);
+	if (hasRoi && ((roi.x < 0) || (roi.y < 0) || (roi.width <= 0) || (roi.height <= 0)))
+	{
+		throw InvalidParams("Invalid roi specified, x and y must be >= 0 and w and h > 0");
+	}
+}
+
+void validate_clip_params(const Protocol::CommandRequest& request)
+{
+	// validate captureDirectory and filenamePrefix, a clip has no image options
+	if (request.captureDirectory.empty())
+	{
+		throw InvalidParams("You must set a capture directory");
+	}
+	else if (!IsPathDirectory(request.captureDirectory))
+	{
+		throw InvalidParams("Invalid directory specified");
+	}
+	else if (request.filenamePrefix.empty())
+	{
+		throw InvalidParams("You must set a filename prefix");
+	}
+
+	// validate clip format
+	if ((request.clipFormat != "y4m") && (request.clipFormat != "raw"))
+	{
+		throw InvalidParams("Invalid clip format specified '"+request.clipFormat+"', must be y4m or raw");
+	}
+
+	// validate length, given either as duration or as frame count
+	if ((request.clipDuration != 0.0) && (request.clipFrames != 0))
+	{
+		throw InvalidParams("Set either a duration or a frame count, not both");
+	}
+	else if ((request.clipDuration == 0.0) && (request.clipFrames == 0))
+	{
+		throw InvalidParams("You must set a duration or a frame count");
+	}
+	else if ((request.clipFrames < 0) || (request.clipFrames > kMaxClipFrames))
+	{
+		throw InvalidParams("Invalid frame count specified '"+std::to_string(request.clipFrames)+"', must be in [1, "+std::to_string(kMaxClipFrames)+"]");
+	}
+	else if (!((request.clipDuration >= 0.0) && (request.clipDuration <= kMaxClipDuration)))
+	{
+		throw InvalidParams("Invalid duration specified '"+std::to_string(request.clipDuration)+"', must be in (0, "+std::to_string((int)kMaxClipDuration)+"]");
+	}
+}
+
+std::string make_response(const std::string& result, const std::string& filepath="", const int& errCode=0, const std::string& errMsg="")
+{
+	if (result == R_OK)
+	{
+		return Protocol::MakeOkResponse(filepath);
+	}
+	return Protocol::MakeErrorResponse(errCode, errMsg);
+}
+
+// Respond with the constant OK body, copied straight into the response without a temporary string
+void set_ok_response(httplib::Response& res)
+{
+	const std::string& response = Protocol::OkResponse();
+	res.set_content(response.data(), response.size(), "application/json");
 }
 
 int main(int argc, char* argv[])
@@ -157,6 +514,7 @@ int main(int argc, char* argv[])
 	bool						supportsFormatDetection = false;
 
 	std::thread					captureStillsThread;
+	bool						continuousCapture = false;	// capture kept running for the signal analyzer or motion trigger
 
 	IDeckLinkIterator*			deckLinkIterator = NULL;
 	IDeckLink*					deckLink = NULL;
@@ -175,6 +533,27 @@ int main(int argc, char* argv[])
 	int							logLevel = spdlog::level::info;
 	std::string					logDirectory = "";
 	std::string					logFilepath = "";
+	int							logQueueSize = 8192;
+	std::string					logOverflowPolicy = "block";
+	int							logFlushInterval = 3;
+	std::string					logRotation = "none";
+	int							logMaxSize = 50;
+	int							logMaxFiles = -1;
+	bool						logCompress = false;
+
+	// Output files
+	std::string					durability = "none";
+	bool						preallocate = false;
+	bool						unbuffered = false;
+	int							unbufferedMinSize = 4;
+	bool						asyncWrite = false;
+	int							asyncWriteQueueSize = 256;
+	int							convertThreads = 0;
+
+	// Signal analysis
+	int							analyzeInterval = 0;
+	double						frozenSeconds = 2.0;
+	std::string					autoCaptureDirectory = "";
 
 	// Get command line options
 	for (int i = 1; i < argc; i++)
@@ -196,6 +575,57 @@ int main(int argc, char* argv[])
 
 		else if (strcmp(argv[i], "--log-dir") == 0)
 			logDirectory = argv[++i];
+
+		else if (strcmp(argv[i], "--log-queue-size") == 0)
+			logQueueSize = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--log-overflow") == 0)
+			logOverflowPolicy = argv[++i];
+
+		else if (strcmp(argv[i], "--log-flush-interval") == 0)
+			logFlushInterval = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--log-rotate") == 0)
+			logRotation = argv[++i];
+
+		else if (strcmp(argv[i], "--log-max-size") == 0)
+			logMaxSize = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--log-max-files") == 0)
+			logMaxFiles = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--log-compress") == 0)
+			logCompress = true;
+
+		else if (strcmp(argv[i], "--durability") == 0)
+			durability = argv[++i];
+
+		else if (strcmp(argv[i], "--preallocate") == 0)
+			preallocate = true;
+
+		else if (strcmp(argv[i], "--unbuffered") == 0)
+			unbuffered = true;
+
+		else if (strcmp(argv[i], "--unbuffered-min-size") == 0)
+			unbufferedMinSize = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--async-write") == 0)
+			asyncWrite = true;
+
+		else if (strcmp(argv[i], "--async-write-queue") == 0)
+			asyncWriteQueueSize = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--convert-threads") == 0)
+			convertThreads = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--analyze-interval") == 0)
+			analyzeInterval = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--frozen-seconds") == 0)
+			frozenSeconds = atof(argv[++i]);
+
+		else if (strcmp(argv[i], "--auto-capture-dir") == 0)
+			autoCaptureDirectory = argv[++i];
 	}
 
 	// Initialize logger
@@ -213,17 +643,85 @@ int main(int argc, char* argv[])
 		fprintf(stderr, "You must set a log directory\n");
 		return exitStatus;
 	}
+	if (logQueueSize <= 0)
+	{
+		fprintf(stderr, "Invalid log queue size specified: %d\n", logQueueSize);
+		return exitStatus;
+	}
+	if ((logOverflowPolicy != "block") && (logOverflowPolicy != "overrun"))
+	{
+		fprintf(stderr, "Invalid log overflow policy specified: %s\n", logOverflowPolicy.c_str());
+		fprintf(stderr, "block: wait for space in the queue (default)\noverrun: drop the oldest queued message\n");
+		return exitStatus;
+	}
+	if ((logRotation != "none") && (logRotation != "size") && (logRotation != "daily"))
+	{
+		fprintf(stderr, "Invalid log rotation specified: %s\n", logRotation.c_str());
+		fprintf(stderr, "none: one file per start (default)\nsize: rotate when --log-max-size MB is reached\ndaily: rotate at midnight\n");
+		return exitStatus;
+	}
+	if (logMaxSize <= 0)
+	{
+		fprintf(stderr, "Invalid log max size specified: %d\n", logMaxSize);
+		return exitStatus;
+	}
+	if (logMaxFiles < 0)
+	{
+		// Unbounded unless rotating
+		logMaxFiles = (logRotation == "none") ? 0 : 10;
+	}
 	try
 	{
-		logFilepath = logDirectory + "\\SnapShotCreator_" + CurrentDateTime("%Y%m%d%H%M%S") + ".log";
-		spdlog::set_default_logger(spdlog::basic_logger_mt("SnapShotCreator", logFilepath));
+		// Log messages are formatted on the calling thread and written to file by a dedicated logging thread
+		std::shared_ptr<spdlog::sinks::sink> logSink;
+		if (logRotation == "size")
+		{
+			logFilepath = logDirectory + "\\SnapShotCreator_" + CurrentDateTime("%Y%m%d%H%M%S") + ".log";
+			logSink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(logFilepath, (size_t)logMaxSize * 1024 * 1024, (size_t)logMaxFiles);
+		}
+		else if (logRotation == "daily")
+		{
+			// Written as SnapShotCreator_<YYYY-MM-DD>.log
+			logFilepath = logDirectory + "\\SnapShotCreator.log";
+			logSink = std::make_shared<spdlog::sinks::daily_file_sink_mt>(logFilepath, 0, 0, false, (uint16_t)(std::min)(logMaxFiles, 65535));
+		}
+		else
+		{
+			logFilepath = logDirectory + "\\SnapShotCreator_" + CurrentDateTime("%Y%m%d%H%M%S") + ".log";
+			logSink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(logFilepath);
+		}
+		spdlog::init_thread_pool(logQueueSize, 1);
+		auto logger = std::make_shared<spdlog::async_logger>("SnapShotCreator",
+			logSink,
+			spdlog::thread_pool(),
+			(logOverflowPolicy == "overrun") ? spdlog::async_overflow_policy::overrun_oldest : spdlog::async_overflow_policy::block);
+		spdlog::initialize_logger(logger);
+		spdlog::set_default_logger(logger);
+		spdlog::flush_on(spdlog::level::err);
+		if (logFlushInterval > 0)
+			spdlog::flush_every(std::chrono::seconds(logFlushInterval));
 	}
 	catch (...)
 	{
 		fprintf(stderr, "Invalid log directory specified: %s\n", logDirectory.c_str());
+		spdlog::shutdown();
 		return exitStatus;
 	}
 
+	// Teardown on every return from here on: background threads first, then the logger, whose thread pool is
+	// drained so that their last messages and any error just logged are written out
+	struct Teardown
+	{
+		~Teardown()
+		{
+			SignalAnalyzer::Stop();
+			MotionTrigger::Stop();
+			FileWriter::StopAsyncWriter();
+			LogMaintenance::Stop();
+			spdlog::shutdown();
+		}
+	} teardown;
+
 	// Log startup command
 	for(int i = 0; i < argc; ++i)
 	{
@@ -248,6 +746,58 @@ int main(int argc, char* argv[])
 		spdlog::error("You must select a port number between 2000 - 65535");
 		return exitStatus;
 	}
+	if ((durability != "none") && (durability != "data") && (durability != "full"))
+	{
+		spdlog::error("Invalid durability specified: {} (none, data or full)", durability);
+		return exitStatus;
+	}
+	if (unbufferedMinSize < 0)
+	{
+		spdlog::error("Invalid unbuffered min size specified: {}", unbufferedMinSize);
+		return exitStatus;
+	}
+	// Files of at least --unbuffered-min-size MB bypass the system file cache
+	FileWriter::Configure({
+		(durability == "full") ? FileWriter::kDurabilityFull : (durability == "data") ? FileWriter::kDurabilityData : FileWriter::kDurabilityNone,
+		preallocate,
+		unbuffered,
+		(size_t)unbufferedMinSize * 1024 * 1024 });
+	if (asyncWrite && (asyncWriteQueueSize <= 0))
+	{
+		spdlog::error("Invalid async write queue size specified: {}", asyncWriteQueueSize);
+		return exitStatus;
+	}
+	if (convertThreads < 0)
+	{
+		spdlog::error("Invalid convert thread count specified: {}", convertThreads);
+		return exitStatus;
+	}
+	// 0 keeps the default, one thread per core up to 8
+	if (convertThreads > 0)
+		PixelConverter::SetThreadCount(convertThreads);
+	if (analyzeInterval < 0)
+	{
+		spdlog::error("Invalid analyze interval specified: {}", analyzeInterval);
+		return exitStatus;
+	}
+	if (!(frozenSeconds > 0.0))
+	{
+		spdlog::error("Invalid frozen seconds specified: {}", frozenSeconds);
+		return exitStatus;
+	}
+	if (!autoCaptureDirectory.empty() && ((analyzeInterval == 0) || !IsPathDirectory(autoCaptureDirectory)))
+	{
+		spdlog::error("Invalid auto capture directory specified: {} (requires --analyze-interval)", autoCaptureDirectory);
+		return exitStatus;
+	}
+
+	// Background threads are started once all options are valid.
+	// Bound disk usage across restarts too, since every start opens a new file
+	if ((logMaxFiles > 0) || logCompress)
+		LogMaintenance::Start(logDirectory, "SnapShotCreator_*.log", (logMaxFiles > 0) ? logMaxFiles : SIZE_MAX, logCompress, kLogMaintenanceInterval);
+	// Responses are sent once the image is encoded, files are written by a background I/O thread
+	if (asyncWrite)
+		FileWriter::StartAsyncWriter((size_t)asyncWriteQueueSize * 1024 * 1024);
 
 	// Initialize input device
 	// TODO(low): wrap in a function and make another thread for it.
@@ -390,8 +940,42 @@ int main(int argc, char* argv[])
 			throw InitializationError("Timeout waiting for valid frame");
 		}
 
-		// Stop capturing on successful try
-		selectedDeckLinkInput->StopCapture();
+		if (receivedVideoFrame != NULL)
+			receivedVideoFrame->Release();
+
+		if (analyzeInterval > 0)
+		{
+			// Keep capturing for the signal analyzer, frames are only queued while a snapshot is taken
+			SignalAnalyzer::Options		analyzerOptions;
+			SignalAnalyzer::SnapshotHandler	snapshotHandler;
+
+			analyzerOptions.interval = analyzeInterval;
+			analyzerOptions.frozenSeconds = frozenSeconds;
+			if (!autoCaptureDirectory.empty())
+			{
+				snapshotHandler = [autoCaptureDirectory](SignalAnalyzer::State from, SignalAnalyzer::State to, IDeckLinkVideoFrame* videoFrame, time_t captureTime) {
+					Protocol::CommandRequest	request;
+					std::vector<std::string>	filepaths;
+
+					request.captureDirectory = autoCaptureDirectory;
+					request.filenamePrefix = std::string("signal_") + SignalAnalyzer::GetStateName(to);
+					request.imageFormat = "png";
+					CaptureStills::WriteSnapshot(videoFrame, request, bmdUnknownFieldDominance, captureTime, filepaths);
+
+					spdlog::info("Captured signal change from {} to {} to {}", SignalAnalyzer::GetStateName(from), SignalAnalyzer::GetStateName(to), filepaths[0]);
+					return filepaths[0];
+				};
+			}
+
+			selectedDeckLinkInput->SetVideoFrameQueueing(false);
+			SignalAnalyzer::Start(analyzerOptions, snapshotHandler);
+			continuousCapture = true;
+		}
+		else
+		{
+			// Stop capturing on successful try
+			selectedDeckLinkInput->StopCapture();
+		}
 
 		// Update server status
 		serverStatus = IDLE;
@@ -423,26 +1007,23 @@ int main(int argc, char* argv[])
 
 	// create a snapshot
 	svr.Post("/", [&](const httplib::Request &req, httplib::Response &res) {
-		std::string 							rawJson = req.body;
-		Json::Value 							root;
-		Json::CharReaderBuilder 				jsonBuilder;
-		const std::unique_ptr<Json::CharReader>	jsonReader(jsonBuilder.newCharReader());
+		Protocol::CommandRequest				request;
 
 		std::string								command;
 		std::string 							captureDirectory;
 		std::string 							filenamePrefix;
 		std::string 							imageFormat;
-		std::string 							filepath;
+		std::vector<std::string>				filepaths;
 		std::string 							err;
 
 		// Parse JSON body
-		if (!jsonReader->parse(rawJson.c_str(), rawJson.c_str() + rawJson.length(), &root, &err))
+		if (!Protocol::ParseRequest(req.body, request))
 		{
 			throw InvalidRequest("failed to parse JSON body");
 		}
 
 		// Get command
-		command = root["command"].asString();
+		command = request.command;
 
 		if (command == "IS_INITIALIZED")
 		{
@@ -450,7 +1031,7 @@ int main(int argc, char* argv[])
 			// Confirm if server is ready
 			if (serverStatus > INITIALIZING)
 			{
-				res.set_content(make_response(R_OK), "application/json");
+				set_ok_response(res);
 			}
 			else
 			{
@@ -465,6 +1046,15 @@ int main(int argc, char* argv[])
 			if (selectedDeckLinkInput != NULL)
 			{
 				selectedDeckLinkInput->CancelCapture();
+				ClipRecorder::Cancel();
+				if (continuousCapture)
+				{
+					// Stop the capture kept running for the signal analyzer and motion trigger
+					SignalAnalyzer::Stop();
+					MotionTrigger::Stop();
+					selectedDeckLinkInput->StopCapture();
+					continuousCapture = false;
+				}
 				selectedDeckLinkInput->Release();
 				selectedDeckLinkInput = NULL;
 			}
@@ -475,10 +1065,57 @@ int main(int argc, char* argv[])
 			}
 			ImageWriter::UnInitialize();
 			CoUninitialize();
-			res.set_content(make_response(R_OK), "application/json");
+			set_ok_response(res);
 			svr.stop();
 		}
 
+		else if (command == "GET_STATS")
+		{
+			spdlog::info("received command: {}", command);
+			SignalAnalyzer::Stats	stats = SignalAnalyzer::GetStats();
+			Json::Value				body;
+			Json::Value				transitions(Json::arrayValue);
+
+			for (const SignalAnalyzer::Transition& transition : stats.transitions)
+			{
+				Json::Value entry;
+				entry["from"] = SignalAnalyzer::GetStateName(transition.from);
+				entry["to"] = SignalAnalyzer::GetStateName(transition.to);
+				entry["time"] = transition.time;
+				if (!transition.filepath.empty())
+					entry["filepath"] = transition.filepath;
+				transitions.append(entry);
+			}
+
+			// Signal state of the live input, only tracked with --analyze-interval
+			body["signal"]["analyzing"] = stats.running;
+			body["signal"]["state"] = SignalAnalyzer::GetStateName(stats.state);
+			body["signal"]["since"] = stats.since;
+			body["signal"]["analyzed_frames"] = (Json::UInt64)stats.analyzedFrames;
+			body["signal"]["luma_mean"] = stats.lumaMean;
+			body["signal"]["luma_deviation"] = stats.lumaDeviation;
+			body["signal"]["difference"] = stats.difference;
+			body["signal"]["transitions"] = transitions;
+
+			// Motion triggered capture, only tracked between START_MOTION_TRIGGER and STOP_MOTION_TRIGGER
+			MotionTrigger::Stats	motionStats = MotionTrigger::GetStats();
+			Json::Value				lastFilepaths(Json::arrayValue);
+
+			for (const std::string& filepath : motionStats.lastFilepaths)
+				lastFilepaths.append(filepath);
+
+			body["motion"]["running"] = motionStats.running;
+			body["motion"]["compared_frames"] = (Json::UInt64)motionStats.comparedFrames;
+			body["motion"]["triggers"] = (Json::UInt64)motionStats.triggers;
+			body["motion"]["rate_limited"] = (Json::UInt64)motionStats.rateLimited;
+			body["motion"]["dropped"] = (Json::UInt64)motionStats.dropped;
+			body["motion"]["difference"] = motionStats.difference;
+			body["motion"]["peak_difference"] = motionStats.peakDifference;
+			body["motion"]["last_trigger_time"] = motionStats.lastTriggerTime;
+			body["motion"]["last_filepaths"] = lastFilepaths;
+			res.set_content(Protocol::MakeOkResponse(body), "application/json");
+		}
+
 		else if (command == "CREATE_SNAPSHOT")
 		{
 			spdlog::info("received command: {}", command);
@@ -497,36 +1134,155 @@ int main(int argc, char* argv[])
 			serverStatus = PROCESSING;
 
 			// Get parameters
-			captureDirectory = root["data"].get("output_directory", "").asCString();
-			filenamePrefix = root["data"].get("filename_prefix", "").asCString();
-			imageFormat = root["data"].get("image_format", "").asCString();
+			captureDirectory = request.captureDirectory;
+			filenamePrefix = request.filenamePrefix;
+			imageFormat = request.imageFormat;
 
 			// Print the request params
 			spdlog::info("Capturing snapshot:\n"
 				" - Capture directory: {}\n"
 				" - Filename prefix: {}\n"
-				" - Image format: {}",
+				" - Image format: {}\n"
+				" - Bit depth: {}\n"
+				" - Scale: {} (max width {}{})\n"
+				" - Region: {}x{}+{}+{}\n"
+				" - Skip if unchanged: {} (threshold {})\n"
+				" - Deinterlace: {}",
 				captureDirectory.c_str(),
 				filenamePrefix.c_str(),
-				imageFormat.c_str()
+				imageFormat.c_str(),
+				request.bitDepth,
+				request.scale,
+				request.maxWidth,
+				request.thumbnail ? ", thumbnail" : "",
+				request.roi.width, request.roi.height, request.roi.x, request.roi.y,
+				request.skipIfUnchanged, request.changeThreshold,
+				request.deinterlace.c_str()
 			);
+			if (is_animated_format(imageFormat))
+			{
+				spdlog::info(" - Animation: {}s at {} fps", request.clipDuration, request.animationFrameRate);
+			}
+			if (request.accumulateFrames > 1)
+			{
+				spdlog::info(" - Accumulate: {} of {} frames", request.accumulateMode.c_str(), request.accumulateFrames);
+			}
+			for (size_t i = 0; i < request.outputs.size(); i++)
+			{
+				const Protocol::OutputRequest& output = request.outputs[i];
+				spdlog::info(" - Output {}: {} {}\\{} {}-bit scale {} (max width {}) region {}x{}+{}+{}",
+					i, output.imageFormat.c_str(), output.captureDirectory.c_str(), output.filenamePrefix.c_str(),
+					output.bitDepth, output.scale, output.maxWidth,
+					output.roi.width, output.roi.height, output.roi.x, output.roi.y);
+			}
 
 			// Validate params
-			validate_request_params(captureDirectory, filenamePrefix, imageFormat);
+			validate_request_params(request);
+			validate_frame_params(request, selectedDeckLinkInput);
 
-			// Start capturing
-			result = selectedDeckLinkInput->StartCapture(selectedDisplayMode, std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndex]), enableFormatDetection);
-			if (result != S_OK)
-				throw CaptureError("failed to start capture");
+			// Start capturing, or queueing the frames of the capture kept running
+			if (continuousCapture)
+			{
+				selectedDeckLinkInput->SetVideoFrameQueueing(true);
+			}
+			else
+			{
+				result = selectedDeckLinkInput->StartCapture(selectedDisplayMode, std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndex]), enableFormatDetection);
+				if (result != S_OK)
+					throw CaptureError("failed to start capture");
+			}
 
 			// Start thread for capture processing
 			captureStillsThread = std::thread([&] {
-				CaptureStills::CreateSnapshot(selectedDeckLinkInput, captureDirectory, filenamePrefix, imageFormat, filepath, err);
+				if (is_animated_format(request.imageFormat))
+				{
+					filepaths.assign(1, "");
+					CaptureStills::CreateAnimation(selectedDeckLinkInput, request, filepaths[0], err);
+				}
+				else
+				{
+					CaptureStills::CreateSnapshot(selectedDeckLinkInput, request, filepaths, err);
+				}
 			});
 			// Wait on return of main capture stills thread
 			captureStillsThread.join();
 			// Stop capturing
-			selectedDeckLinkInput->StopCapture();
+			if (continuousCapture)
+				selectedDeckLinkInput->SetVideoFrameQueueing(false);
+			else
+				selectedDeckLinkInput->StopCapture();
+
+			// Update server status
+			serverStatus = IDLE;
+
+			// Check result
+			if (!err.empty())
+			{
+				throw CaptureError(err);
+			}
+			if (!request.outputs.empty())
+				res.set_content(Protocol::MakeOkResponse(filepaths), "application/json");
+			else
+				res.set_content(Protocol::MakeOkResponse(filepaths[0], request.thumbnail ? filepaths[1] : ""), "application/json");
+		}
+
+		else if (command == "CREATE_CONTACT_SHEET")
+		{
+			spdlog::info("received command: {}", command);
+			if (serverStatus < IDLE)
+			{
+				throw InitializationError(initializationErrMsg);
+			}
+			else if (serverStatus > IDLE)
+			{
+				throw CaptureError("server is processing another snapshot");
+			}
+
+			serverStatus = PROCESSING;
+
+			spdlog::info("Creating contact sheet:\n"
+				" - Capture directory: {}\n"
+				" - Filename prefix: {}\n"
+				" - Image format: {}\n"
+				" - Bit depth: {}\n"
+				" - Frames: {} every {}s ({} columns)\n"
+				" - Tile scale: {} (max width {})\n"
+				" - Region: {}x{}+{}+{}",
+				request.captureDirectory.c_str(),
+				request.filenamePrefix.c_str(),
+				request.imageFormat.c_str(),
+				request.bitDepth,
+				request.sheetFrames, request.sheetInterval, request.sheetColumns,
+				request.scale, request.maxWidth,
+				request.roi.width, request.roi.height, request.roi.x, request.roi.y
+			);
+
+			// Validate params
+			validate_contact_sheet_params(request);
+			validate_frame_params(request, selectedDeckLinkInput);
+
+			// Start capturing, or queueing the frames of the capture kept running
+			if (continuousCapture)
+			{
+				selectedDeckLinkInput->SetVideoFrameQueueing(true);
+			}
+			else
+			{
+				result = selectedDeckLinkInput->StartCapture(selectedDisplayMode, std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndex]), enableFormatDetection);
+				if (result != S_OK)
+					throw CaptureError("failed to start capture");
+			}
+
+			std::string filepath;
+			captureStillsThread = std::thread([&] {
+				CaptureStills::CreateContactSheet(selectedDeckLinkInput, request, filepath, err);
+			});
+			captureStillsThread.join();
+			// Stop capturing
+			if (continuousCapture)
+				selectedDeckLinkInput->SetVideoFrameQueueing(false);
+			else
+				selectedDeckLinkInput->StopCapture();
 
 			// Update server status
 			serverStatus = IDLE;
@@ -536,7 +1292,263 @@ int main(int argc, char* argv[])
 			{
 				throw CaptureError(err);
 			}
-			res.set_content(make_response(R_OK, filepath), "application/json");
+			res.set_content(Protocol::MakeOkResponse(filepath), "application/json");
+		}
+
+		else if (command == "ANALYZE_FRAME")
+		{
+			spdlog::info("received command: {}", command);
+			if (serverStatus < IDLE)
+			{
+				throw InitializationError(initializationErrMsg);
+			}
+			else if (serverStatus > IDLE)
+			{
+				throw CaptureError("server is processing another snapshot");
+			}
+
+			serverStatus = PROCESSING;
+
+			spdlog::info("Analyzing frame:\n"
+				" - Region: {}x{}+{}+{}\n"
+				" - Histogram bins: {}",
+				request.roi.width, request.roi.height, request.roi.x, request.roi.y,
+				request.histogramBins
+			);
+
+			// Validate params
+			validate_analysis_params(request);
+			validate_frame_params(request, selectedDeckLinkInput);
+
+			// Start capturing, or queueing the frames of the capture kept running
+			if (continuousCapture)
+			{
+				selectedDeckLinkInput->SetVideoFrameQueueing(true);
+			}
+			else
+			{
+				result = selectedDeckLinkInput->StartCapture(selectedDisplayMode, std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndex]), enableFormatDetection);
+				if (result != S_OK)
+					throw CaptureError("failed to start capture");
+			}
+
+			FrameStatistics::Statistics statistics;
+			captureStillsThread = std::thread([&] {
+				CaptureStills::AnalyzeFrame(selectedDeckLinkInput, request, statistics, err);
+			});
+			captureStillsThread.join();
+			// Stop capturing
+			if (continuousCapture)
+				selectedDeckLinkInput->SetVideoFrameQueueing(false);
+			else
+				selectedDeckLinkInput->StopCapture();
+
+			// Update server status
+			serverStatus = IDLE;
+
+			// Check result
+			if (!err.empty())
+			{
+				throw CaptureError(err);
+			}
+
+			// Levels in native code values of the captured pixel format
+			Json::Value body;
+			body["width"] = (Json::Int)statistics.width;
+			body["height"] = (Json::Int)statistics.height;
+			body["pixel_format"] = RawVideoFrame::GetPixelFormatTag(statistics.pixelFormat);
+			body["bit_depth"] = statistics.bitDepth;
+			if (statistics.yuv)
+				body["out_of_gamut"] = (Json::UInt64)statistics.outOfGamut;
+
+			for (const FrameStatistics::Channel& channel : statistics.channels)
+			{
+				Json::Value& entry = body["channels"][channel.name];
+				entry["min"] = channel.minimum;
+				entry["max"] = channel.maximum;
+				entry["mean"] = channel.mean;
+				entry["legal_min"] = channel.legalMinimum;
+				entry["legal_max"] = channel.legalMaximum;
+				entry["below_legal"] = (Json::UInt64)channel.below;
+				entry["above_legal"] = (Json::UInt64)channel.above;
+				if (request.histogramBins > 0)
+				{
+					Json::Value histogram(Json::arrayValue);
+					for (uint64_t count : FrameStatistics::GetHistogram(channel, request.histogramBins))
+						histogram.append((Json::UInt64)count);
+					entry["histogram"] = histogram;
+				}
+			}
+			res.set_content(Protocol::MakeOkResponse(body), "application/json");
+		}
+
+		else if (command == "RECORD_CLIP")
+		{
+			spdlog::info("received command: {}", command);
+			if (serverStatus < IDLE)
+			{
+				throw InitializationError(initializationErrMsg);
+			}
+			else if (serverStatus > IDLE)
+			{
+				throw CaptureError("server is processing another snapshot");
+			}
+
+			serverStatus = PROCESSING;
+
+			spdlog::info("Recording clip:\n"
+				" - Capture directory: {}\n"
+				" - Filename prefix: {}\n"
+				" - Clip format: {}\n"
+				" - Duration: {}s\n"
+				" - Frame count: {}",
+				request.captureDirectory.c_str(),
+				request.filenamePrefix.c_str(),
+				request.clipFormat.c_str(),
+				request.clipDuration,
+				request.clipFrames
+			);
+
+			// Validate params
+			validate_clip_params(request);
+
+			// Frames reach the recorder from the capture callback, the device queue is not used
+			if (!continuousCapture)
+			{
+				result = selectedDeckLinkInput->StartCapture(selectedDisplayMode, std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndex]), enableFormatDetection);
+				if (result != S_OK)
+					throw CaptureError("failed to start capture");
+				selectedDeckLinkInput->SetVideoFrameQueueing(false);
+			}
+
+			ClipRecorder::Options	options;
+			ClipRecorder::Result	clip = {};
+			options.filepath = ImageWriter::GetFilepath(request.captureDirectory, request.filenamePrefix, request.clipFormat);
+			options.container = (request.clipFormat == "raw") ? ClipRecorder::kContainerRaw : ClipRecorder::kContainerY4m;
+			options.frameCount = (uint64_t)request.clipFrames;
+			options.duration = request.clipDuration;
+			options.fieldDominance = selectedDeckLinkInput->GetFieldDominance();
+
+			captureStillsThread = std::thread([&] {
+				try
+				{
+					ClipRecorder::Record(options, clip);
+				}
+				catch (const std::exception& ex)
+				{
+					err = ex.what();
+				}
+			});
+			captureStillsThread.join();
+			// Stop capturing
+			if (!continuousCapture)
+				selectedDeckLinkInput->StopCapture();
+
+			// Update server status
+			serverStatus = IDLE;
+
+			// Check result
+			if (!err.empty())
+			{
+				throw CaptureError(err);
+			}
+
+			Json::Value body;
+			body["filepath"] = options.filepath;
+			body["frames"] = (Json::UInt64)clip.writtenFrames;
+			body["dropped_frames"] = (Json::UInt64)clip.droppedFrames;
+			res.set_content(Protocol::MakeOkResponse(body), "application/json");
+		}
+
+		else if (command == "START_MOTION_TRIGGER")
+		{
+			spdlog::info("received command: {}", command);
+			if (serverStatus < IDLE)
+			{
+				throw InitializationError(initializationErrMsg);
+			}
+			else if (serverStatus > IDLE)
+			{
+				throw CaptureError("server is processing another snapshot");
+			}
+
+			spdlog::info("Starting motion trigger:\n"
+				" - Capture directory: {}\n"
+				" - Filename prefix: {}\n"
+				" - Image format: {}\n"
+				" - Threshold: {}\n"
+				" - Trigger region: {}x{}+{}+{}\n"
+				" - Min interval: {}s\n"
+				" - Pre-trigger frames: {}",
+				request.captureDirectory.c_str(),
+				request.filenamePrefix.c_str(),
+				request.imageFormat.c_str(),
+				request.triggerThreshold,
+				request.triggerRegion.width, request.triggerRegion.height, request.triggerRegion.x, request.triggerRegion.y,
+				request.minInterval,
+				request.preTriggerFrames
+			);
+
+			// Validate params
+			validate_request_params(request);
+			validate_trigger_params(request);
+			validate_frame_params(request, selectedDeckLinkInput);
+
+			// Keep capturing, frames are compared on the capture callback and only queued for snapshots
+			if (!continuousCapture)
+			{
+				result = selectedDeckLinkInput->StartCapture(selectedDisplayMode, std::get<kPixelFormatValue>(kSupportedPixelFormats[pixelFormatIndex]), enableFormatDetection);
+				if (result != S_OK)
+					throw CaptureError("failed to start capture");
+				selectedDeckLinkInput->SetVideoFrameQueueing(false);
+				continuousCapture = true;
+			}
+
+			MotionTrigger::Options triggerOptions;
+			triggerOptions.threshold = request.triggerThreshold;
+			triggerOptions.region = { request.triggerRegion.x, request.triggerRegion.y, request.triggerRegion.width, request.triggerRegion.height };
+			triggerOptions.minInterval = request.minInterval;
+			triggerOptions.preTriggerFrames = request.preTriggerFrames;
+
+			// Each capture is written as a snapshot of the request, pre-trigger frames with "_pre" appended to the prefixes
+			MotionTrigger::Start(triggerOptions, [request, selectedDeckLinkInput](IDeckLinkVideoFrame* videoFrame, time_t captureTime, bool preTrigger) {
+				Protocol::CommandRequest	frameRequest = request;
+				std::vector<std::string>	frameFilepaths;
+
+				frameRequest.skipIfUnchanged = false;
+				if (preTrigger)
+				{
+					frameRequest.filenamePrefix += "_pre";
+					for (Protocol::OutputRequest& output : frameRequest.outputs)
+						output.filenamePrefix += "_pre";
+				}
+				CaptureStills::WriteSnapshot(videoFrame, frameRequest, selectedDeckLinkInput->GetFieldDominance(), captureTime, frameFilepaths);
+				return frameFilepaths;
+			});
+			set_ok_response(res);
+		}
+
+		else if (command == "STOP_MOTION_TRIGGER")
+		{
+			spdlog::info("received command: {}", command);
+			if (serverStatus < IDLE)
+			{
+				throw InitializationError(initializationErrMsg);
+			}
+			else if (serverStatus > IDLE)
+			{
+				throw CaptureError("server is processing another snapshot");
+			}
+
+			MotionTrigger::Stop();
+
+			// Stop capturing unless the signal analyzer still needs the frames
+			if (continuousCapture && !SignalAnalyzer::IsRunning())
+			{
+				selectedDeckLinkInput->StopCapture();
+				continuousCapture = false;
+			}
+			set_ok_response(res);
 		}
 		else
 		{
@@ -615,7 +1627,11 @@ int main(int argc, char* argv[])
 
 	// set logger for request/response
 	svr.set_logger([&](const httplib::Request &req, const httplib::Response &res) {
-		spdlog::debug(dump_req_and_res(req, res).c_str());
+		// Checked up front so that nothing is formatted, not even into the backtrace buffer, above debug level
+		if (spdlog::default_logger_raw()->should_log(spdlog::level::debug))
+		{
+			spdlog::debug("{}", dump_req_and_res(req, res));
+		}
 	});
 
 	spdlog::info("Server started at http://localhost:{}", portNo);
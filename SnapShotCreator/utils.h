@@ -6,15 +6,20 @@
 
 namespace
 {
-    // Get formatted current date/time
-    const std::string CurrentDateTime(const char* fmt)
+    // Get formatted local date/time
+    const std::string FormatDateTime(time_t time, const char* fmt)
     {
-        time_t     now = time(NULL);
         struct tm  tstruct;
         char       buf[30];
 
-        localtime_s(&tstruct, &now);
+        localtime_s(&tstruct, &time);
         strftime(buf, sizeof(buf), fmt, &tstruct);
         return buf;
     }
+
+    // Get formatted current date/time
+    const std::string CurrentDateTime(const char* fmt)
+    {
+        return FormatDateTime(time(NULL), fmt);
+    }
 }
@@ -0,0 +1,813 @@
+#include <Windows.h>
+#include <Psapi.h>
+#include <stdio.h>
+#include <json/json.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/async.h"
+#include "include/spdlog/sinks/basic_file_sink.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+#include "platform.h"
+#include "Bgra32VideoFrame.h"
+#include "RawVideoFrame.h"
+#include "Rgb48VideoFrame.h"
+#include "PixelConverter.h"
+#include "FrameHash.h"
+#include "SignalAnalyzer.h"
+#include "MotionTrigger.h"
+#include "FrameStatistics.h"
+#include "FrameAccumulator.h"
+#include "ImageWriter.h"
+#include "FileWriter.h"
+#include "MemoryStream.h"
+#include "CaptureStills.h"
+#include "Protocol.h"
+
+
+// Allocation counter. Only allocations made by this process' CRT heap are seen;
+// buffers allocated inside the DeckLink API or WIC DLLs are not counted.
+static std::atomic<uint64_t>			g_allocationCount{ 0 };
+
+void* operator new(size_t size)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = malloc(size ? size : 1);
+	if (ptr == NULL)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+
+// Reference mode encoding {mode name, width, height, field dominance}
+struct ReferenceMode
+{
+	const char*			name;
+	long				width;
+	long				height;
+	BMDFieldDominance	fieldDominance;
+};
+
+const std::vector<ReferenceMode> kReferenceModes
+{
+	{ "1080i50", 1920, 1080, bmdUpperFieldFirst },
+	{ "1080p30", 1920, 1080, bmdProgressiveFrame },
+	{ "2160p30", 3840, 2160, bmdProgressiveFrame },
+};
+
+const char* GetFieldDominanceName(BMDFieldDominance fieldDominance)
+{
+	switch (fieldDominance)
+	{
+		case bmdProgressiveFrame:			return "progressive";
+		case bmdProgressiveSegmentedFrame:	return "progressive_segmented";
+		case bmdUpperFieldFirst:			return "upper_field_first";
+		case bmdLowerFieldFirst:			return "lower_field_first";
+		default:							return "unknown";
+	}
+}
+
+struct RunResult
+{
+	uint64_t	frames;
+	uint64_t	allocations;
+	double		seconds;
+	bool		succeeded;
+};
+
+// Per-thread work item. Setup runs before the clock starts, the returned callable is timed.
+typedef std::function<bool(void)>				BenchmarkIteration;
+typedef std::function<BenchmarkIteration(int)>	BenchmarkSetup;
+
+RunResult RunThreads(int threadCount, int iterations, const BenchmarkSetup& setup)
+{
+	RunResult					result = { 0, 0, 0.0, true };
+	std::vector<std::thread>	threads;
+	std::atomic<int>			readyCount{ 0 };
+	std::atomic<bool>			start{ false };
+	std::atomic<bool>			failed{ false };
+	uint64_t					allocationsBefore;
+
+	for (int t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([&, t] {
+			CoInitializeEx(NULL, COINIT_MULTITHREADED);
+			{
+				BenchmarkIteration iteration = setup(t);
+				readyCount++;
+				while (!start)
+					std::this_thread::yield();
+
+				for (int i = 0; i < iterations; i++)
+				{
+					if (!iteration())
+					{
+						failed = true;
+						break;
+					}
+				}
+			}
+			CoUninitialize();
+		});
+	}
+
+	while (readyCount < threadCount)
+		std::this_thread::yield();
+
+	allocationsBefore = g_allocationCount.load();
+	auto startTime = std::chrono::steady_clock::now();
+	start = true;
+
+	for (auto& thread : threads)
+		thread.join();
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	result.allocations = g_allocationCount.load() - allocationsBefore;
+	result.frames = (uint64_t)threadCount * iterations;
+	result.succeeded = !failed;
+	return result;
+}
+
+// Fill a BGRA frame with colour bars over a luma ramp and a little noise, so that encoders see realistic entropy
+void FillTestPattern(IDeckLinkVideoFrame* frame)
+{
+	static const uint8_t	kBars[8][3] = {
+		{ 191, 191, 191 }, { 0, 191, 191 }, { 191, 191, 0 }, { 0, 191, 0 },
+		{ 191, 0, 191 }, { 0, 0, 191 }, { 191, 0, 0 }, { 0, 0, 0 },
+	};
+	uint8_t*				bytes = NULL;
+	uint32_t				noise = 0x12345678;
+	long					width = frame->GetWidth();
+	long					height = frame->GetHeight();
+
+	frame->GetBytes((void**)&bytes);
+
+	for (long y = 0; y < height; y++)
+	{
+		uint8_t* row = bytes + y * frame->GetRowBytes();
+		for (long x = 0; x < width; x++)
+		{
+			noise = noise * 1664525 + 1013904223;
+			int n = (noise >> 28) - 8;
+			if (y < height * 2 / 3)
+			{
+				const uint8_t* bar = kBars[(x * 8) / width];
+				row[x * 4 + 0] = (uint8_t)(std::max)(0, (std::min)(255, bar[0] + n));
+				row[x * 4 + 1] = (uint8_t)(std::max)(0, (std::min)(255, bar[1] + n));
+				row[x * 4 + 2] = (uint8_t)(std::max)(0, (std::min)(255, bar[2] + n));
+			}
+			else
+			{
+				uint8_t luma = (uint8_t)((x * 255) / (width - 1));
+				row[x * 4 + 0] = row[x * 4 + 1] = row[x * 4 + 2] = luma;
+			}
+			row[x * 4 + 3] = 255;
+		}
+	}
+}
+
+// Load <referenceDirectory>\<mode>_<tag>.raw, or synthesise the frame if it is missing
+RawVideoFrame* LoadReferenceFrame(IDeckLinkVideoConversion* converter, const std::string& referenceDirectory,
+	const ReferenceMode& mode, BMDPixelFormat pixelFormat, bool& synthetic)
+{
+	RawVideoFrame*		frame = new RawVideoFrame(mode.width, mode.height, pixelFormat, bmdFrameFlagDefault);
+	uint8_t*			bytes = NULL;
+
+	frame->GetBytes((void**)&bytes);
+
+	if (!referenceDirectory.empty())
+	{
+		std::string		filepath = referenceDirectory + "\\" + mode.name + "_" + RawVideoFrame::GetPixelFormatTag(pixelFormat) + ".raw";
+		std::ifstream	file(filepath, std::ios::binary | std::ios::ate);
+
+		if (file && (size_t)file.tellg() == frame->GetBufferSize())
+		{
+			file.seekg(0);
+			file.read((char*)bytes, frame->GetBufferSize());
+			synthetic = false;
+			return frame;
+		}
+		spdlog::warn("Reference frame {} not found or has unexpected size, synthesising", filepath);
+	}
+
+	Bgra32VideoFrame* pattern = new Bgra32VideoFrame(mode.width, mode.height, bmdFrameFlagDefault);
+	FillTestPattern(pattern);
+
+	if (pixelFormat == bmdFormat8BitBGRA)
+	{
+		uint8_t* patternBytes = NULL;
+		pattern->GetBytes((void**)&patternBytes);
+		memcpy(bytes, patternBytes, frame->GetBufferSize());
+	}
+	else if (FAILED(converter->ConvertFrame(pattern, frame)))
+	{
+		spdlog::error("Unable to synthesise {} {} reference frame", mode.name, RawVideoFrame::GetPixelFormatTag(pixelFormat));
+		frame->Release();
+		frame = NULL;
+	}
+
+	pattern->Release();
+	synthetic = true;
+	return frame;
+}
+
+Json::Value MakeResult(const char* benchmark, const ReferenceMode& mode, BMDPixelFormat pixelFormat, bool synthetic,
+	int threadCount, size_t frameBytes, const RunResult& run)
+{
+	Json::Value result;
+
+	result["benchmark"] = benchmark;
+	result["mode"] = mode.name;
+	result["width"] = (Json::Int)mode.width;
+	result["height"] = (Json::Int)mode.height;
+	result["field_dominance"] = GetFieldDominanceName(mode.fieldDominance);
+	result["pixel_format"] = RawVideoFrame::GetPixelFormatTag(pixelFormat);
+	result["source"] = synthetic ? "synthetic" : "reference";
+	result["threads"] = threadCount;
+	result["frames"] = (Json::UInt64)run.frames;
+	result["seconds"] = run.seconds;
+	result["frames_per_second"] = run.frames / run.seconds;
+	result["megabytes_per_second"] = (run.frames * (double)frameBytes) / (run.seconds * 1024.0 * 1024.0);
+	result["allocations_per_frame"] = (double)run.allocations / run.frames;
+	result["succeeded"] = run.succeeded;
+	return result;
+}
+
+// Request decoding: single-pass decoder against the jsoncpp document path, for the bodies clients actually send
+void RunProtocolBenchmarks(std::ostream& resultsStream, Json::StreamWriterBuilder& jsonBuilder, const std::vector<int>& threadCounts)
+{
+	static const int	kIterations = 100000;
+	static const std::vector<std::pair<const char*, std::string>> kBodies
+	{
+		{ "is_initialized", "{\"command\":\"IS_INITIALIZED\"}" },
+		{ "create_snapshot", "{\"command\":\"CREATE_SNAPSHOT\",\"data\":{\"output_directory\":\"C:\\\\snapshots\\\\camera1\","
+			"\"filename_prefix\":\"camera1_\",\"image_format\":\"png\"}}" },
+	};
+	static const std::vector<std::pair<const char*, bool (*)(const std::string&, Protocol::CommandRequest&)>> kDecoders
+	{
+		{ "fast", Protocol::DecodeRequestFast },
+		{ "jsoncpp", Protocol::DecodeRequestJson },
+	};
+
+	for (const auto& body : kBodies)
+	{
+		for (const auto& decoder : kDecoders)
+		{
+			for (int threadCount : threadCounts)
+			{
+				RunResult run = RunThreads(threadCount, kIterations, [&](int) -> BenchmarkIteration {
+					return [&]() {
+						Protocol::CommandRequest request;
+						return decoder.second(body.second, request);
+					};
+				});
+
+				Json::Value line;
+				line["benchmark"] = "parse_request";
+				line["body"] = body.first;
+				line["decoder"] = decoder.first;
+				line["threads"] = threadCount;
+				line["requests"] = (Json::UInt64)run.frames;
+				line["seconds"] = run.seconds;
+				line["requests_per_second"] = run.frames / run.seconds;
+				line["nanoseconds_per_request"] = (run.seconds * 1e9 * threadCount) / run.frames;
+				line["allocations_per_request"] = (double)run.allocations / run.frames;
+				line["succeeded"] = run.succeeded;
+				resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+			}
+		}
+	}
+}
+
+// Cost of one log call on the calling thread, for the synchronous file logger and the asynchronous logger used by the server
+void RunLoggingBenchmarks(std::ostream& resultsStream, Json::StreamWriterBuilder& jsonBuilder, const std::vector<int>& threadCounts,
+	const std::string& outputDirectory)
+{
+	static const int		kIterations = 20000;
+	const std::string		filepath = outputDirectory + "\\snapshots\\camera1_20200101000000.png";
+
+	for (const char* mode : { "sync", "async_block", "async_overrun" })
+	{
+		for (int threadCount : threadCounts)
+		{
+			std::shared_ptr<spdlog::details::thread_pool>	threadPool;
+			std::shared_ptr<spdlog::logger>					logger;
+			auto sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(outputDirectory + "\\benchmark_" + mode + ".log", true);
+
+			if (strcmp(mode, "sync") == 0)
+			{
+				logger = std::make_shared<spdlog::logger>("benchmark", sink);
+			}
+			else
+			{
+				threadPool = std::make_shared<spdlog::details::thread_pool>(8192, 1);
+				logger = std::make_shared<spdlog::async_logger>("benchmark", sink, threadPool,
+					(strcmp(mode, "async_block") == 0) ? spdlog::async_overflow_policy::block : spdlog::async_overflow_policy::overrun_oldest);
+			}
+			logger->set_pattern("%Y-%m-%d %H:%M:%S [%-7l] [thread %-5t] %v");
+
+			RunResult run = RunThreads(threadCount, kIterations, [&](int) -> BenchmarkIteration {
+				return [&]() {
+					logger->info("Capturing frame to {}", filepath.c_str());
+					return true;
+				};
+			});
+
+			Json::Value line;
+			line["benchmark"] = "log_call";
+			line["logger"] = mode;
+			line["threads"] = threadCount;
+			line["calls"] = (Json::UInt64)run.frames;
+			line["seconds"] = run.seconds;
+			line["nanoseconds_per_call"] = (run.seconds * 1e9 * threadCount) / run.frames;
+			line["allocations_per_call"] = (double)run.allocations / run.frames;
+			resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+		}
+	}
+}
+
+// Bytes currently held by the system file cache
+double SystemCacheMegabytes()
+{
+	PERFORMANCE_INFORMATION performanceInfo;
+
+	if (!GetPerformanceInfo(&performanceInfo, sizeof(performanceInfo)))
+		return 0.0;
+
+	return (double)performanceInfo.SystemCache * performanceInfo.PageSize / (1024.0 * 1024.0);
+}
+
+// Writing an encoded image of uncompressed BMP size, through the file cache and with unbuffered I/O.
+// The change in system file cache size over the run shows how much cache each path displaces.
+void RunFileWriteBenchmarks(std::ostream& resultsStream, Json::StreamWriterBuilder& jsonBuilder, const std::vector<int>& threadCounts,
+	const std::string& outputDirectory, int iterations)
+{
+	for (const ReferenceMode& mode : kReferenceModes)
+	{
+		size_t							imageBytes = (size_t)mode.width * mode.height * 4 + 54;
+		std::shared_ptr<MemoryStream>	image(new MemoryStream(imageBytes), [](MemoryStream* stream) { stream->Release(); });
+		std::vector<uint8_t>			pattern(imageBytes);
+
+		for (size_t i = 0; i < imageBytes; i++)
+			pattern[i] = (uint8_t)(i * 31);
+		image->Write(pattern.data(), (ULONG)imageBytes, NULL);
+
+		for (bool unbuffered : { false, true })
+		{
+			FileWriter::Configure({ FileWriter::kDurabilityNone, false, unbuffered, 0 });
+
+			for (int threadCount : threadCounts)
+			{
+				double cacheBefore = SystemCacheMegabytes();
+
+				RunResult run = RunThreads(threadCount, iterations, [&](int t) -> BenchmarkIteration {
+					std::string filepath = outputDirectory + "\\benchmark_write_" + std::to_string(t) + ".bmp";
+					return [=]() {
+						return SUCCEEDED(FileWriter::WriteFileAtomic(filepath, image->GetData(), image->GetSize()));
+					};
+				});
+
+				double cacheAfter = SystemCacheMegabytes();
+
+				Json::Value line;
+				line["benchmark"] = "write_file";
+				line["mode"] = mode.name;
+				line["io"] = unbuffered ? "unbuffered" : "buffered";
+				line["bytes"] = (Json::UInt64)imageBytes;
+				line["threads"] = threadCount;
+				line["files"] = (Json::UInt64)run.frames;
+				line["seconds"] = run.seconds;
+				line["megabytes_per_second"] = (run.frames * (double)imageBytes) / (run.seconds * 1024.0 * 1024.0);
+				line["system_cache_growth_megabytes"] = cacheAfter - cacheBefore;
+				line["succeeded"] = run.succeeded;
+				resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+			}
+		}
+	}
+
+	FileWriter::Configure({ FileWriter::kDurabilityNone, false, false, 0 });
+}
+
+std::vector<int> ParseThreadCounts(const char* arg)
+{
+	std::vector<int>	threadCounts;
+	std::stringstream	ss(arg);
+	std::string			item;
+
+	while (std::getline(ss, item, ','))
+	{
+		int count = atoi(item.c_str());
+		if (count > 0)
+			threadCounts.push_back(count);
+	}
+	return threadCounts;
+}
+
+int main(int argc, char* argv[])
+{
+	// Configuration Flags
+	std::string					referenceDirectory = "";
+	std::string					outputDirectory = "";
+	std::string					resultsFilepath = "";
+	int							iterations = 20;
+	std::vector<int>			threadCounts = { 1, 2, 4 };
+	int							logLevel = spdlog::level::info;
+
+	HRESULT						result;
+	int							exitStatus = 1;
+	IDeckLinkVideoConversion*	deckLinkFrameConverter = NULL;
+	Json::StreamWriterBuilder	jsonBuilder;
+	std::ofstream				resultsFile;
+	std::ostream*				resultsStream = &std::cout;
+
+	// Get command line options
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--reference-dir") == 0)
+			referenceDirectory = argv[++i];
+
+		else if (strcmp(argv[i], "--output-dir") == 0)
+			outputDirectory = argv[++i];
+
+		else if (strcmp(argv[i], "--results") == 0)
+			resultsFilepath = argv[++i];
+
+		else if (strcmp(argv[i], "--iterations") == 0)
+			iterations = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--threads") == 0)
+			threadCounts = ParseThreadCounts(argv[++i]);
+
+		else if (strcmp(argv[i], "--log-level") == 0)
+			logLevel = atoi(argv[++i]);
+	}
+
+	// Results go to stdout (or --results), diagnostics to stderr
+	spdlog::set_default_logger(spdlog::stderr_color_mt("SnapShotCreatorBenchmark"));
+	spdlog::set_level(static_cast<spdlog::level::level_enum>(logLevel));
+
+	if (iterations <= 0 || threadCounts.empty())
+	{
+		fprintf(stderr, "Usage: SnapShotCreatorBenchmark.exe --output-dir <directory> [--reference-dir <directory>] [--results <file>] [--iterations <n>] [--threads <n,n,...>]\n");
+		return exitStatus;
+	}
+	if (outputDirectory.empty() || !IsPathDirectory(outputDirectory))
+	{
+		fprintf(stderr, "You must set a valid output directory for encoded images\n");
+		return exitStatus;
+	}
+	if (!resultsFilepath.empty())
+	{
+		resultsFile.open(resultsFilepath, std::ios::out | std::ios::trunc);
+		if (!resultsFile)
+		{
+			fprintf(stderr, "Unable to open results file: %s\n", resultsFilepath.c_str());
+			return exitStatus;
+		}
+		resultsStream = &resultsFile;
+	}
+
+	// One JSON object per line
+	jsonBuilder["indentation"] = "";
+
+	result = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	if (FAILED(result))
+	{
+		spdlog::error("Initialization of COM failed");
+		return exitStatus;
+	}
+
+	if (FAILED(ImageWriter::Initialize()) || GetDeckLinkVideoConversion(&deckLinkFrameConverter) != S_OK)
+		goto bail;
+
+	RunProtocolBenchmarks(*resultsStream, jsonBuilder, threadCounts);
+	RunLoggingBenchmarks(*resultsStream, jsonBuilder, threadCounts, outputDirectory);
+	RunFileWriteBenchmarks(*resultsStream, jsonBuilder, threadCounts, outputDirectory, iterations);
+
+	for (const ReferenceMode& mode : kReferenceModes)
+	{
+		for (const auto& supportedPixelFormat : kSupportedPixelFormats)
+		{
+			BMDPixelFormat		pixelFormat = std::get<kPixelFormatValue>(supportedPixelFormat);
+			bool				synthetic = true;
+			RawVideoFrame*		referenceFrame = LoadReferenceFrame(deckLinkFrameConverter, referenceDirectory, mode, pixelFormat, synthetic);
+
+			if (referenceFrame == NULL)
+				continue;
+
+			// Conversion: native pixel format -> 8-bit BGRA, each thread with its own converter and destination frame
+			for (int threadCount : threadCounts)
+			{
+				RunResult run = RunThreads(threadCount, iterations, [&](int) -> BenchmarkIteration {
+					std::shared_ptr<IDeckLinkVideoConversion> converter;
+					std::shared_ptr<Bgra32VideoFrame> bgraFrame(new Bgra32VideoFrame(mode.width, mode.height, bmdFrameFlagDefault),
+						[](Bgra32VideoFrame* frame) { frame->Release(); });
+					IDeckLinkVideoConversion* threadConverter = NULL;
+
+					if (GetDeckLinkVideoConversion(&threadConverter) == S_OK)
+						converter.reset(threadConverter, [](IDeckLinkVideoConversion* c) { c->Release(); });
+
+					return [=]() {
+						return converter && SUCCEEDED(converter->ConvertFrame(referenceFrame, bgraFrame.get()));
+					};
+				});
+
+				*resultsStream << Json::writeString(jsonBuilder,
+					MakeResult("convert", mode, pixelFormat, synthetic, threadCount, referenceFrame->GetBufferSize(), run)) << std::endl;
+			}
+
+			// Conversions run with the field dominance of the mode, as CaptureStills does, without deinterlacing unless asked
+			PixelConverter::Rect wholeFrame = { 0, 0, mode.width, mode.height };
+
+			// 16-bit conversion: native pixel format -> 16-bit RGB, rows of each frame also split across the converter's threads
+			for (int threadCount : threadCounts)
+			{
+				RunResult run = RunThreads(threadCount, iterations, [&](int) -> BenchmarkIteration {
+					std::shared_ptr<Rgb48VideoFrame> rgbFrame(new Rgb48VideoFrame(mode.width, mode.height, bmdFrameFlagDefault),
+						[](Rgb48VideoFrame* frame) { frame->Release(); });
+
+					return [=]() {
+						return SUCCEEDED(PixelConverter::ConvertFrame(referenceFrame, wholeFrame, rgbFrame.get(), PixelConverter::kDeinterlaceNone, mode.fieldDominance));
+					};
+				});
+
+				*resultsStream << Json::writeString(jsonBuilder,
+					MakeResult("convert_rgb48", mode, pixelFormat, synthetic, threadCount, referenceFrame->GetBufferSize(), run)) << std::endl;
+			}
+
+			// Deinterlacing fused with the 8-bit conversion, progressive modes measure the requested but skipped deinterlacing
+			for (PixelConverter::Deinterlace deinterlace : { PixelConverter::kDeinterlaceField, PixelConverter::kDeinterlaceBlend, PixelConverter::kDeinterlaceAdaptive })
+			{
+				RunResult run = RunThreads(1, iterations, [&](int) -> BenchmarkIteration {
+					std::shared_ptr<Bgra32VideoFrame> bgraFrame(new Bgra32VideoFrame(mode.width, mode.height, bmdFrameFlagDefault),
+						[](Bgra32VideoFrame* frame) { frame->Release(); });
+
+					return [=]() {
+						return SUCCEEDED(PixelConverter::ConvertFrame(referenceFrame, wholeFrame, bgraFrame.get(), deinterlace, mode.fieldDominance));
+					};
+				});
+
+				const char* deinterlaceNames[] = { "none", "field", "blend", "adaptive" };
+				Json::Value line = MakeResult("convert_deinterlace", mode, pixelFormat, synthetic, 1, referenceFrame->GetBufferSize(), run);
+				line["deinterlace"] = deinterlaceNames[deinterlace];
+				*resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+			}
+
+			// Thumbnails: conversion fused with area averaging down to dashboard preview widths
+			for (long thumbnailWidth : { 320L, 640L })
+			{
+				long thumbnailHeight = mode.height * thumbnailWidth / mode.width;
+
+				for (int threadCount : threadCounts)
+				{
+					RunResult run = RunThreads(threadCount, iterations, [&](int) -> BenchmarkIteration {
+						std::shared_ptr<Bgra32VideoFrame> thumbnailFrame(new Bgra32VideoFrame(thumbnailWidth, thumbnailHeight, bmdFrameFlagDefault),
+							[](Bgra32VideoFrame* frame) { frame->Release(); });
+
+						return [=]() {
+							return SUCCEEDED(PixelConverter::ConvertFrame(referenceFrame, wholeFrame, thumbnailFrame.get(), PixelConverter::kDeinterlaceNone, mode.fieldDominance));
+						};
+					});
+
+					Json::Value line = MakeResult("convert_thumbnail", mode, pixelFormat, synthetic, threadCount, referenceFrame->GetBufferSize(), run);
+					line["thumbnail_width"] = (Json::Int)thumbnailWidth;
+					*resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+				}
+			}
+
+			// Region of interest: a logo sized rectangle, starting inside a packing group, should cost a fraction of the frame
+			{
+				PixelConverter::Rect region = { 101, 37, 256, 128 };
+
+				for (int threadCount : threadCounts)
+				{
+					RunResult run = RunThreads(threadCount, iterations, [&](int) -> BenchmarkIteration {
+						std::shared_ptr<Bgra32VideoFrame> regionFrame(new Bgra32VideoFrame(region.width, region.height, bmdFrameFlagDefault),
+							[](Bgra32VideoFrame* frame) { frame->Release(); });
+
+						return [=]() {
+							return SUCCEEDED(PixelConverter::ConvertFrame(referenceFrame, region, regionFrame.get(), PixelConverter::kDeinterlaceNone, mode.fieldDominance));
+						};
+					});
+
+					Json::Value line = MakeResult("convert_roi", mode, pixelFormat, synthetic, threadCount, referenceFrame->GetBufferSize(), run);
+					line["roi_width"] = (Json::Int)region.width;
+					line["roi_height"] = (Json::Int)region.height;
+					*resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+				}
+			}
+
+			// Fingerprint: exact hash of the whole buffer plus the sampled perceptual hash, paid on every snapshot
+			for (int threadCount : threadCounts)
+			{
+				RunResult run = RunThreads(threadCount, iterations, [&](int) -> BenchmarkIteration {
+					return [=]() {
+						FrameHash::Fingerprint fingerprint;
+						return SUCCEEDED(FrameHash::Compute(referenceFrame, fingerprint));
+					};
+				});
+
+				*resultsStream << Json::writeString(jsonBuilder,
+					MakeResult("fingerprint", mode, pixelFormat, synthetic, threadCount, referenceFrame->GetBufferSize(), run)) << std::endl;
+			}
+
+			// Level statistics of the whole frame, histograms and gamut check on the native code values
+			{
+				RunResult run = RunThreads(1, iterations, [&](int) -> BenchmarkIteration {
+					return [=]() {
+						FrameStatistics::Statistics statistics;
+						return SUCCEEDED(FrameStatistics::Compute(referenceFrame, { 0, 0, referenceFrame->GetWidth(), referenceFrame->GetHeight() }, statistics));
+					};
+				});
+
+				*resultsStream << Json::writeString(jsonBuilder,
+					MakeResult("frame_statistics", mode, pixelFormat, synthetic, 1, referenceFrame->GetBufferSize(), run)) << std::endl;
+			}
+
+			// Signal analysis of one frame, paid on the capture callback thread for every Nth frame
+			{
+				SignalAnalyzer::Options analyzerOptions;
+				analyzerOptions.interval = 1;
+				SignalAnalyzer::Start(analyzerOptions, SignalAnalyzer::SnapshotHandler());
+
+				RunResult run = RunThreads(1, iterations, [&](int) -> BenchmarkIteration {
+					return [=]() {
+						SignalAnalyzer::FrameArrived(referenceFrame, true);
+						return true;
+					};
+				});
+
+				SignalAnalyzer::Stop();
+				*resultsStream << Json::writeString(jsonBuilder,
+					MakeResult("signal_analysis", mode, pixelFormat, synthetic, 1, referenceFrame->GetBufferSize(), run)) << std::endl;
+			}
+
+			// Motion comparison of one frame, paid on the capture callback thread for every frame while the trigger runs.
+			// The frame never changes, so nothing fires and only the comparison is measured.
+			{
+				MotionTrigger::Options triggerOptions;
+				triggerOptions.threshold = 1.0;
+				MotionTrigger::Start(triggerOptions, MotionTrigger::CaptureHandler());
+
+				RunResult run = RunThreads(1, iterations, [&](int) -> BenchmarkIteration {
+					return [=]() {
+						MotionTrigger::FrameArrived(referenceFrame);
+						return true;
+					};
+				});
+
+				MotionTrigger::Stop();
+				*resultsStream << Json::writeString(jsonBuilder,
+					MakeResult("motion_trigger", mode, pixelFormat, synthetic, 1, referenceFrame->GetBufferSize(), run)) << std::endl;
+			}
+
+			// Accumulation of 8 frames into one, the adds are paid as frames arrive and the result once per request
+			for (FrameAccumulator::Mode accumulateMode : { FrameAccumulator::kModeMean, FrameAccumulator::kModeMedian })
+			{
+				RunResult run = RunThreads(1, iterations, [&](int) -> BenchmarkIteration {
+					return [=]() {
+						FrameAccumulator accumulator(accumulateMode);
+						IDeckLinkVideoFrame* resultFrame = NULL;
+
+						for (int i = 0; i < 8; i++)
+						{
+							if (accumulator.Add(referenceFrame) != S_OK)
+								return false;
+						}
+						if (accumulator.GetResult(&resultFrame) != S_OK)
+							return false;
+
+						resultFrame->Release();
+						return true;
+					};
+				});
+
+				Json::Value line = MakeResult("frame_accumulate", mode, pixelFormat, synthetic, 1, referenceFrame->GetBufferSize(), run);
+				line["accumulate_mode"] = (accumulateMode == FrameAccumulator::kModeMedian) ? "median" : "mean";
+				line["accumulated_frames"] = 8;
+				*resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+			}
+
+			// Encoding is independent of the source pixel format, so only measure it once per mode
+			if (pixelFormat == bmdFormat8BitBGRA)
+			{
+				for (const std::string& imageFormat : supportedImageFormats)
+				{
+					// Measured below from a burst of frames
+					if (std::find(animatedImageFormats.begin(), animatedImageFormats.end(), imageFormat) != animatedImageFormats.end())
+						continue;
+
+					for (int threadCount : threadCounts)
+					{
+						RunResult run = RunThreads(threadCount, iterations, [&](int t) -> BenchmarkIteration {
+							std::string filepath = outputDirectory + "\\benchmark_" + std::to_string(t) + "." + imageFormat;
+							return [=]() {
+								return SUCCEEDED(ImageWriter::WriteVideoFrameToImage(referenceFrame, filepath, imageFormat));
+							};
+						});
+
+						Json::Value line = MakeResult("encode", mode, pixelFormat, synthetic, threadCount, referenceFrame->GetBufferSize(), run);
+						line["image_format"] = imageFormat;
+						*resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+					}
+				}
+
+				// Animated images of 20 half size frames with a moving box, so that every frame differs from the one before
+				// in part only. Frames are encoded in parallel inside the writer, one request at a time.
+				std::vector<IDeckLinkVideoFrame*> animationFrames;
+				for (int i = 0; i < 20; i++)
+				{
+					void* frameBytes = NULL;
+					Bgra32VideoFrame* animationFrame = new Bgra32VideoFrame(mode.width / 2, mode.height / 2, bmdFrameFlagDefault);
+					PixelConverter::ConvertFrame(referenceFrame, animationFrame);
+					animationFrame->GetBytes(&frameBytes);
+					for (long y = 0; y < animationFrame->GetHeight() / 8; y++)
+						memset((uint8_t*)frameBytes + (size_t)y * animationFrame->GetRowBytes() + (size_t)i * 8 * 4, 0xff, 64 * 4);
+					animationFrames.push_back(animationFrame);
+				}
+
+				for (const std::string& imageFormat : animatedImageFormats)
+				{
+					RunResult run = RunThreads(1, iterations, [&](int t) -> BenchmarkIteration {
+						std::string filepath = outputDirectory + "\\benchmark_" + std::to_string(t) + "." + imageFormat;
+						return [=]() {
+							return SUCCEEDED(ImageWriter::WriteAnimation(animationFrames, 10.0, filepath, imageFormat));
+						};
+					});
+
+					Json::Value line = MakeResult("encode_animation", mode, pixelFormat, synthetic, 1, referenceFrame->GetBufferSize(), run);
+					line["image_format"] = imageFormat;
+					line["animation_frames"] = (Json::Int)animationFrames.size();
+					*resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+				}
+
+				for (IDeckLinkVideoFrame* animationFrame : animationFrames)
+					animationFrame->Release();
+
+				// 16-bit encoding, from the same picture widened to 16 bits per channel
+				Rgb48VideoFrame* rgbFrame = new Rgb48VideoFrame(mode.width, mode.height, bmdFrameFlagDefault);
+				PixelConverter::ConvertFrame(referenceFrame, rgbFrame);
+
+				for (const std::string imageFormat : { "png", "tiff" })
+				{
+					for (int threadCount : threadCounts)
+					{
+						RunResult run = RunThreads(threadCount, iterations, [&](int t) -> BenchmarkIteration {
+							std::string filepath = outputDirectory + "\\benchmark_rgb48_" + std::to_string(t) + "." + imageFormat;
+							return [=]() {
+								return SUCCEEDED(ImageWriter::WriteVideoFrameToImage(rgbFrame, filepath, imageFormat));
+							};
+						});
+
+						Json::Value line = MakeResult("encode_rgb48", mode, pixelFormat, synthetic, threadCount, referenceFrame->GetBufferSize(), run);
+						line["image_format"] = imageFormat;
+						*resultsStream << Json::writeString(jsonBuilder, line) << std::endl;
+					}
+				}
+
+				rgbFrame->Release();
+			}
+
+			referenceFrame->Release();
+		}
+	}
+
+	// A full disk or an unwritable results file must not pass for a complete run
+	if (resultsFile.is_open())
+		resultsFile.close();
+	else
+		resultsStream->flush();
+	if (resultsStream->fail())
+	{
+		fprintf(stderr, "Unable to write results%s%s\n", resultsFilepath.empty() ? "" : " file: ", resultsFilepath.c_str());
+		goto bail;
+	}
+
+	exitStatus = 0;
+
+bail:
+	if (deckLinkFrameConverter != NULL)
+	{
+		deckLinkFrameConverter->Release();
+		deckLinkFrameConverter = NULL;
+	}
+	ImageWriter::UnInitialize();
+	CoUninitialize();
+	return exitStatus;
+}
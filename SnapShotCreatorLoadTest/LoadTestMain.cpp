@@ -0,0 +1,280 @@
+#include <httplib.h>
+#include <Windows.h>
+#include <stdio.h>
+#include <json/json.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+typedef std::chrono::steady_clock	Clock;
+
+// Outcome of one request. Latencies are in microseconds.
+struct Sample
+{
+	double			correctedLatency;	// from the scheduled send time, includes time spent queued behind slow requests
+	double			serviceLatency;		// from the actual send time only
+	std::string		outcome;			// "OK", the server error code, or "transport"
+};
+
+std::string ClassifyResponse(const std::shared_ptr<httplib::Response>& res)
+{
+	Json::CharReaderBuilder					jsonBuilder;
+	const std::unique_ptr<Json::CharReader>	jsonReader(jsonBuilder.newCharReader());
+	Json::Value								root;
+	std::string								err;
+
+	if (!res)
+		return "transport";
+
+	if (!jsonReader->parse(res->body.c_str(), res->body.c_str() + res->body.length(), &root, &err))
+		return "http_" + std::to_string(res->status);
+
+	if (root["response"].asString() == "OK")
+		return "OK";
+
+	// 900/910/911/912/990/999 as defined by ErrorCode in the server
+	return std::to_string(root["body"].get("code", 0).asInt());
+}
+
+Json::Value Percentiles(std::vector<double> latencies)
+{
+	static const double		kPercentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	Json::Value				result;
+
+	if (latencies.empty())
+		return result;
+
+	std::sort(latencies.begin(), latencies.end());
+	for (double percentile : kPercentiles)
+	{
+		size_t index = (size_t)((percentile / 100.0) * (latencies.size() - 1) + 0.5);
+		char key[16];
+		snprintf(key, sizeof(key), "p%g", percentile);
+		result[key] = latencies[index] / 1000.0;
+	}
+	result["max"] = latencies.back() / 1000.0;
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	// Configuration Flags
+	std::string					host = "localhost";
+	int							portNo = -1;
+	std::string					command = "IS_INITIALIZED";
+	std::string					captureDirectory = "";
+	std::string					filenamePrefix = "loadtest_";
+	std::string					imageFormat = "bmp";
+	std::string					resultsFilepath = "";
+	int							concurrency = 1;
+	double						rate = 0.0;
+	int							durationSeconds = 10;
+	double						sloP99 = 0.0;			// milliseconds of corrected p99 latency, 0 for no limit
+	double						maxErrorRate = 1.0;		// share of requests without an OK response, 1 for no limit
+
+	int							exitStatus = 1;
+	std::string					requestBody;
+	std::vector<std::thread>	workers;
+	std::vector<Sample>			samples;
+	std::mutex					samplesMutex;
+	std::atomic<uint64_t>		nextRequest{ 0 };
+	std::ofstream				resultsFile;
+
+	// Get command line options
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--host") == 0)
+			host = argv[++i];
+
+		else if (strcmp(argv[i], "-p") == 0)
+			portNo = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--command") == 0)
+			command = argv[++i];
+
+		else if (strcmp(argv[i], "--output-dir") == 0)
+			captureDirectory = argv[++i];
+
+		else if (strcmp(argv[i], "--prefix") == 0)
+			filenamePrefix = argv[++i];
+
+		else if (strcmp(argv[i], "--image-format") == 0)
+			imageFormat = argv[++i];
+
+		else if (strcmp(argv[i], "--concurrency") == 0)
+			concurrency = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--rate") == 0)
+			rate = atof(argv[++i]);
+
+		else if (strcmp(argv[i], "--duration") == 0)
+			durationSeconds = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "--results") == 0)
+			resultsFilepath = argv[++i];
+
+		else if (strcmp(argv[i], "--slo-p99") == 0)
+			sloP99 = atof(argv[++i]);
+
+		else if (strcmp(argv[i], "--max-error-rate") == 0)
+			maxErrorRate = atof(argv[++i]);
+	}
+
+	if ((portNo > 65535) || (portNo < 2000) || (concurrency <= 0) || (durationSeconds <= 0) || (rate < 0.0) ||
+		(sloP99 < 0.0) || !((maxErrorRate >= 0.0) && (maxErrorRate <= 1.0)))
+	{
+		fprintf(stderr, "Usage: SnapShotCreatorLoadTest.exe -p <port> [--host <host>] [--command IS_INITIALIZED|CREATE_SNAPSHOT]\n"
+			"    [--output-dir <directory>] [--prefix <filename prefix>] [--image-format <format>]\n"
+			"    [--concurrency <clients>] [--rate <requests per second, 0 = as fast as possible>] [--duration <seconds>] [--results <file>]\n"
+			"    [--slo-p99 <corrected p99 latency in ms, 0 = none>] [--max-error-rate <share of failed requests, 0 to 1>]\n"
+			"Exits with 2 if the run misses the latency or error rate objective.\n");
+		return exitStatus;
+	}
+
+	// Build the request once, every client sends the same body
+	{
+		Json::StreamWriterBuilder	jsonBuilder;
+		Json::Value					root;
+
+		jsonBuilder["indentation"] = "";
+		root["command"] = command;
+		if (command == "CREATE_SNAPSHOT")
+		{
+			root["data"]["output_directory"] = captureDirectory;
+			root["data"]["filename_prefix"] = filenamePrefix;
+			root["data"]["image_format"] = imageFormat;
+		}
+		requestBody = Json::writeString(jsonBuilder, root);
+	}
+
+	// Open the results file up front, so that a bad path fails before the run instead of discarding it
+	if (!resultsFilepath.empty())
+	{
+		resultsFile.open(resultsFilepath, std::ios::out | std::ios::trunc);
+		if (!resultsFile.is_open())
+		{
+			fprintf(stderr, "Could not open results file %s\n", resultsFilepath.c_str());
+			return exitStatus;
+		}
+	}
+
+	const Clock::time_point startTime = Clock::now();
+	const Clock::time_point endTime = startTime + std::chrono::seconds(durationSeconds);
+
+	for (int t = 0; t < concurrency; t++)
+	{
+		workers.emplace_back([&] {
+			httplib::Client			client(host.c_str(), portNo);
+			std::vector<Sample>		localSamples;
+
+			while (true)
+			{
+				// Open loop: request n is due at start + n/rate regardless of how long earlier requests took,
+				// so latency measured from the due time is free of coordinated omission.
+				uint64_t			n = nextRequest.fetch_add(1);
+				Clock::time_point	scheduled = (rate > 0.0)
+					? startTime + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(n / rate))
+					: Clock::now();
+
+				if (scheduled >= endTime)
+					break;
+				std::this_thread::sleep_until(scheduled);
+
+				Clock::time_point	sent = Clock::now();
+				auto				res = client.Post("/", requestBody, "application/json");
+				Clock::time_point	received = Clock::now();
+
+				localSamples.push_back({
+					std::chrono::duration<double, std::micro>(received - scheduled).count(),
+					std::chrono::duration<double, std::micro>(received - sent).count(),
+					ClassifyResponse(res)
+				});
+			}
+
+			std::lock_guard<std::mutex> lock(samplesMutex);
+			samples.insert(samples.end(), localSamples.begin(), localSamples.end());
+		});
+	}
+
+	for (auto& worker : workers)
+		worker.join();
+
+	double elapsedSeconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+	// Report
+	bool sloPassed = true;
+	{
+		Json::StreamWriterBuilder	jsonBuilder;
+		Json::Value					report;
+		std::vector<double>			corrected;
+		std::vector<double>			service;
+		std::map<std::string, int>	outcomes;
+		uint64_t					errors = 0;
+
+		for (const Sample& sample : samples)
+		{
+			corrected.push_back(sample.correctedLatency);
+			service.push_back(sample.serviceLatency);
+			outcomes[sample.outcome]++;
+			if (sample.outcome != "OK")
+				errors++;
+		}
+
+		report["command"] = command;
+		report["concurrency"] = concurrency;
+		report["target_rate"] = rate;
+		report["duration_seconds"] = elapsedSeconds;
+		report["requests"] = (Json::UInt64)samples.size();
+		report["throughput"] = samples.size() / elapsedSeconds;
+		report["latency_ms"]["corrected"] = Percentiles(corrected);
+		report["latency_ms"]["uncorrected"] = Percentiles(service);
+		for (const auto& outcome : outcomes)
+			report["outcomes"][outcome.first] = outcome.second;
+
+		// Service level objective, a run without any request only passes without limits
+		double errorRate = samples.empty() ? 1.0 : (double)errors / samples.size();
+		bool p99Passed = (sloP99 == 0.0) || (!samples.empty() && (report["latency_ms"]["corrected"]["p99"].asDouble() <= sloP99));
+		bool errorRatePassed = (errorRate <= maxErrorRate);
+
+		sloPassed = p99Passed && errorRatePassed;
+		report["error_rate"] = errorRate;
+		report["slo"]["p99_ms"] = sloP99;
+		report["slo"]["p99_passed"] = p99Passed;
+		report["slo"]["max_error_rate"] = maxErrorRate;
+		report["slo"]["error_rate_passed"] = errorRatePassed;
+		report["slo"]["passed"] = sloPassed;
+
+		if (resultsFilepath.empty())
+		{
+			std::cout << Json::writeString(jsonBuilder, report) << std::endl;
+		}
+		else
+		{
+			resultsFile << Json::writeString(jsonBuilder, report) << std::endl;
+			resultsFile.close();
+			if (resultsFile.fail())
+			{
+				fprintf(stderr, "Could not write results file %s\n", resultsFilepath.c_str());
+				return exitStatus;
+			}
+		}
+	}
+
+	if (!sloPassed)
+	{
+		fprintf(stderr, "Service level objective missed\n");
+		return 2;
+	}
+
+	exitStatus = 0;
+	return exitStatus;
+}